@@ -59,9 +59,15 @@ static void cb(stratum_response_t *res, int socket) {
 
 int main(void) {
     int socket = socket_init(hostname, port);
-    stratum_mining_subscribe(socket, "dummy useragent", "null", hostname, port,
-                             cb);
-    stratum_mining_authorize(socket, username, "", cb);
+
+    if (socket == -1)
+        errx(EXIT_FAILURE, "Failed to connect to %s:%s", hostname, port);
+
+    if (stratum_mining_subscribe(socket, "dummy useragent", "null", hostname,
+                                 port, cb) == -1 ||
+        stratum_mining_authorize(socket, username, "", cb) == -1)
+        errx(EXIT_FAILURE, "Lost the connection to %s:%s", hostname, port);
+
     // A mock submission - obviously invalid.
     printf("Submitting a mock submission\n");
     stratum_mining_submit(socket, username, "69", "420", "101", "foo", cb);
@@ -0,0 +1,89 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_BITCOIN_H
+#define LIBSTRATUM_BITCOIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libstratum/job.h"
+#include "libstratum/session.h"
+#include "libstratum/sha256.h"
+#include "libstratum/stratum.h"
+#include "libstratum/target.h"
+
+// VERSION || PREVHASH || MERKLEROOT || TIME || BITS || NONCE
+#define STRATUM_BITCOIN_HEADER_SIZE 80
+// Offsets of the fields the miner fills in.
+#define STRATUM_BITCOIN_HEADER_MERKLE_ROOT 36
+#define STRATUM_BITCOIN_HEADER_TIME 68
+#define STRATUM_BITCOIN_HEADER_NONCE 76
+
+#define STRATUM_BITCOIN_COINBASE_SIZE 4096
+// Enough for blocks of up to 2^32 transactions.
+#define STRATUM_BITCOIN_MAX_BRANCHES 32
+
+/**
+ * A Bitcoin-style stratum v1 `mining.notify` job, which sends the coinbase
+ * transaction split around the extranonces and the merkle branches instead
+ * of a merkle root.
+ **/
+typedef struct {
+    char job_id[STRATUM_JOB_ID_SIZE + 1];
+    // In block order, the merkle root is left zeroed.
+    uint8_t header[STRATUM_BITCOIN_HEADER_SIZE];
+
+    // COINB1 || EXTRANONCE_1 || EXTRANONCE_2 || COINB2, EXTRANONCE_2 zeroed.
+    uint8_t coinbase[STRATUM_BITCOIN_COINBASE_SIZE];
+    uint16_t coinbase_size;
+    uint16_t nonce_2_offset;
+    uint8_t nonce_2_size;
+    // SHA-256 of the whole blocks before EXTRANONCE_2, shared by every roll.
+    stratum_sha256_t midstate;
+
+    uint8_t branches[STRATUM_BITCOIN_MAX_BRANCHES][32];
+    uint8_t nbranches;
+
+    uint8_t clean;
+    // The session's target for this job, if the server sent one.
+    uint8_t has_target;
+    stratum_target_t target;
+} stratum_bitcoin_job_t;
+
+/**
+ * Decode the Bitcoin-style `mining.notify` notification `res` into `job`,
+ * using the EXTRANONCE_1, EXTRANONCE_2_SIZE and target of `session` which
+ * MUST have handled `res` already.
+ * Returns -1 if `res` is not a valid Bitcoin-style `mining.notify`.
+ **/
+int stratum_bitcoin_job_from_notify(stratum_bitcoin_job_t *job,
+                                    const stratum_response_t *res,
+                                    const stratum_session_t *session);
+
+/**
+ * Compute the merkle roots of `job` for `n` EXTRANONCE_2 values of
+ * `job->nonce_2_size` bytes each, stored back to back in `nonce_2`.
+ * Only the coinbase blocks holding EXTRANONCE_2 are hashed for each value,
+ * several values at a time, see `stratum_sha256d_many()`.
+ **/
+void stratum_bitcoin_merkle_roots(const stratum_bitcoin_job_t *job,
+                                  const uint8_t *nonce_2, size_t n,
+                                  uint8_t (*roots)[32]);
+
+/* the header of `job` for the EXTRANONCE_2 `nonce_2`, the nonce is zeroed */
+void stratum_bitcoin_header(const stratum_bitcoin_job_t *job,
+                            const uint8_t *nonce_2,
+                            uint8_t header[STRATUM_BITCOIN_HEADER_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_BITCOIN_H */
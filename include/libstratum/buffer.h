@@ -0,0 +1,48 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_BUFFER_H
+#define LIBSTRATUM_BUFFER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} stratum_buffer_t;
+
+/* initialize an empty buffer, no memory is allocated until needed */
+void stratum_buffer_init(stratum_buffer_t *buf);
+
+/* free the memory owned by `buf` and reset it to an empty buffer */
+void stratum_buffer_free(stratum_buffer_t *buf);
+
+/* make room for at least `size` more bytes, returns -1 on failure */
+int stratum_buffer_reserve(stratum_buffer_t *buf, size_t size);
+
+/* append `size` bytes of `data` to `buf`, returns -1 on failure */
+int stratum_buffer_append(stratum_buffer_t *buf, const void *data, size_t size);
+
+/* drop the first `size` bytes of `buf` */
+void stratum_buffer_consume(stratum_buffer_t *buf, size_t size);
+
+/**
+ * Return the next '\n' terminated line found at or after `*offset`, with the
+ * terminator replaced by '\0', and advance `*offset` past it.
+ * Returns NULL when no complete line is left, the caller should then
+ * `stratum_buffer_consume(buf, *offset)` to drop the lines it has handled.
+ **/
+char *stratum_buffer_next_line(stratum_buffer_t *buf, size_t *offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_BUFFER_H */
@@ -0,0 +1,90 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_CAPTURE_H
+#define LIBSTRATUM_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libstratum/stratum.h"
+
+#define STRATUM_CAPTURE_MAGIC "STRCAP01"
+
+typedef enum {
+    STRATUM_CAPTURE_RX = 0,
+    STRATUM_CAPTURE_TX = 1,
+} stratum_capture_dir_t;
+
+/**
+ * A capture is the 8 bytes of STRATUM_CAPTURE_MAGIC followed by records,
+ * each one being this little-endian header and `size` bytes of raw traffic
+ * exactly as read from or sent to the socket (not necessarily whole lines).
+ **/
+typedef struct {
+    // CLOCK_REALTIME, in nanoseconds.
+    uint64_t time;
+    uint32_t size;
+    uint16_t socket;
+    uint8_t dir;
+    uint8_t reserved;
+} stratum_capture_record_t;
+
+/**
+ * Append the traffic of every socket (`socket_read()`, `socket_send()` and
+ * `stratum_client_t`) to the capture at `path`, created if needed.
+ * Returns -1 on failure. Safe to call from any thread.
+ **/
+int stratum_capture_open(const char *path);
+
+/* stop capturing, the capture is closed once the writes in progress are done */
+void stratum_capture_close(void);
+
+/* record `size` bytes of `data` going `dir` on `socket`, if capturing */
+void stratum_capture_write(int socket, stratum_capture_dir_t dir,
+                           const void *data, size_t size);
+
+typedef enum {
+    // Sleep between records to reproduce the original timing.
+    STRATUM_REPLAY_PACED = 1 << 0,
+} stratum_replay_flags_t;
+
+typedef struct {
+    uint64_t records;
+    uint64_t bytes;
+    // Received lines parsed and handed to the callback.
+    uint64_t lines;
+    // Received lines `stratum_parse_response()` failed on.
+    uint64_t errors;
+    // Wall time taken by the replay.
+    uint64_t elapsed_ns;
+} stratum_replay_stats_t;
+
+typedef struct stratum_replay stratum_replay_t;
+
+/* map the capture at `path`, returns NULL if it cannot be read */
+stratum_replay_t *stratum_replay_open(const char *path);
+
+void stratum_replay_close(stratum_replay_t *replay);
+
+/**
+ * Feed every received line of the capture through `stratum_parse_response()`
+ * and `cb` (which MAY be NULL), as `stratum_send_and_handle_data()` would,
+ * including updating the session attached to the recorded socket number.
+ * Unparsable lines are counted and skipped. `stats` MAY be NULL.
+ * Returns -1 if the capture is truncated or corrupted.
+ **/
+int stratum_replay_run(stratum_replay_t *replay, int flags, stratum_cb_t cb,
+                       stratum_replay_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_CAPTURE_H */
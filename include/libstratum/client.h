@@ -0,0 +1,156 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_CLIENT_H
+#define LIBSTRATUM_CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netdb.h>
+
+#include "libstratum/loop.h"
+#include "libstratum/session.h"
+#include "libstratum/stratum.h"
+
+// Requests with a reply callback that may be waiting for it at once.
+#define STRATUM_CLIENT_MAX_INFLIGHT 256
+
+typedef struct stratum_client stratum_client_t;
+
+/**
+ * Called with the server's reply to a request, `res` is freed once the
+ * callback returns. `res` is NULL if the connection was lost or the request
+ * timed out before the reply arrived.
+ **/
+typedef void (*stratum_client_reply_cb_t)(stratum_client_t *client,
+                                          stratum_response_t *res, void *arg);
+
+/* called for every notification sent by the server (id null) */
+typedef void (*stratum_client_notify_cb_t)(stratum_client_t *client,
+                                           stratum_response_t *res, void *arg);
+
+/* called every time the connection to the server is made */
+typedef void (*stratum_client_connect_cb_t)(stratum_client_t *client,
+                                            void *arg);
+
+/**
+ * Called once the connection is closed, after every pending reply failed.
+ * It MAY call `stratum_client_reconnect()`.
+ **/
+typedef void (*stratum_client_close_cb_t)(stratum_client_t *client,
+                                          void *arg);
+
+/**
+ * Non-blocking stratum client driven by `loop`.
+ * Requests can be made right away, they are sent once connected.
+ * Unless noted otherwise, the functions below must be called from the
+ * thread running `loop` (or before it runs).
+ * `hostname` is resolved once, here: reconnecting reuses its addresses, so
+ * only creating a client may block the loop on DNS, see
+ * `stratum_client_init_resolved()` to resolve it elsewhere.
+ **/
+stratum_client_t *stratum_client_init(stratum_loop_t *loop,
+                                      const char *hostname, const char *port);
+
+/**
+ * Resolve `hostname` and `port` for `stratum_client_init_resolved()`, this
+ * blocks on DNS and MAY be called from any thread. Returns NULL on failure.
+ **/
+struct addrinfo *stratum_client_resolve(const char *hostname,
+                                        const char *port);
+
+/**
+ * Create a client connecting to the already resolved `addrs` of `hostname`
+ * and `port`, which it owns from then on, even if it fails.
+ **/
+stratum_client_t *stratum_client_init_resolved(stratum_loop_t *loop,
+                                               const char *hostname,
+                                               const char *port,
+                                               struct addrinfo *addrs);
+
+/* close the connection and free `client` once the loop iteration ends */
+void stratum_client_free(stratum_client_t *client);
+
+/* close the connection, pending replies fail and the close callback runs */
+void stratum_client_close(stratum_client_t *client);
+
+/**
+ * Forget the reply callback of the request `id`, which is then never
+ * called, e.g. once whoever waited for the reply is gone. The request is
+ * still sent if it was not already.
+ **/
+void stratum_client_cancel(stratum_client_t *client, long id);
+
+/**
+ * Drop the connection (if still open) and connect again, keeping the
+ * session id, callbacks and timing. Pending replies fail, and nothing
+ * queued for the old connection is sent. Subscribing and authorizing again
+ * is up to the connect callback. Returns -1 and closes `client` on failure.
+ **/
+int stratum_client_reconnect(stratum_client_t *client);
+
+/**
+ * Fail requests left without a reply for `request_ms` (30s by default), and
+ * reconnect once nothing has been received for `idle_ms` (never by default).
+ * 0 disables either. Both are in milliseconds.
+ **/
+void stratum_client_set_timeouts(stratum_client_t *client,
+                                 uint64_t request_ms, uint64_t idle_ms);
+
+void stratum_client_on_connect(stratum_client_t *client,
+                               stratum_client_connect_cb_t cb, void *arg);
+
+void stratum_client_on_notify(stratum_client_t *client,
+                              stratum_client_notify_cb_t cb, void *arg);
+
+void stratum_client_on_close(stratum_client_t *client,
+                             stratum_client_close_cb_t cb, void *arg);
+
+/* see `stratum_session_enable_timing()` */
+int stratum_client_enable_timing(stratum_client_t *client,
+                                 stratum_timing_t *timing);
+
+/* the session kept up to date with the messages received by `client` */
+stratum_session_t *stratum_client_session(stratum_client_t *client);
+
+/* the loop driving `client` */
+stratum_loop_t *stratum_client_loop(stratum_client_t *client);
+
+/* 1 once the connection has been closed */
+int stratum_client_closed(const stratum_client_t *client);
+
+/**
+ * The requests below return the id of the request, or -1 if it could not be
+ * queued. A share dropped as a duplicate returns -2 instead, see
+ * `stratum_session_enable_dedup()`, and one that could not be queued is
+ * not recorded as submitted, so it can be retried.
+ * `cb` MAY be NULL if the reply is not needed, otherwise the request also
+ * fails while STRATUM_CLIENT_MAX_INFLIGHT others wait for their reply.
+ * See `stratum_mining_subscribe()` and friends for their params.
+ **/
+long stratum_client_subscribe(stratum_client_t *client,
+                              const char *user_agent, const char *session_id,
+                              stratum_client_reply_cb_t cb, void *arg);
+
+long stratum_client_authorize(stratum_client_t *client, const char *username,
+                              const char *password,
+                              stratum_client_reply_cb_t cb, void *arg);
+
+long stratum_client_submit(stratum_client_t *client, const char *worker,
+                           const char *job_id, const char *time,
+                           const char *nonce_2, const char *solution,
+                           stratum_client_reply_cb_t cb, void *arg);
+
+long stratum_client_suggest_target(stratum_client_t *client,
+                                   const char *target,
+                                   stratum_client_reply_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_CLIENT_H */
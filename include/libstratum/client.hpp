@@ -0,0 +1,567 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_CLIENT_HPP
+#define LIBSTRATUM_CLIENT_HPP
+
+/**
+ * Header-only C++20 coroutine layer over `stratum_client_t`.
+ *
+ *   stratum::task<> mine(stratum::client &client) {
+ *       co_await client.subscribe("MagicBean/1.0.0");
+ *       co_await client.authorize("user", "password");
+ *
+ *       while (auto job = co_await client.next_job())
+ *           ...
+ *   }
+ *
+ * Every coroutine touching a client runs on the thread of that client's loop,
+ * so many sessions share one thread without any locking.
+ **/
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <errno.h>
+
+#include "libstratum/client.h"
+#include "libstratum/loop.h"
+#include "libstratum/target.h"
+
+namespace stratum {
+
+/* thrown when a request is made on, or interrupted by, a closed connection */
+class connection_closed : public std::runtime_error {
+  public:
+    connection_closed() : std::runtime_error("stratum connection closed") {}
+};
+
+/* thrown when a request timed out, or was dropped by a reconnection */
+class request_failed : public std::runtime_error {
+  public:
+    request_failed() : std::runtime_error("stratum request failed") {}
+};
+
+template <typename T = void> class task;
+
+namespace detail {
+
+template <typename T> struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    // Started with `spawn()`, nobody awaits the result.
+    bool detached = false;
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<P> h) noexcept {
+            promise_base &p = h.promise();
+
+            if (p.detached) {
+                if (p.exception)
+                    std::terminate();
+
+                h.destroy();
+                return std::noop_coroutine();
+            }
+
+            return p.continuation ? p.continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    void rethrow() {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+template <typename T> struct promise : promise_base<T> {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+
+    template <typename U> void return_value(U &&v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        this->rethrow();
+        return std::move(*value);
+    }
+};
+
+template <> struct promise<void> : promise_base<void> {
+    task<void> get_return_object();
+    void return_void() {}
+    void result() { rethrow(); }
+};
+
+} // namespace detail
+
+/**
+ * Lazily started coroutine, it runs once awaited or handed to `spawn()`.
+ **/
+template <typename T> class task {
+  public:
+    using promise_type = detail::promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    explicit task(handle_type h) : handle(h) {}
+    task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+        handle.promise().continuation = h;
+        return handle;
+    }
+
+    T await_resume() { return handle.promise().result(); }
+
+    /* start the coroutine and let it free itself once done */
+    void detach() {
+        handle_type h = std::exchange(handle, {});
+
+        h.promise().detached = true;
+        h.resume();
+    }
+
+  private:
+    handle_type handle;
+};
+
+namespace detail {
+
+template <typename T> task<T> promise<T>::get_return_object() {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() {
+    using handle_type = std::coroutine_handle<promise<void>>;
+
+    return task<void>(handle_type::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * Run `t` without awaiting it, it MUST NOT throw since nobody could catch it.
+ * It runs on the calling thread until its first suspension, see
+ * `loop::schedule()` to start it on a loop thread instead.
+ **/
+inline void spawn(task<void> t) { t.detach(); }
+
+/**
+ * Owning wrapper around `stratum_loop_t`.
+ **/
+class loop {
+  public:
+    loop() : ptr(stratum_loop_init()) {
+        if (ptr == nullptr)
+            throw std::system_error(errno, std::generic_category(),
+                                    "stratum_loop_init");
+    }
+
+    loop(const loop &) = delete;
+    loop &operator=(const loop &) = delete;
+
+    ~loop() { stratum_loop_free(ptr); }
+
+    stratum_loop_t *get() const noexcept { return ptr; }
+
+    void run() { stratum_loop_run(ptr); }
+    void stop() { stratum_loop_stop(ptr); }
+
+    /* `co_await loop.schedule()` resumes the coroutine on the loop thread */
+    auto schedule() {
+        struct awaiter {
+            stratum_loop_t *loop;
+
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                if (stratum_loop_post(loop, resume, h.address()) == -1)
+                    throw std::system_error(errno, std::generic_category(),
+                                            "stratum_loop_post");
+            }
+
+            void await_resume() const noexcept {}
+
+            static void resume(stratum_loop_t *, void *arg) {
+                std::coroutine_handle<>::from_address(arg).resume();
+            }
+        };
+
+        return awaiter{ptr};
+    }
+
+  private:
+    stratum_loop_t *ptr;
+};
+
+/**
+ * Owning copy of a `stratum_response_t`, which only lives as long as the
+ * callback it is given to.
+ **/
+struct response {
+    long id = 0;
+    std::optional<std::string> method;
+    std::optional<std::string> result[STRATUM_MAX_RESULTS];
+    std::optional<std::string> error[STRATUM_MAX_ERRORS];
+    std::optional<std::string> params[STRATUM_MAX_PARAMS];
+
+    response() = default;
+
+    explicit response(const stratum_response_t *res) : id(res->id) {
+        copy(method, res->method);
+
+        for (int i = 0; i < STRATUM_MAX_RESULTS; i++)
+            copy(result[i], res->result[i]);
+        for (int i = 0; i < STRATUM_MAX_ERRORS; i++)
+            copy(error[i], res->error[i]);
+        for (int i = 0; i < STRATUM_MAX_PARAMS; i++)
+            copy(params[i], res->params[i]);
+    }
+
+    /* the server did not report an error */
+    bool ok() const { return !error[0].has_value(); }
+
+  private:
+    static void copy(std::optional<std::string> &dst, const char *src) {
+        if (src != nullptr)
+            dst.emplace(src);
+    }
+};
+
+/**
+ * https://zips.z.cash/zip-0301#mining-notify
+ * `target` is the session's target for this job, if the server sent one.
+ **/
+struct job {
+    std::string job_id;
+    std::string version;
+    std::string prev_hash;
+    std::string merkle_root;
+    std::string reserved;
+    std::string time;
+    std::string bits;
+    bool clean_jobs = false;
+    std::optional<stratum_target_t> target;
+};
+
+/* see `stratum_mining_submit()` */
+struct share {
+    std::string worker;
+    std::string job_id;
+    std::string time;
+    std::string nonce_2;
+    std::string solution;
+};
+
+/**
+ * Coroutine friendly `stratum_client_t`. It must only be used from the
+ * thread of its loop, and outlive the coroutines awaiting it.
+ **/
+class client {
+  public:
+    client(loop &l, const char *hostname, const char *port)
+        : ptr(stratum_client_init(l.get(), hostname, port)) {
+        if (ptr == nullptr)
+            throw std::system_error(errno, std::generic_category(),
+                                    "stratum_client_init");
+
+        stratum_client_on_notify(ptr, on_notify, this);
+        stratum_client_on_close(ptr, on_close, this);
+    }
+
+    client(const client &) = delete;
+    client &operator=(const client &) = delete;
+
+    /**
+     * The coroutines still awaiting a request or a job are detached: they
+     * are never resumed, and destroying them later is safe.
+     **/
+    ~client() {
+        while (pending != nullptr) {
+            stratum_client_cancel(ptr, pending->id);
+            pending->unlink();
+        }
+
+        // Closing would otherwise resume them on a half destroyed client.
+        stratum_client_on_notify(ptr, nullptr, nullptr);
+        stratum_client_on_close(ptr, nullptr, nullptr);
+        stratum_client_free(ptr);
+    }
+
+    stratum_client_t *get() const noexcept { return ptr; }
+
+    const stratum_session_t &session() const {
+        return *stratum_client_session(ptr);
+    }
+
+    bool closed() const { return stratum_client_closed(ptr); }
+    void close() { stratum_client_close(ptr); }
+    bool reconnect() { return stratum_client_reconnect(ptr) == 0; }
+
+    /* see `stratum_client_set_timeouts()` */
+    void set_timeouts(std::uint64_t request_ms, std::uint64_t idle_ms) {
+        stratum_client_set_timeouts(ptr, request_ms, idle_ms);
+    }
+
+    /**
+     * The `co_await`able requests below resume with the server's reply,
+     * or throw `connection_closed` if the connection is lost first and
+     * `request_failed` if it timed out, the client reconnected or the share
+     * was a duplicate.
+     **/
+    auto subscribe(const char *user_agent, const char *session_id = nullptr) {
+        return request([=](stratum_client_t *c, auto cb, void *arg) {
+            return stratum_client_subscribe(c, user_agent, session_id, cb, arg);
+        });
+    }
+
+    auto authorize(const char *username, const char *password) {
+        return request([=](stratum_client_t *c, auto cb, void *arg) {
+            return stratum_client_authorize(c, username, password, cb, arg);
+        });
+    }
+
+    auto submit(share s) {
+        return request([s = std::move(s)](stratum_client_t *c, auto cb,
+                                          void *arg) {
+            return stratum_client_submit(c, s.worker.c_str(), s.job_id.c_str(),
+                                         s.time.c_str(), s.nonce_2.c_str(),
+                                         s.solution.c_str(), cb, arg);
+        });
+    }
+
+    auto suggest_target(const char *target) {
+        return request([=](stratum_client_t *c, auto cb, void *arg) {
+            return stratum_client_suggest_target(c, target, cb, arg);
+        });
+    }
+
+    /**
+     * `co_await client.next_job()` resumes with the next `mining.notify`
+     * job, or nullopt once the connection is closed.
+     * Jobs superseded by a clean job that were not consumed yet are dropped.
+     **/
+    auto next_job() {
+        struct awaiter {
+            client *self;
+
+            bool await_ready() const noexcept {
+                return !self->jobs.empty() || self->closed();
+            }
+
+            void await_suspend(std::coroutine_handle<> h) noexcept {
+                self->job_waiter = h;
+            }
+
+            std::optional<job> await_resume() {
+                if (self->jobs.empty())
+                    return std::nullopt;
+
+                job j = std::move(self->jobs.front());
+                self->jobs.pop_front();
+                return j;
+            }
+        };
+
+        return awaiter{this};
+    }
+
+  private:
+    // A request waiting for its reply, listed in `pending` of its client.
+    struct pending_request {
+        client *owner = nullptr;
+        pending_request *prev = nullptr;
+        pending_request *next = nullptr;
+        long id = 0;
+
+        void link(client *c, long request) {
+            owner = c;
+            id = request;
+            next = c->pending;
+
+            if (next != nullptr)
+                next->prev = this;
+
+            c->pending = this;
+        }
+
+        void unlink() {
+            if (owner == nullptr)
+                return;
+
+            if (prev != nullptr)
+                prev->next = next;
+            else
+                owner->pending = next;
+
+            if (next != nullptr)
+                next->prev = prev;
+
+            owner = nullptr;
+            prev = next = nullptr;
+        }
+    };
+
+    template <typename F> struct request_awaiter : pending_request {
+        stratum_client_t *ptr;
+        client *self;
+        F send;
+        std::coroutine_handle<> handle;
+        std::optional<response> res;
+        bool done = false;
+        // Set while `send` runs, the coroutine is not suspended yet then.
+        bool sending = false;
+
+        request_awaiter(client *c, F f)
+            : ptr(c->ptr), self(c), send(std::move(f)) {}
+        request_awaiter(const request_awaiter &) = delete;
+        request_awaiter &operator=(const request_awaiter &) = delete;
+
+        // Destroyed along with its coroutine before the reply came.
+        ~request_awaiter() {
+            if (owner != nullptr) {
+                stratum_client_cancel(ptr, id);
+                unlink();
+            }
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            long request;
+
+            handle = h;
+
+            // The reply callback may run right away if the send fails, it
+            // then leaves resuming to us.
+            sending = true;
+            request = send(ptr, on_reply, this);
+            sending = false;
+
+            // -2 is a share dropped as a duplicate, which gets no reply.
+            if (request < 0)
+                done = true;
+
+            if (!done)
+                link(self, request);
+
+            return !done;
+        }
+
+        response await_resume() {
+            if (res)
+                return std::move(*res);
+
+            if (stratum_client_closed(ptr))
+                throw connection_closed();
+
+            throw request_failed();
+        }
+
+        static void on_reply(stratum_client_t *, stratum_response_t *r,
+                             void *arg) {
+            request_awaiter *a = static_cast<request_awaiter *>(arg);
+
+            if (r != nullptr)
+                a->res.emplace(r);
+
+            a->done = true;
+            a->unlink();
+
+            if (!a->sending)
+                a->handle.resume();
+        }
+    };
+
+    template <typename F> request_awaiter<F> request(F send) {
+        return request_awaiter<F>(this, std::move(send));
+    }
+
+    static void on_notify(stratum_client_t *c, stratum_response_t *res,
+                          void *arg) {
+        client *self = static_cast<client *>(arg);
+        const stratum_session_t *session = stratum_client_session(c);
+
+        if (res->method == nullptr ||
+            stratum_method_from_string(res->method) != STRATUM_METHOD_NOTIFY)
+            return;
+
+        for (int i = 0; i < 8; i++) {
+            if (res->params[i] == nullptr)
+                return;
+        }
+
+        // Bitcoin-style jobs, see `stratum_bitcoin_job_from_notify()`.
+        if (res->params[8] != nullptr)
+            return;
+
+        job j{res->params[0],
+              res->params[1],
+              res->params[2],
+              res->params[3],
+              res->params[4],
+              res->params[5],
+              res->params[6],
+              std::string(res->params[7]) == "true",
+              std::nullopt};
+
+        if (session->has_target)
+            j.target = session->target;
+
+        if (j.clean_jobs)
+            self->jobs.clear();
+
+        self->jobs.push_back(std::move(j));
+        self->wake();
+    }
+
+    static void on_close(stratum_client_t *, void *arg) {
+        static_cast<client *>(arg)->wake();
+    }
+
+    void wake() {
+        std::coroutine_handle<> h = std::exchange(job_waiter, {});
+
+        if (h)
+            h.resume();
+    }
+
+    stratum_client_t *ptr;
+    std::deque<job> jobs;
+    std::coroutine_handle<> job_waiter;
+    pending_request *pending = nullptr;
+};
+
+} // namespace stratum
+
+#endif /* LIBSTRATUM_CLIENT_HPP */
@@ -11,15 +11,55 @@ extern "C" {
 #endif
 
 #include <arpa/inet.h>
+#include <stdint.h>
+#include <sys/types.h>
 
-/* create a socket, and return the fd */
+/* create a socket, and return the fd, or -1 if it failed to connect */
 int socket_init(const char *hostname, const char *port);
 
-/* send `data` to the socket */
-void socket_send(int socket, const char *data);
+/* send `data` to the socket, returns -1 if it failed */
+int socket_send(int socket, const char *data);
 
-/* write `bufsize` amount of data received by the socket into `buffer` */
-void socket_read(int socket, void *buffer, size_t bufsize);
+/**
+ * Send the `size` bytes of `data` to the socket, e.g. binary frames, until
+ * every one of them is sent. Returns -1 if it failed.
+ **/
+int socket_write(int socket, const void *data, size_t size);
+
+/**
+ * Write up to `bufsize` bytes received by the socket into `buffer`, returns
+ * their number, 0 if the server closed the connection, or -1 on failure.
+ **/
+ssize_t socket_read(int socket, void *buffer, size_t bufsize);
+
+/**
+ * Make `socket_read()` and `socket_send()` give up once the server has not
+ * answered for `ms` milliseconds, instead of blocking forever. 0 restores
+ * the default of waiting forever.
+ **/
+int socket_set_timeout(int socket, uint64_t ms);
+
+/**
+ * Ask the kernel to timestamp the data received and sent on `socket`
+ * (SO_TIMESTAMPING), see `socket_recv()` and `socket_tx_timestamp()`.
+ * Sent bytes are numbered from 0 starting with the next send.
+ **/
+int socket_enable_timestamping(int socket);
+
+/**
+ * Read up to `bufsize` bytes into `buffer` like read(), and store the kernel
+ * receive time of the data (CLOCK_REALTIME ns, 0 if unknown) into `rx_ns`
+ * unless it is NULL.
+ **/
+ssize_t socket_recv(int socket, void *buffer, size_t bufsize,
+                    uint64_t *rx_ns);
+
+/**
+ * Pop the next transmit timestamp of `socket` without blocking: `ns` is when
+ * the byte numbered `key` (and every byte before it) left for the wire.
+ * Returns 1 if one was popped, 0 if there are none left.
+ **/
+int socket_tx_timestamp(int socket, uint32_t *key, uint64_t *ns);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,75 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_DEDUP_H
+#define LIBSTRATUM_DEDUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Jobs tracked at once, the slot of another job is taken over when full.
+#define STRATUM_DEDUP_JOBS 8
+
+typedef struct {
+    // Hash of the job id, 0 if the slot is free.
+    uint64_t job;
+    // Open addressed set of share fingerprints, 0 being an empty bucket.
+    uint64_t *keys;
+} stratum_dedup_job_t;
+
+/**
+ * Duplicate share filter, a lock-free set of share fingerprints per job that
+ * any number of threads can check shares against concurrently.
+ * It errs on the side of submitting: a share is only ever reported as a
+ * duplicate if it was checked before, but a duplicate can get through while
+ * its job is being retired or once the job's set is full.
+ **/
+typedef struct {
+    stratum_dedup_job_t jobs[STRATUM_DEDUP_JOBS];
+    // Buckets per job, a power of 2.
+    size_t capacity;
+} stratum_dedup_t;
+
+/**
+ * Initialize `dedup` for up to `shares` shares per job (rounded up so the
+ * sets stay at most half full). Returns -1 if it cannot be allocated.
+ **/
+int stratum_dedup_init(stratum_dedup_t *dedup, size_t shares);
+
+/* free the sets of `dedup` */
+void stratum_dedup_free(stratum_dedup_t *dedup);
+
+/**
+ * Record the share (`job_id`, `time`, `nonce_2`, `solution`) of a
+ * `mining.submit`. Returns 1 if it is new and should be submitted, 0 if it
+ * was already recorded.
+ **/
+int stratum_dedup_check(stratum_dedup_t *dedup, const char *job_id,
+                        const char *time, const char *nonce_2,
+                        const char *solution);
+
+/**
+ * Forget a share recorded by `stratum_dedup_check()`, so it can be checked
+ * (and submitted) again once sending it failed.
+ **/
+void stratum_dedup_forget(stratum_dedup_t *dedup, const char *job_id,
+                          const char *time, const char *nonce_2,
+                          const char *solution);
+
+/* forget the shares of `job_id`, once the job is no longer valid */
+void stratum_dedup_retire(stratum_dedup_t *dedup, const char *job_id);
+
+/* forget the shares of every job, e.g. on a clean job */
+void stratum_dedup_clear(stratum_dedup_t *dedup);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_DEDUP_H */
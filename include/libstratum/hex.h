@@ -0,0 +1,30 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_HEX_H
+#define LIBSTRATUM_HEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Decode the hex string `hex` into `out`, which can hold `size` bytes.
+ * Returns the number of bytes written, or -1 if `hex` is not valid hex or
+ * does not fit.
+ **/
+int stratum_hex_decode(const char *hex, uint8_t *out, size_t size);
+
+/* encode `size` bytes of `data` as lowercase hex into `out` (2 * size + 1) */
+void stratum_hex_encode(const uint8_t *data, size_t size, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_HEX_H */
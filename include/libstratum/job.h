@@ -0,0 +1,56 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_JOB_H
+#define LIBSTRATUM_JOB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "libstratum/nonce.h"
+#include "libstratum/session.h"
+#include "libstratum/stratum.h"
+#include "libstratum/target.h"
+
+// VERSION || PREVHASH || MERKLEROOT || RESERVED || TIME || BITS || NONCE
+#define STRATUM_HEADER_SIZE 140
+// Offsets of the fields the miner fills in.
+#define STRATUM_HEADER_TIME 100
+#define STRATUM_HEADER_NONCE 108
+
+#define STRATUM_JOB_ID_SIZE 64
+
+/**
+ * A `mining.notify` job decoded into the block header to be mined.
+ * https://zips.z.cash/zip-0301#mining-notify
+ **/
+typedef struct {
+    char job_id[STRATUM_JOB_ID_SIZE + 1];
+    // Starts with NONCE_1, the miner fills in NONCE_2 and the solution.
+    uint8_t header[STRATUM_HEADER_SIZE];
+    // Length of the NONCE_1 prefix of the header nonce.
+    uint8_t nonce_1_size;
+    uint8_t clean;
+    // The session's target for this job, if the server sent one.
+    uint8_t has_target;
+    stratum_target_t target;
+} stratum_job_t;
+
+/**
+ * Decode the `mining.notify` notification `res` into `job`, using the
+ * NONCE_1 and target of `session` which MUST have handled `res` already.
+ * Returns -1 if `res` is not a valid `mining.notify`.
+ **/
+int stratum_job_from_notify(stratum_job_t *job, const stratum_response_t *res,
+                            const stratum_session_t *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_JOB_H */
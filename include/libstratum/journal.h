@@ -0,0 +1,113 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_JOURNAL_H
+#define LIBSTRATUM_JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STRATUM_JOURNAL_MAGIC "STRJRN02"
+
+typedef enum {
+    STRATUM_JOURNAL_PENDING = 0,
+    // Answered by the server (accepted or not), or pruned.
+    STRATUM_JOURNAL_DONE = 1,
+} stratum_journal_state_t;
+
+/**
+ * A journal is a file of a fixed size, starting with the 8 bytes of
+ * STRATUM_JOURNAL_MAGIC and the offset of its end (u64), followed by
+ * records made of this header and the NULL terminated SESSION_ID, NONCE_1,
+ * WORKER, JOB_ID, TIME, NONCE_2 and SOLUTION of a share, padded to 8 bytes.
+ * Records are only ever appended, then marked done in place. Once full, the
+ * pending ones are copied into a new file renamed over the journal.
+ **/
+typedef struct {
+    // Of the whole record, padding included.
+    uint32_t size;
+    uint8_t state;
+    uint8_t reserved[3];
+    // Id of the request the share was last submitted with.
+    int64_t id;
+} stratum_journal_record_t;
+
+typedef struct {
+    long id;
+    // Of the session the share was found for, "" if the server sent none.
+    const char *session_id;
+    const char *nonce_1;
+    const char *worker;
+    const char *job_id;
+    const char *time;
+    const char *nonce_2;
+    const char *solution;
+} stratum_journal_share_t;
+
+typedef struct stratum_journal stratum_journal_t;
+
+/**
+ * Map the journal at `path`, created with room for `size` bytes if it does
+ * not exist yet. The shares left pending by a previous run are kept.
+ * Returns NULL on failure.
+ **/
+stratum_journal_t *stratum_journal_open(const char *path, size_t size);
+
+void stratum_journal_close(stratum_journal_t *journal);
+
+/**
+ * Record the share submitted with the request `id` on the session
+ * `session_id` (which MAY be "") and `nonce_1`, until
+ * `stratum_journal_ack()`. Returns -1 if the journal is full of pending
+ * shares, or could not be compacted.
+ **/
+int stratum_journal_append(stratum_journal_t *journal, long id,
+                           const char *session_id, const char *nonce_1,
+                           const char *worker, const char *job_id,
+                           const char *time, const char *nonce_2,
+                           const char *solution);
+
+/* mark the oldest pending share submitted with the request `id` as done */
+void stratum_journal_ack(stratum_journal_t *journal, long id);
+
+/* mark every pending share as done, once their jobs are no longer valid */
+void stratum_journal_prune(stratum_journal_t *journal);
+
+/**
+ * Mark as done the pending shares that the session `session_id` and
+ * `nonce_1` can no longer submit, on its first job `job_id`: those found
+ * with another NONCE_1 (or session id, when both are known), or for another
+ * job.
+ **/
+void stratum_journal_prune_stale(stratum_journal_t *journal,
+                                 const char *session_id, const char *nonce_1,
+                                 const char *job_id);
+
+/* the number of pending shares */
+size_t stratum_journal_pending(const stratum_journal_t *journal);
+
+/**
+ * Returns the id of the request `share` was submitted again with, or -1 if
+ * it could not be.
+ **/
+typedef long (*stratum_journal_submit_t)(const stratum_journal_share_t *share,
+                                         void *arg);
+
+/**
+ * Submit every pending share again with `submit`, e.g. after a reconnect,
+ * and remember the new ids. Returns the number of shares resubmitted.
+ **/
+size_t stratum_journal_resubmit(stratum_journal_t *journal,
+                                stratum_journal_submit_t submit, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_JOURNAL_H */
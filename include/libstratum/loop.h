@@ -0,0 +1,112 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_LOOP_H
+#define LIBSTRATUM_LOOP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+typedef struct stratum_loop stratum_loop_t;
+typedef struct stratum_loop_handler stratum_loop_handler_t;
+
+/* called from the loop thread with the epoll events that fired on `handler` */
+typedef void (*stratum_loop_cb_t)(stratum_loop_t *loop,
+                                  stratum_loop_handler_t *handler,
+                                  uint32_t events);
+
+/* a unit of work ran on the loop thread, see `stratum_loop_post()` */
+typedef void (*stratum_loop_task_t)(stratum_loop_t *loop, void *arg);
+
+struct stratum_loop_handler {
+    int fd;
+    stratum_loop_cb_t cb;
+    void *ctx;
+};
+
+typedef struct stratum_timer stratum_timer_t;
+
+/* called from the loop thread once `timer` expired, it MAY re-arm it */
+typedef void (*stratum_timer_cb_t)(stratum_loop_t *loop,
+                                   stratum_timer_t *timer);
+
+/**
+ * A timer of the loop's hierarchical timer wheel, with a millisecond
+ * resolution. Arming and disarming it are O(1).
+ **/
+struct stratum_timer {
+    stratum_timer_cb_t cb;
+    void *ctx;
+
+    // Owned by the loop.
+    uint64_t expires;
+    stratum_timer_t *next;
+    stratum_timer_t *prev;
+};
+
+/* create an epoll backed event loop, returns NULL on failure */
+stratum_loop_t *stratum_loop_init(void);
+
+/* free the loop, it must not be running */
+void stratum_loop_free(stratum_loop_t *loop);
+
+/**
+ * Watch `handler->fd` for `events` (EPOLLIN, EPOLLOUT, ...).
+ * `handler` must stay valid until it has been removed with
+ * `stratum_loop_del()` and the current iteration has finished,
+ * use `stratum_loop_post()` to defer freeing it from inside a callback.
+ **/
+int stratum_loop_add(stratum_loop_t *loop, stratum_loop_handler_t *handler,
+                     uint32_t events);
+
+/* change the events watched on `handler->fd` */
+int stratum_loop_mod(stratum_loop_t *loop, stratum_loop_handler_t *handler,
+                     uint32_t events);
+
+/* stop watching `handler->fd` */
+int stratum_loop_del(stratum_loop_t *loop, stratum_loop_handler_t *handler);
+
+/**
+ * Run `task(loop, arg)` on the loop thread once the current iteration has
+ * dispatched its events. Safe to call from any thread.
+ **/
+int stratum_loop_post(stratum_loop_t *loop, stratum_loop_task_t task,
+                      void *arg);
+
+/* initialize a disarmed `timer` */
+void stratum_timer_init(stratum_timer_t *timer, stratum_timer_cb_t cb,
+                        void *ctx);
+
+/* 1 if `timer` is armed */
+int stratum_timer_pending(const stratum_timer_t *timer);
+
+/**
+ * Arm `timer` to fire in `ms` milliseconds, re-arming it if it already was.
+ * Like the rest of the loop, timers MUST only be touched from its thread.
+ **/
+void stratum_loop_timer_add(stratum_loop_t *loop, stratum_timer_t *timer,
+                            uint64_t ms);
+
+/* disarm `timer`, nothing happens if it is not armed */
+void stratum_loop_timer_del(stratum_loop_t *loop, stratum_timer_t *timer);
+
+/* dispatch events on the calling thread until `stratum_loop_stop()` */
+void stratum_loop_run(stratum_loop_t *loop);
+
+/* ask the loop to return from `stratum_loop_run()`, safe from any thread */
+void stratum_loop_stop(stratum_loop_t *loop);
+
+/* pin the calling thread to `cpu` (modulo the number of online cpus) */
+int stratum_loop_pin(int cpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_LOOP_H */
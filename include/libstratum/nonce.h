@@ -0,0 +1,71 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_NONCE_H
+#define LIBSTRATUM_NONCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// https://zips.z.cash/zip-0301#nonce-parts
+#define STRATUM_NONCE_SIZE 32
+
+/**
+ * A range of NONCE_2 values owned by one solver thread or device.
+ * Ranges split from the same parent never overlap, so solvers do not need to
+ * coordinate and can never submit the same nonce twice.
+ **/
+typedef struct {
+    uint8_t nonce_1[STRATUM_NONCE_SIZE];
+    size_t nonce_1_size;
+    size_t nonce_2_size;
+
+    // The low bits of NONCE_2 (at most 64) are handed out as base + n, for n
+    // in [0, mask].
+    uint64_t base;
+    uint64_t mask;
+    uint64_t taken;
+} stratum_nonce_range_t;
+
+/**
+ * Initialize `range` to the whole NONCE_2 space left by `nonce_1`, the hex
+ * NONCE_1 sent in the `mining.subscribe` result.
+ * Returns -1 if `nonce_1` is not valid.
+ **/
+int stratum_nonce_range_init(stratum_nonce_range_t *range,
+                             const char *nonce_1);
+
+/**
+ * Split the unused `range` into `parts` disjoint ranges and initialize `out`
+ * to the `index`th one. Ranges can be split again, e.g. per device and then
+ * per thread. Returns -1 if `range` is too small.
+ **/
+int stratum_nonce_range_split(const stratum_nonce_range_t *range, size_t parts,
+                              size_t index, stratum_nonce_range_t *out);
+
+/**
+ * Write the next NONCE_2 of `range` (`range->nonce_2_size` bytes) into
+ * `nonce_2`. Only the thread owning `range` may call this.
+ * Returns -1 once the range is exhausted.
+ **/
+int stratum_nonce_next(stratum_nonce_range_t *range, uint8_t *nonce_2);
+
+/* like `stratum_nonce_next()`, for a range shared by several threads */
+int stratum_nonce_next_shared(stratum_nonce_range_t *range, uint8_t *nonce_2);
+
+/* write the full header nonce (NONCE_1 || `nonce_2`) into `nonce` */
+void stratum_nonce_build(const stratum_nonce_range_t *range,
+                         const uint8_t *nonce_2,
+                         uint8_t nonce[STRATUM_NONCE_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_NONCE_H */
@@ -0,0 +1,64 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_RATECTL_H
+#define LIBSTRATUM_RATECTL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "libstratum/target.h"
+
+/**
+ * Share rate controller, measures how often shares are submitted on a
+ * connection and works out the target to suggest (`mining.suggest_target`)
+ * so the rate stays close to `rate`.
+ * All times are in seconds, from a monotonic clock.
+ **/
+typedef struct {
+    // Wanted shares per second.
+    double rate;
+    // Relative deadband around `rate` in which the target is left alone.
+    double hysteresis;
+    // Longest time to measure before deciding, slow rigs need the full window.
+    double window;
+    // Shares after which a decision is made without waiting for `window`.
+    uint32_t min_shares;
+
+    // Measurement since the last target change.
+    double since;
+    uint32_t shares;
+} stratum_ratectl_t;
+
+/**
+ * Initialize `ctl` to aim for `rate` shares per second, `hysteresis` is the
+ * accepted relative error (e.g. 0.25 for +/- 25%).
+ **/
+void stratum_ratectl_init(stratum_ratectl_t *ctl, double rate,
+                          double hysteresis, double now);
+
+/* restart the measurement, to be called whenever the target changes */
+void stratum_ratectl_reset(stratum_ratectl_t *ctl, double now);
+
+/* record a submitted share */
+void stratum_ratectl_share(stratum_ratectl_t *ctl);
+
+/**
+ * Returns 1 and writes the target to suggest into `suggested` if the rate
+ * measured against `current` is outside of the hysteresis band, 0 otherwise.
+ * The measurement restarts once a target is suggested.
+ **/
+int stratum_ratectl_update(stratum_ratectl_t *ctl,
+                           const stratum_target_t *current, double now,
+                           stratum_target_t *suggested);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_RATECTL_H */
@@ -0,0 +1,80 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_READER_H
+#define LIBSTRATUM_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "libstratum/stratum.h"
+
+/* what the reader does with a message once the ring is full */
+typedef enum {
+    // Wait for the consumer, the kernel buffer then fills up as without it.
+    STRATUM_OVERFLOW_BLOCK,
+    // Drop the oldest `mining.notify` once it is next in line, a newer job
+    // supersedes it. Other messages are waited for.
+    STRATUM_OVERFLOW_DROP_NOTIFY,
+    // Stop reading, the consumer then fails as if the connection had.
+    STRATUM_OVERFLOW_FAIL,
+} stratum_overflow_t;
+
+/**
+ * A thread reading, framing and parsing the JSON lines of a socket into a
+ * bounded single-producer single-consumer ring, so a slow consumer does not
+ * delay the reads. Only the reader thread pushes and only the consumer pops,
+ * the reader may also evict the message next in line under
+ * STRATUM_OVERFLOW_DROP_NOTIFY.
+ **/
+typedef struct stratum_reader stratum_reader_t;
+
+/**
+ * Create a reader with room for `size` messages, a power of two.
+ * Returns NULL on failure.
+ **/
+stratum_reader_t *stratum_reader_init(uint32_t size,
+                                      stratum_overflow_t overflow);
+
+/**
+ * Spawn the thread reading `socket`, recording the kernel receive time of
+ * each message if `timestamps` is set (see `socket_recv()`).
+ **/
+int stratum_reader_start(stratum_reader_t *reader, int socket,
+                         int timestamps);
+
+/* stop the thread and wait for it to exit, queued messages are kept */
+void stratum_reader_stop(stratum_reader_t *reader);
+
+/* free a stopped reader and the messages still queued */
+void stratum_reader_free(stratum_reader_t *reader);
+
+/**
+ * Take the oldest queued message and its receive time (unless `rx_ns` is
+ * NULL), the caller owns it from then on. Only the consumer may call this.
+ * Returns 1 if `res` was filled in, 0 if the ring is empty, or -1 if it is
+ * empty and the reader stopped (the connection failed, or the ring
+ * overflowed under STRATUM_OVERFLOW_FAIL).
+ **/
+int stratum_reader_pop(stratum_reader_t *reader, stratum_response_t **res,
+                       uint64_t *rx_ns);
+
+/**
+ * Wait until a message is queued, returns -1 if none ever will be.
+ * Only the consumer may call this.
+ **/
+int stratum_reader_wait(stratum_reader_t *reader);
+
+/* the number of notifications dropped under STRATUM_OVERFLOW_DROP_NOTIFY */
+uint64_t stratum_reader_dropped(const stratum_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_READER_H */
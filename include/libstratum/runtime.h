@@ -0,0 +1,72 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_RUNTIME_H
+#define LIBSTRATUM_RUNTIME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "libstratum/client.h"
+#include "libstratum/loop.h"
+
+/**
+ * A pool of event loops, one thread per shard pinned to its own cpu.
+ * A client is created on one shard and stays there for its whole life, so its
+ * state is only ever touched by that shard's thread and needs no locking.
+ * Other threads reach a shard with `stratum_runtime_post()`, which goes
+ * through the loop's lock-free task queue.
+ **/
+typedef struct stratum_runtime stratum_runtime_t;
+
+/* called on the shard thread, `client` is NULL if it could not be created */
+typedef void (*stratum_runtime_connect_cb_t)(stratum_client_t *client,
+                                             void *arg);
+
+/* create `shards` loops, or one per online cpu if `shards` < 1 */
+stratum_runtime_t *stratum_runtime_init(int shards);
+
+/* spawn the shard threads */
+int stratum_runtime_start(stratum_runtime_t *runtime);
+
+/* stop the shard threads and wait for them to exit */
+void stratum_runtime_stop(stratum_runtime_t *runtime);
+
+/**
+ * Free the runtime, it must be stopped and every client freed
+ * (`stratum_client_free()` from its shard).
+ **/
+void stratum_runtime_free(stratum_runtime_t *runtime);
+
+int stratum_runtime_shards(const stratum_runtime_t *runtime);
+
+/* the loop of `shard` (modulo the number of shards) */
+stratum_loop_t *stratum_runtime_loop(stratum_runtime_t *runtime, int shard);
+
+/* the shard run by the calling thread, -1 if it is not a shard thread */
+int stratum_runtime_current(void);
+
+/* run `task(loop, arg)` on `shard`, safe to call from any thread */
+int stratum_runtime_post(stratum_runtime_t *runtime, int shard,
+                         stratum_loop_task_t task, void *arg);
+
+/**
+ * Connect to `hostname`:`port` from `shard`, or the next shard in round
+ * robin order if `shard` is -1. `cb` is then called on that shard with the
+ * new client, which belongs to it from then on.
+ * `hostname` is resolved on the calling thread before returning, so calling
+ * this from a shard blocks it on DNS.
+ * Safe to call from any thread, returns the shard or -1 on failure.
+ **/
+int stratum_runtime_connect(stratum_runtime_t *runtime, int shard,
+                            const char *hostname, const char *port,
+                            stratum_runtime_connect_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_RUNTIME_H */
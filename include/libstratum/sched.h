@@ -0,0 +1,98 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_SCHED_H
+#define LIBSTRATUM_SCHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "libstratum/job.h"
+#include "libstratum/session.h"
+#include "libstratum/stratum.h"
+
+#define STRATUM_SCHED_POOLS 16
+
+/**
+ * Splits the hashrate of the solvers between several pools (or accounts)
+ * by weight, e.g. the percentages of a contract.
+ * Every pool keeps its latest decoded job in a seqlock protected slot, so a
+ * solver switches pools with a copy and no syscall. Solvers ask which pool
+ * to work on for each slice of work (a number of nonces, or of
+ * microseconds): the one that got the least of its weight so far, counting
+ * only the fraction of its shares that were accepted, so a pool that rejects
+ * or loses shares gets more time to make up for it. Pools without a job, or
+ * whose job is older than the maximum age, are skipped.
+ * Jobs are published by the thread handling each pool, any number of
+ * solver threads may pick concurrently.
+ **/
+typedef struct stratum_sched stratum_sched_t;
+
+/**
+ * Create a scheduler without any pool. Jobs older than `max_age` seconds
+ * are not worked on, 0 to keep them for as long as the pool has no other.
+ **/
+stratum_sched_t *stratum_sched_init(double max_age);
+
+void stratum_sched_free(stratum_sched_t *sched);
+
+/**
+ * Add a pool getting `weight` parts of the hashrate, before the solvers
+ * start. Returns its index, or -1 if there are STRATUM_SCHED_POOLS already.
+ **/
+int stratum_sched_add(stratum_sched_t *sched, uint32_t weight);
+
+/* change the weight of `pool`, 0 to stop working for it */
+void stratum_sched_set_weight(stratum_sched_t *sched, int pool,
+                              uint32_t weight);
+
+/**
+ * Make `job` the job of `pool`, received at `now` (seconds from a monotonic
+ * clock). A pool getting a job again after having none starts level with
+ * the others instead of taking every slice until it caught up.
+ **/
+void stratum_sched_publish(stratum_sched_t *sched, int pool,
+                           const stratum_job_t *job, double now);
+
+/**
+ * Decode the `mining.notify` `res` with `session`, see
+ * `stratum_job_from_notify()`, and publish it for `pool`.
+ * Returns -1 if `res` is not a valid `mining.notify`.
+ **/
+int stratum_sched_handle_notify(stratum_sched_t *sched, int pool,
+                                const stratum_response_t *res,
+                                const stratum_session_t *session, double now);
+
+/* stop working for `pool` until its next job, e.g. once it disconnected */
+void stratum_sched_retire(stratum_sched_t *sched, int pool);
+
+/* account for the answer to a share submitted to `pool` */
+void stratum_sched_share(stratum_sched_t *sched, int pool, int accepted);
+
+/**
+ * Pick the pool to spend the next `work` units on at `now`, copy its job
+ * into `job` and its generation into `generation` (if not NULL).
+ * Returns the pool, or -1 if none has a job to work on.
+ **/
+int stratum_sched_pick(stratum_sched_t *sched, double now, uint64_t work,
+                       stratum_job_t *job, uint64_t *generation);
+
+/**
+ * Number of jobs published for `pool` so far, cheap enough to poll during a
+ * slice to notice its job changed.
+ **/
+uint64_t stratum_sched_generation(const stratum_sched_t *sched, int pool);
+
+/* the units of work spent on `pool` so far */
+uint64_t stratum_sched_work(const stratum_sched_t *sched, int pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_SCHED_H */
@@ -0,0 +1,81 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_SERVER_H
+#define LIBSTRATUM_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "libstratum/stratum.h"
+
+typedef struct stratum_server stratum_server_t;
+typedef struct stratum_server_client stratum_server_client_t;
+
+/**
+ * Called on the client's shard thread for every request it sends,
+ * `req` is freed once the callback returns.
+ * `req` is NULL when the client has disconnected, this is the last call made
+ * for `client` and any data attached to it should be released.
+ **/
+typedef void (*stratum_server_cb_t)(stratum_server_client_t *client,
+                                    stratum_response_t *req);
+
+/**
+ * Create a listener on `host`:`port` (`host` MAY be NULL for any address)
+ * sharded across `shards` event loops.
+ * Every shard owns its own SO_REUSEPORT socket so the kernel spreads accepted
+ * connections between them, and a client stays on its shard until it
+ * disconnects.
+ **/
+stratum_server_t *stratum_server_init(const char *host, const char *port,
+                                      int shards, stratum_server_cb_t cb);
+
+/* spawn one thread per shard, each pinned to its own cpu */
+int stratum_server_start(stratum_server_t *server);
+
+/* stop the shard threads and wait for them to exit */
+void stratum_server_stop(stratum_server_t *server);
+
+/* disconnect every client and free the server, it must be stopped */
+void stratum_server_free(stratum_server_t *server);
+
+/**
+ * Reply to the request `id` of `client`.
+ * `result` and `error` are raw JSON values, NULL is sent as `null`.
+ * Must be called from the client's shard thread (i.e. its callback).
+ **/
+int stratum_server_reply(stratum_server_client_t *client, long id,
+                         const char *result, const char *error);
+
+/**
+ * Send the notification `method` to `client`, `params` is a JSON array.
+ * Must be called from the client's shard thread (i.e. its callback).
+ **/
+int stratum_server_notify(stratum_server_client_t *client, const char *method,
+                          const char *params);
+
+/* send the notification `method` to every connected client, from any thread */
+int stratum_server_broadcast(stratum_server_t *server, const char *method,
+                             const char *params);
+
+/* disconnect `client`, from its shard thread */
+void stratum_server_close(stratum_server_client_t *client);
+
+/* attach a user pointer to `client` */
+void stratum_server_set_data(stratum_server_client_t *client, void *data);
+
+/* the user pointer attached to `client`, NULL by default */
+void *stratum_server_get_data(stratum_server_client_t *client);
+
+/* the index of the shard serving `client` */
+int stratum_server_shard(stratum_server_client_t *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_SERVER_H */
@@ -0,0 +1,217 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_SESSION_H
+#define LIBSTRATUM_SESSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libstratum/buffer.h"
+#include "libstratum/dedup.h"
+#include "libstratum/journal.h"
+#include "libstratum/nonce.h"
+#include "libstratum/ratectl.h"
+#include "libstratum/reader.h"
+#include "libstratum/stratum.h"
+#include "libstratum/sv2.h"
+#include "libstratum/target.h"
+#include "libstratum/timing.h"
+#include "libstratum/workers.h"
+
+typedef enum {
+    // JSON lines, the default.
+    STRATUM_PROTOCOL_V1,
+    // Plaintext binary frames, see `stratum_session_enable_sv2()`.
+    STRATUM_PROTOCOL_V2,
+} stratum_protocol_t;
+
+// Per connection state, kept up to date from the messages of the server.
+typedef struct {
+    int socket;
+    stratum_protocol_t protocol;
+
+    // From the `mining.subscribe` result, see `stratum_nonce_range_init()`.
+    long subscribe_id;
+    char session_id[65];
+    char nonce_1[2 * STRATUM_NONCE_SIZE + 1];
+    // EXTRANONCE_2_SIZE of Bitcoin-style pools, 0 for ZIP-301 ones.
+    uint8_t nonce_2_size;
+    // From OpenStandardMiningChannel.Success on Stratum V2 sessions, whose
+    // EXTRANONCE_PREFIX is kept as `nonce_1`.
+    uint32_t channel_id;
+
+    // Target of the current job.
+    stratum_target_t target;
+    uint8_t has_target;
+    // Target sent by `mining.set_target` (or `mining.set_difficulty`), used
+    // from the next job onwards.
+    stratum_target_t next_target;
+    uint8_t has_next_target;
+
+    // Optional, see `stratum_session_enable_ratectl()`.
+    stratum_ratectl_t *ratectl;
+    // Optional, see `stratum_session_enable_timing()`.
+    stratum_timing_t *timing;
+    // See `stratum_session_enable_coalescing()`.
+    uint8_t coalesce;
+    // Optional, see `stratum_session_enable_dedup()`.
+    stratum_dedup_t *dedup;
+    // Optional, see `stratum_session_enable_workers()`.
+    stratum_workers_t *workers;
+    // Optional, see `stratum_session_enable_journal()`.
+    stratum_journal_t *journal;
+    // Set until the first job of the connection, which the shares left in
+    // `journal` are resubmitted (or pruned) on.
+    uint8_t resubmit;
+    // Id of the next blocking API request while `journal` is set without
+    // `workers`, which keep their own.
+    long next_id;
+    // Optional, see `stratum_session_enable_reader()`.
+    stratum_reader_t *reader;
+    // What was read past the last complete line, without a reader.
+    stratum_buffer_t rx;
+} stratum_session_t;
+
+/**
+ * Initialize `session` and attach it to `socket`, every message received by
+ * `stratum_send_and_handle_data()` on `socket` then updates `session` before
+ * the callback is ran. Returns -1 if the socket cannot be tracked.
+ **/
+int stratum_session_init(stratum_session_t *session, int socket);
+
+/* detach `session` from its socket and free what it buffered */
+void stratum_session_free(stratum_session_t *session);
+
+/* the session attached to `socket`, or NULL */
+stratum_session_t *stratum_session_lookup(int socket);
+
+/* update `session` from a message `res` received from the server */
+void stratum_session_handle_response(stratum_session_t *session,
+                                     const stratum_response_t *res);
+
+/**
+ * Check a share against the target of the current job before submitting it,
+ * see `stratum_share_check()`.
+ * Returns 1 if it should be submitted (or no target is known yet), 0 if the
+ * server would reject it as a Low Difficulty Share.
+ **/
+int stratum_session_check_share(const stratum_session_t *session,
+                                const uint8_t *header, size_t header_size,
+                                const uint8_t *solution, size_t solution_size);
+
+/**
+ * Let `ctl` keep the share rate of `session` near `rate` shares per second,
+ * by sending `mining.suggest_target` once the measured rate leaves the
+ * +/- `hysteresis` band. The measurement restarts on every
+ * `mining.set_target`, so the server's answer is given time to settle.
+ * On the session of a `stratum_client_t` the suggestion is queued by
+ * `stratum_client_submit()` instead.
+ **/
+void stratum_session_enable_ratectl(stratum_session_t *session,
+                                    stratum_ratectl_t *ctl, double rate,
+                                    double hysteresis);
+
+/**
+ * Record the per stage latency of the messages of `session` into `timing`,
+ * using the kernel's timestamps of its socket (SO_TIMESTAMPING).
+ * Returns -1 if the socket does not support them.
+ **/
+int stratum_session_enable_timing(stratum_session_t *session,
+                                  stratum_timing_t *timing);
+
+/**
+ * Pass the messages received in a single read through `stratum_coalesce()`
+ * before handling them, so a burst of jobs ending with a clean one only
+ * reaches the callback (and the solvers) once.
+ **/
+void stratum_session_enable_coalescing(stratum_session_t *session);
+
+/**
+ * Drop the shares submitted twice on `session` (by two solver threads, or a
+ * retry) before they are sent, instead of having the pool reject them as
+ * Duplicate Share. The jobs of `dedup` are cleared on every clean job.
+ **/
+void stratum_session_enable_dedup(stratum_session_t *session,
+                                  stratum_dedup_t *dedup);
+
+/**
+ * Track the workers authorized on `session` in `workers`, so several of them
+ * can share its connection. Every `mining.authorize` and `mining.submit` then
+ * gets its own id (from STRATUM_WORKERS_FIRST_ID on for the blocking API),
+ * which `stratum_workers_lookup()` maps back to the worker, and the replies
+ * update the worker's accepted and rejected counters. On Stratum V2 sessions
+ * each worker opens its own channel.
+ **/
+void stratum_session_enable_workers(stratum_session_t *session,
+                                    stratum_workers_t *workers);
+
+/**
+ * Record every share submitted on `session` in `journal` until the server
+ * answers it, so the shares still unacknowledged when the connection drops
+ * (or the process dies) are not lost. On the first `mining.notify` of the
+ * next connection they are pruned if it has CLEAN_JOBS set, and otherwise
+ * submitted again if they were found for its job with the same NONCE_1 (the
+ * session was resumed), see `stratum_journal_prune_stale()`. Stratum V2
+ * shares are pruned once a channel is opened, their jobs never outlive it.
+ * Replies are matched by id, so the blocking API's `mining.authorize` and
+ * `mining.submit` get unique ones from then on, from
+ * STRATUM_WORKERS_FIRST_ID on like with workers.
+ **/
+void stratum_session_enable_journal(stratum_session_t *session,
+                                    stratum_journal_t *journal);
+
+/**
+ * Read the socket of `session` from the thread of `reader`, which queues
+ * the parsed messages until `stratum_send_and_handle_data()` (or
+ * `stratum_handle_data()`) hands them to the callback, so a slow callback
+ * no longer delays the reads. What happens once `reader` is full depends on
+ * its overflow policy, see `stratum_reader_init()`.
+ * Returns -1 if the thread could not be started, or on Stratum V2 sessions.
+ **/
+int stratum_session_enable_reader(stratum_session_t *session,
+                                  stratum_reader_t *reader);
+
+/**
+ * Speak Stratum V2 (plaintext, without the Noise handshake) on the socket of
+ * `session` instead of JSON lines. The `stratum_mining_*()` calls are then
+ * sent as their SV2 counterparts:
+ * - `stratum_mining_subscribe()` as SetupConnection,
+ * - `stratum_mining_authorize()` as OpenStandardMiningChannel,
+ * - `stratum_mining_submit()` as SubmitSharesStandard, where `job_id`,
+ *   `time`, `nonce_2` and `solution` are the hex JOB_ID, NTIME, NONCE and
+ *   VERSION of the share,
+ * - `stratum_mining_suggest_target()` as UpdateChannel,
+ * and the callbacks get what the server sends back as responses shaped like
+ * stratum v1 ones, see `stratum_sv2_to_response()`.
+ **/
+void stratum_session_enable_sv2(stratum_session_t *session);
+
+/* update `session` from a Stratum V2 message `msg` received from the server */
+void stratum_session_handle_sv2(stratum_session_t *session,
+                                const stratum_sv2_message_t *msg);
+
+/**
+ * Account for a share submitted on `session` in its rate controller.
+ * Returns 1 and writes the hex target to suggest into `hex` if the rate
+ * left the hysteresis band, 0 otherwise (or without a controller).
+ **/
+int stratum_session_rate_share(stratum_session_t *session, char hex[65]);
+
+/**
+ * Account for a share submitted by `stratum_mining_submit()`, suggesting a
+ * new target with `stratum_mining_suggest_target()` if needed.
+ **/
+void stratum_session_handle_submit(stratum_session_t *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_SESSION_H */
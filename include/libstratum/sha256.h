@@ -0,0 +1,47 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_SHA256_H
+#define LIBSTRATUM_SHA256_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t buf[64];
+} stratum_sha256_t;
+
+void stratum_sha256_init(stratum_sha256_t *ctx);
+
+void stratum_sha256_update(stratum_sha256_t *ctx, const void *data,
+                           size_t size);
+
+void stratum_sha256_final(stratum_sha256_t *ctx, uint8_t out[32]);
+
+/* SHA-256(SHA-256(data)), as used for block and merkle hashes */
+void stratum_sha256d(const void *data, size_t size, uint8_t out[32]);
+
+/**
+ * SHA-256d of `n` messages of `size` bytes, the `i`th one starting at
+ * `data + i * stride` and hashed into `out[i]`. Messages are hashed 8 at a
+ * time in AVX2 lanes on cpus without the SHA extensions.
+ * Unless `prefix` is NULL, every message is hashed as if preceded by what
+ * was fed to `prefix`, which MUST be a multiple of 64 bytes (a midstate).
+ **/
+void stratum_sha256d_many(const stratum_sha256_t *prefix, const uint8_t *data,
+                          size_t size, size_t stride, size_t n,
+                          uint8_t (*out)[32]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_SHA256_H */
@@ -0,0 +1,96 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_SHM_H
+#define LIBSTRATUM_SHM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libstratum/client.h"
+#include "libstratum/job.h"
+#include "libstratum/nonce.h"
+
+// An Equihash (200, 9) solution with its compactSize, see
+// `stratum_mining_submit()`.
+#define STRATUM_SOLUTION_SIZE 1347
+
+/**
+ * Shared memory channel between the process talking to the pool and
+ * out-of-process solvers, without any syscall once mapped:
+ * - the current job sits in a seqlock protected slot, written by the pool
+ *   side and read by any number of solvers,
+ * - shares go back through a bounded ring, pushed by any number of solvers
+ *   and popped by the pool side.
+ **/
+typedef struct stratum_shm stratum_shm_t;
+
+/* a share found by a solver, see `stratum_mining_submit()` */
+typedef struct {
+    char job_id[STRATUM_JOB_ID_SIZE + 1];
+    uint8_t time[4];
+    uint8_t nonce_2_size;
+    uint8_t nonce_2[STRATUM_NONCE_SIZE];
+    uint16_t solution_size;
+    uint8_t solution[STRATUM_SOLUTION_SIZE];
+} stratum_shm_share_t;
+
+/**
+ * Create (or reset) the POSIX shared memory object `name` with room for
+ * `ring_size` shares, a power of two. For the pool side.
+ **/
+stratum_shm_t *stratum_shm_create(const char *name, uint32_t ring_size);
+
+/* map the existing channel `name`, for solvers */
+stratum_shm_t *stratum_shm_open(const char *name);
+
+/* unmap the channel, it stays around until `stratum_shm_unlink()` */
+void stratum_shm_close(stratum_shm_t *shm);
+
+int stratum_shm_unlink(const char *name);
+
+/* make `job` the current job, only the pool side may call this */
+void stratum_shm_publish(stratum_shm_t *shm, const stratum_job_t *job);
+
+/**
+ * Number of jobs published so far, cheap enough to poll between two nonces
+ * to notice a new job.
+ **/
+uint64_t stratum_shm_generation(const stratum_shm_t *shm);
+
+/**
+ * Copy a consistent snapshot of the current job into `job`.
+ * Returns its generation, 0 if no job has been published yet.
+ **/
+uint64_t stratum_shm_read_job(const stratum_shm_t *shm, stratum_job_t *job);
+
+/* queue `share` for submission, returns -1 if the ring is full */
+int stratum_shm_push_share(stratum_shm_t *shm,
+                           const stratum_shm_share_t *share);
+
+/**
+ * Take the oldest queued share, only the pool side may call this.
+ * Returns 1 if `share` was filled in, 0 if the ring is empty.
+ **/
+int stratum_shm_pop_share(stratum_shm_t *shm, stratum_shm_share_t *share);
+
+/**
+ * Submit every queued share as `worker` with `client`, `cb` and `arg` are
+ * passed to `stratum_client_submit()`. Returns the number of shares sent,
+ * duplicates are dropped without being counted.
+ **/
+int stratum_shm_submit_shares(stratum_shm_t *shm, stratum_client_t *client,
+                              const char *worker,
+                              stratum_client_reply_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_SHM_H */
@@ -10,8 +10,11 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "libstratum/writer.h"
+
 #define LIBSTRATUM_VERSION_MAJOR 0
 #define LIBSTRATUM_VERSION_MINOR 0
 #define LIBSTRATUM_VERSION_PATCH 1
@@ -27,24 +30,104 @@ typedef struct {
     char *params;
 } stratum_data_t;
 
+// [[SUBSCRIPTIONS], EXTRANONCE_1, EXTRANONCE_2_SIZE] for Bitcoin-style pools.
+#define STRATUM_MAX_RESULTS 3
+#define STRATUM_MAX_ERRORS 3
+// A Bitcoin-style mining.notify() has 9 params, ZIP-301's has 8.
+#define STRATUM_MAX_PARAMS 9
+
 typedef struct {
     // -1 = parsing error from client (us)
     long id;
     char *method;
-    char *result[2];
-    char *error[3];
-    // server should never send more than 8 params. mining.notify()
-    char *params[8];
+    // Nested arrays and objects are kept as raw JSON, e.g. "[\"ab\",\"cd\"]".
+    char *result[STRATUM_MAX_RESULTS];
+    char *error[STRATUM_MAX_ERRORS];
+    char *params[STRATUM_MAX_PARAMS];
 } stratum_response_t;
 
 typedef void (*stratum_cb_t)(stratum_response_t *evt, int socket);
 
+// https://zips.z.cash/zip-0301#protocol-messages
+typedef enum {
+    STRATUM_METHOD_UNKNOWN = 0,
+    STRATUM_METHOD_SUBSCRIBE,
+    STRATUM_METHOD_AUTHORIZE,
+    STRATUM_METHOD_SET_TARGET,
+    STRATUM_METHOD_NOTIFY,
+    STRATUM_METHOD_SUBMIT,
+    STRATUM_METHOD_SUGGEST_TARGET,
+    STRATUM_METHOD_RECONNECT,
+    // Bitcoin-style pools send a difficulty instead of a target.
+    STRATUM_METHOD_SET_DIFFICULTY,
+} stratum_method_t;
+
 /* serialize the data, so that it is ready to be sent to the socket */
 char *stratum_serialize_data(stratum_data_t *data);
 
-/* parses the JSON data into an alloc'd stratum_data_t */
+/**
+ * Serialize the server's reply to the request `id`.
+ * `result` and `error` are raw JSON values, NULL is sent as `null`.
+ **/
+char *stratum_serialize_result(long id, const char *result, const char *error);
+
+/* serialize a server notification, `params` is a JSON array */
+char *stratum_serialize_notification(const char *method, const char *params);
+
+/**
+ * The `stratum_write_*()` functions serialize a message with `w`, without
+ * allocating unless the writer is allowed to grow, see `stratum_writer_t`.
+ **/
+void stratum_write_subscribe(stratum_writer_t *w, long id,
+                             const char *user_agent, const char *session_id,
+                             const char *host, const char *port);
+
+void stratum_write_authorize(stratum_writer_t *w, long id,
+                             const char *username, const char *password);
+
+void stratum_write_submit(stratum_writer_t *w, long id, const char *worker,
+                          const char *job_id, const char *time,
+                          const char *nonce_2, const char *solution);
+
+void stratum_write_suggest_target(stratum_writer_t *w, long id,
+                                  const char *target);
+
+/**
+ * Parses the JSON data into an alloc'd stratum_response_t, NULL if out of
+ * memory. `id` is set to -1 if the data is not a JSON object. At most
+ * STRATUM_MAX_PARAMS params (and so on) are kept, the others are ignored.
+ **/
 stratum_response_t *stratum_parse_response(const char *data);
 
+/**
+ * Parses a JSON request sent by a client into an alloc'd stratum_response_t,
+ * `id` is set to -1 if the data is not a valid request. NULL if out of
+ * memory.
+ **/
+stratum_response_t *stratum_parse_request(const char *data);
+
+/* free a stratum_response_t returned by the parsing functions */
+void stratum_response_free(stratum_response_t *res);
+
+/* map a `method` string such as "mining.notify" to a stratum_method_t */
+stratum_method_t stratum_method_from_string(const char *method);
+
+/**
+ * Drop the messages of `batch` (received in a single read, in order) that a
+ * later `mining.notify` with clean_jobs set makes pointless: the jobs sent
+ * before it, and every `mining.set_target` before it but the last one.
+ * Replies and other messages are kept. Dropped messages are freed, the
+ * others are moved to the front of `batch` in order and counted.
+ **/
+size_t stratum_coalesce(stratum_response_t **batch, size_t n);
+
+/**
+ * The requests below return 0 once sent (and their reply handled, if they
+ * wait for one), or -1 if the request could not be serialized or the
+ * connection failed, so the caller can reconnect instead of the process
+ * exiting. A share dropped as a duplicate is not an error.
+ **/
+
 /**
  * https://zips.z.cash/zip-0301#mining-subscribe
  *
@@ -64,9 +147,9 @@ stratum_response_t *stratum_parse_response(const char *data);
  *	 Recommended syntax is the User Agent format used by Zcash nodes.
  *   Example: MagicBean/1.0.0
  **/
-void stratum_mining_subscribe(int socket, const char *user_agent,
-                              const char *session_id, const char *host,
-                              const char *port, stratum_cb_t cb);
+int stratum_mining_subscribe(int socket, const char *user_agent,
+                             const char *session_id, const char *host,
+                             const char *port, stratum_cb_t cb);
 
 /**
  * https://zips.z.cash/zip-0301#mining-authorize
@@ -77,11 +160,25 @@ void stratum_mining_subscribe(int socket, const char *user_agent,
  *     The worker password.
  **/
 
-void stratum_mining_authorize(int socket, const char *username,
-                              const char *password, stratum_cb_t cb);
+int stratum_mining_authorize(int socket, const char *username,
+                             const char *password, stratum_cb_t cb);
+
+int stratum_send_and_handle_data(int socket, stratum_data_t *data,
+                                 stratum_cb_t cb);
 
-void stratum_send_and_handle_data(int socket, stratum_data_t *data,
-                                  stratum_cb_t cb);
+/**
+ * Serialize and send `data` without waiting for a reply, anything the
+ * server answers is handled by the next `stratum_send_and_handle_data()`.
+ **/
+int stratum_send_data(int socket, stratum_data_t *data);
+
+/**
+ * Handle what the server sent without sending anything: the lines completed
+ * by reading `socket` until at least one is, or the messages queued by the
+ * session's reader (see `stratum_session_enable_reader()`), waiting for the
+ * first one. Without a session, a line cut short is read to its end.
+ **/
+int stratum_handle_data(int socket, stratum_cb_t cb);
 
 /* convert a stratum server error code to a human readable string */
 const char *stratum_error_code_to_string(uint8_t code);
@@ -105,9 +202,19 @@ const char *stratum_error_code_to_string(uint8_t code);
  *   (including the compactSize at the beginning in canonical form
  *   https://en.bitcoin.it/wiki/Protocol_documentation#Variable_length_integer)
  **/
-void stratum_mining_submit(int socket, const char *worker, const char *job_id,
-                           const char *time, const char *nonce_2,
-                           char *solution, stratum_cb_t cb);
+int stratum_mining_submit(int socket, const char *worker, const char *job_id,
+                          const char *time, const char *nonce_2,
+                          char *solution, stratum_cb_t cb);
+
+/**
+ * https://zips.z.cash/zip-0301#mining-suggest-target
+ *
+ * TARGET (hex)
+ *   The target suggested by the miner for the next received job and all
+ *   subsequent jobs, the server MAY reply with `mining.set_target`.
+ *   Nothing is read back, see `stratum_send_data()`.
+ **/
+int stratum_mining_suggest_target(int socket, const char *target);
 
 #ifdef __cplusplus
 }
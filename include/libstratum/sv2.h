@@ -0,0 +1,226 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_SV2_H
+#define LIBSTRATUM_SV2_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "libstratum/buffer.h"
+#include "libstratum/stratum.h"
+#include "libstratum/target.h"
+
+/**
+ * https://github.com/stratum-mining/sv2-spec
+ *
+ * Stratum V2 frames, in plaintext (without the Noise handshake):
+ * EXTENSION_TYPE (u16) || MSG_TYPE (u8) || MSG_LENGTH (u24) || PAYLOAD,
+ * every integer being little-endian.
+ **/
+#define STRATUM_SV2_HEADER_SIZE 6
+#define STRATUM_SV2_MAX_PAYLOAD 0xffffff
+// Set in EXTENSION_TYPE for the messages addressed to a channel.
+#define STRATUM_SV2_CHANNEL_MSG 0x8000
+
+// SetupConnection.protocol of the mining protocol.
+#define STRATUM_SV2_PROTOCOL_MINING 0
+#define STRATUM_SV2_VERSION 2
+
+typedef enum {
+    STRATUM_SV2_SETUP_CONNECTION = 0x00,
+    STRATUM_SV2_SETUP_CONNECTION_SUCCESS = 0x01,
+    STRATUM_SV2_SETUP_CONNECTION_ERROR = 0x02,
+    STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL = 0x10,
+    STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS = 0x11,
+    STRATUM_SV2_OPEN_MINING_CHANNEL_ERROR = 0x12,
+    STRATUM_SV2_NEW_MINING_JOB = 0x15,
+    STRATUM_SV2_UPDATE_CHANNEL = 0x16,
+    STRATUM_SV2_SUBMIT_SHARES_STANDARD = 0x1a,
+    STRATUM_SV2_SUBMIT_SHARES_SUCCESS = 0x1c,
+    STRATUM_SV2_SUBMIT_SHARES_ERROR = 0x1d,
+    STRATUM_SV2_SET_NEW_PREV_HASH = 0x20,
+    STRATUM_SV2_SET_TARGET = 0x21,
+    // Any other message, or one of a protocol extension.
+    STRATUM_SV2_UNKNOWN = 0xff,
+} stratum_sv2_type_t;
+
+// STR0_255 fields, null terminated.
+typedef char stratum_sv2_str_t[256];
+
+typedef struct {
+    uint8_t protocol;
+    uint16_t min_version;
+    uint16_t max_version;
+    uint32_t flags;
+    stratum_sv2_str_t endpoint_host;
+    uint16_t endpoint_port;
+    stratum_sv2_str_t vendor;
+    stratum_sv2_str_t hardware_version;
+    stratum_sv2_str_t firmware;
+    stratum_sv2_str_t device_id;
+} stratum_sv2_setup_connection_t;
+
+typedef struct {
+    uint16_t used_version;
+    uint32_t flags;
+} stratum_sv2_setup_connection_success_t;
+
+typedef struct {
+    uint32_t flags;
+    stratum_sv2_str_t error_code;
+} stratum_sv2_setup_connection_error_t;
+
+typedef struct {
+    uint32_t request_id;
+    stratum_sv2_str_t user_identity;
+    float nominal_hash_rate;
+    // U256 fields are little-endian, see `stratum_sv2_target_from_u256()`.
+    uint8_t max_target[32];
+} stratum_sv2_open_standard_mining_channel_t;
+
+typedef struct {
+    uint32_t request_id;
+    uint32_t channel_id;
+    uint8_t target[32];
+    uint8_t extranonce_prefix[32];
+    uint8_t extranonce_prefix_size;
+    uint32_t group_channel_id;
+} stratum_sv2_open_standard_mining_channel_success_t;
+
+typedef struct {
+    uint32_t request_id;
+    stratum_sv2_str_t error_code;
+} stratum_sv2_open_mining_channel_error_t;
+
+typedef struct {
+    uint32_t channel_id;
+    uint32_t job_id;
+    // A future job, to be mined once a SetNewPrevHash refers to it, has no
+    // min_ntime.
+    uint8_t has_min_ntime;
+    uint32_t min_ntime;
+    uint32_t version;
+    // In block header order.
+    uint8_t merkle_root[32];
+} stratum_sv2_new_mining_job_t;
+
+typedef struct {
+    uint32_t channel_id;
+    float nominal_hash_rate;
+    uint8_t maximum_target[32];
+} stratum_sv2_update_channel_t;
+
+typedef struct {
+    uint32_t channel_id;
+    uint32_t sequence_number;
+    uint32_t job_id;
+    uint32_t nonce;
+    uint32_t ntime;
+    uint32_t version;
+} stratum_sv2_submit_shares_standard_t;
+
+typedef struct {
+    uint32_t channel_id;
+    uint32_t last_sequence_number;
+    uint32_t new_submits_accepted_count;
+    uint64_t new_shares_sum;
+} stratum_sv2_submit_shares_success_t;
+
+typedef struct {
+    uint32_t channel_id;
+    uint32_t sequence_number;
+    stratum_sv2_str_t error_code;
+} stratum_sv2_submit_shares_error_t;
+
+typedef struct {
+    uint32_t channel_id;
+    uint32_t job_id;
+    // In block header order.
+    uint8_t prev_hash[32];
+    uint32_t min_ntime;
+    uint32_t nbits;
+} stratum_sv2_set_new_prev_hash_t;
+
+typedef struct {
+    uint32_t channel_id;
+    uint8_t maximum_target[32];
+} stratum_sv2_set_target_t;
+
+typedef struct {
+    stratum_sv2_type_t type;
+
+    union {
+        stratum_sv2_setup_connection_t setup_connection;
+        stratum_sv2_setup_connection_success_t setup_connection_success;
+        stratum_sv2_setup_connection_error_t setup_connection_error;
+        stratum_sv2_open_standard_mining_channel_t
+            open_standard_mining_channel;
+        stratum_sv2_open_standard_mining_channel_success_t
+            open_standard_mining_channel_success;
+        stratum_sv2_open_mining_channel_error_t open_mining_channel_error;
+        stratum_sv2_new_mining_job_t new_mining_job;
+        stratum_sv2_update_channel_t update_channel;
+        stratum_sv2_submit_shares_standard_t submit_shares_standard;
+        stratum_sv2_submit_shares_success_t submit_shares_success;
+        stratum_sv2_submit_shares_error_t submit_shares_error;
+        stratum_sv2_set_new_prev_hash_t set_new_prev_hash;
+        stratum_sv2_set_target_t set_target;
+    } body;
+} stratum_sv2_message_t;
+
+/**
+ * Append the frame of `msg` to `buf`.
+ * Returns -1 if `msg` is of an unknown type or `buf` cannot grow.
+ **/
+int stratum_sv2_encode(stratum_buffer_t *buf, const stratum_sv2_message_t *msg);
+
+/**
+ * Decode the frame at the start of the `size` bytes of `data` into `msg`.
+ * Returns the size of the frame, 0 if it is not complete yet, or -1 if it is
+ * malformed. Messages this library does not know are skipped with their type
+ * set to STRATUM_SV2_UNKNOWN.
+ **/
+ssize_t stratum_sv2_decode(stratum_sv2_message_t *msg, const uint8_t *data,
+                           size_t size);
+
+/**
+ * The stratum v1 shaped equivalent of `msg`, as handed to `stratum_cb_t`
+ * callbacks, or NULL if there is none. Replies carry the request id (or the
+ * share's sequence number) of their request and a `result[0]` of "true", or
+ * "null" with the ZIP-301 error triple [CODE, ERROR_CODE, null].
+ * NewMiningJob and SetNewPrevHash become the notifications
+ * `mining.new_mining_job` and `mining.set_new_prev_hash`, with their fields
+ * as hex (integers in big-endian) in the message's order, and SetTarget
+ * becomes `mining.set_target` [TARGET, CHANNEL_ID].
+ **/
+stratum_response_t *stratum_sv2_to_response(const stratum_sv2_message_t *msg);
+
+/* convert the little-endian U256 `u256` into a target */
+void stratum_sv2_target_from_u256(stratum_target_t *target,
+                                  const uint8_t u256[32]);
+
+/* convert `target` into a little-endian U256 */
+void stratum_sv2_target_to_u256(const stratum_target_t *target,
+                                uint8_t u256[32]);
+
+/**
+ * The 80 bytes block header of `job` on top of `prev_hash`, with the
+ * nonce zeroed and the time set to the latest of both min_ntime.
+ **/
+void stratum_sv2_header(const stratum_sv2_new_mining_job_t *job,
+                        const stratum_sv2_set_new_prev_hash_t *prev_hash,
+                        uint8_t header[80]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_SV2_H */
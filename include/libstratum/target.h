@@ -0,0 +1,67 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_TARGET_H
+#define LIBSTRATUM_TARGET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    // 256-bit big-endian integer, as sent by `mining.set_target`.
+    uint8_t bytes[32];
+} stratum_target_t;
+
+/**
+ * https://zips.z.cash/zip-0301#mining-set-target
+ *
+ * Parse the TARGET (hex) of `mining.set_target`, shorter strings are
+ * zero extended on the left. Returns -1 if `hex` is not a valid target.
+ **/
+int stratum_target_from_hex(stratum_target_t *target, const char *hex);
+
+/**
+ * The target of the DIFFICULTY sent by `mining.set_difficulty` on
+ * Bitcoin-style pools, where difficulty 1 is 0xffff * 2^208.
+ * Returns -1 if `difficulty` is not positive.
+ **/
+int stratum_target_from_difficulty(stratum_target_t *target,
+                                   double difficulty);
+
+/* encode `target` as 64 hex characters into `out` (65 bytes) */
+void stratum_target_to_hex(const stratum_target_t *target, char *out);
+
+/**
+ * Multiply `target` by `factor` (clamped to [0, 255]), saturating at the
+ * largest target. A factor above 1 makes shares easier to find.
+ **/
+void stratum_target_scale(stratum_target_t *target, double factor);
+
+/**
+ * Returns 1 if the block hash `hash` (as output by SHA-256d, i.e. a
+ * little-endian integer) is not larger than `target`, 0 otherwise.
+ **/
+int stratum_target_check_hash(const stratum_target_t *target,
+                              const uint8_t hash[32]);
+
+/**
+ * Hash the block header `header` followed by the Equihash `solution`
+ * (including its compactSize, as sent by `mining.submit`) with SHA-256d and
+ * compare it to `target`.
+ * Returns 1 if the pool would accept the share, 0 if it is low difficulty.
+ **/
+int stratum_share_check(const stratum_target_t *target, const uint8_t *header,
+                        size_t header_size, const uint8_t *solution,
+                        size_t solution_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_TARGET_H */
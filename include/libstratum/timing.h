@@ -0,0 +1,100 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_TIMING_H
+#define LIBSTRATUM_TIMING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Submits waiting for their reply that can be timed at once.
+#define STRATUM_TIMING_PENDING 16
+
+typedef enum {
+    // Kernel receive timestamp -> message parsed.
+    STRATUM_STAGE_WIRE_TO_PARSED = 0,
+    // Message parsed -> callback returned.
+    STRATUM_STAGE_PARSED_TO_DISPATCHED,
+    // `mining.submit` made -> kernel transmit timestamp.
+    STRATUM_STAGE_SUBMIT_TO_WIRE,
+    // Kernel transmit timestamp -> kernel receive timestamp of the reply.
+    STRATUM_STAGE_WIRE_TO_ACK,
+    STRATUM_STAGE_COUNT,
+} stratum_stage_t;
+
+// All times are in nanoseconds.
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} stratum_latency_t;
+
+typedef struct {
+    long id;
+    // Number of bytes sent on the connection up to the end of the request.
+    uint32_t end;
+    uint64_t submit;
+    // Kernel transmit timestamp, 0 until known.
+    uint64_t wire;
+} stratum_timing_submit_t;
+
+/**
+ * Per stage latency of a connection, split by the kernel timestamps of
+ * SO_TIMESTAMPING into the time spent on the network and in the process.
+ * It is updated by the thread handling the connection.
+ **/
+typedef struct {
+    stratum_latency_t stages[STRATUM_STAGE_COUNT];
+
+    // Kernel receive timestamp of the data being handled.
+    uint64_t rx_wire;
+    // Bytes sent since timestamping was enabled, see `socket_tx_timestamp()`.
+    uint32_t tx_bytes;
+    stratum_timing_submit_t submits[STRATUM_TIMING_PENDING];
+} stratum_timing_t;
+
+/* reset `timing` and turn on the kernel timestamps of `socket` */
+int stratum_timing_enable(stratum_timing_t *timing, int socket);
+
+/* current CLOCK_REALTIME in nanoseconds, the clock of kernel timestamps */
+uint64_t stratum_timing_now(void);
+
+/* account for the time between `start` and `end` in `stage` */
+void stratum_timing_record(stratum_timing_t *timing, stratum_stage_t stage,
+                           uint64_t start, uint64_t end);
+
+/* account for `size` bytes sent on the connection */
+void stratum_timing_sent(stratum_timing_t *timing, size_t size);
+
+/**
+ * Time the submit request `id` made at `start`, which ends once `end` bytes
+ * have been sent on the connection.
+ **/
+void stratum_timing_submit(stratum_timing_t *timing, long id, uint32_t end,
+                           uint64_t start);
+
+/* collect the transmit timestamps of `socket`, without blocking */
+void stratum_timing_poll_tx(stratum_timing_t *timing, int socket);
+
+/* the reply to request `id` arrived, received at `timing->rx_wire` */
+void stratum_timing_ack(stratum_timing_t *timing, long id);
+
+/* mean latency of `stage` in nanoseconds, 0 if nothing was recorded */
+uint64_t stratum_timing_mean(const stratum_timing_t *timing,
+                             stratum_stage_t stage);
+
+/* a printable name for `stage`, such as "wire->parsed" */
+const char *stratum_stage_to_string(stratum_stage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_TIMING_H */
@@ -0,0 +1,92 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_WORKERS_H
+#define LIBSTRATUM_WORKERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "libstratum/stratum.h"
+#include "libstratum/sv2.h"
+
+#define STRATUM_MAX_WORKERS 64
+#define STRATUM_WORKER_NAME_SIZE 128
+// Requests remembered until answered, older ones are forgotten.
+#define STRATUM_WORKERS_PENDING 256
+// First id handed out by the blocking API, after its fixed ids.
+#define STRATUM_WORKERS_FIRST_ID 16
+
+typedef enum {
+    STRATUM_WORKER_AUTHORIZE,
+    STRATUM_WORKER_SUBMIT,
+} stratum_worker_request_t;
+
+typedef struct {
+    char name[STRATUM_WORKER_NAME_SIZE];
+    // Set once the server accepted its `mining.authorize`.
+    uint8_t authorized;
+    // The Stratum V2 channel opened for it.
+    uint32_t channel_id;
+
+    uint64_t accepted;
+    uint64_t rejected;
+} stratum_worker_t;
+
+typedef struct {
+    long id;
+    int worker;
+    stratum_worker_request_t type;
+    uint8_t answered;
+} stratum_workers_pending_t;
+
+/**
+ * The workers authorized on a single connection, with the requests made for
+ * them so every reply can be routed back to its worker.
+ **/
+typedef struct {
+    stratum_worker_t workers[STRATUM_MAX_WORKERS];
+    int count;
+
+    // Next id of the blocking API's requests, see
+    // `stratum_session_enable_workers()`.
+    long next_id;
+    stratum_workers_pending_t pending[STRATUM_WORKERS_PENDING];
+    uint32_t head;
+} stratum_workers_t;
+
+/* initialize `workers` without any worker */
+void stratum_workers_init(stratum_workers_t *workers);
+
+/* the worker named `name`, or NULL */
+stratum_worker_t *stratum_workers_find(stratum_workers_t *workers,
+                                       const char *name);
+
+/**
+ * Remember that the request `id` of `type` was made for the worker `name`,
+ * which is added if needed. Returns -1 if there is no room for it.
+ **/
+int stratum_workers_track(stratum_workers_t *workers, long id,
+                          const char *name, stratum_worker_request_t type);
+
+/* the worker the request `id` was made for, or NULL */
+stratum_worker_t *stratum_workers_lookup(stratum_workers_t *workers, long id);
+
+/* update the worker of the request `res` answers */
+void stratum_workers_handle_response(stratum_workers_t *workers,
+                                     const stratum_response_t *res);
+
+/* update the workers from the Stratum V2 reply `msg` */
+void stratum_workers_handle_sv2(stratum_workers_t *workers,
+                                const stratum_sv2_message_t *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_WORKERS_H */
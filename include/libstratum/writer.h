@@ -0,0 +1,94 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef LIBSTRATUM_WRITER_H
+#define LIBSTRATUM_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * JSON writer serializing stratum messages straight into a caller provided
+ * buffer, such as a stack array or a connection's output buffer.
+ * `len` always counts every byte written so far, when it does not fit into
+ * `size` (minus the '\0') the output is incomplete, like `snprintf()`.
+ **/
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    // Move to the heap once `buf` is full instead of failing.
+    uint8_t grow;
+    // `buf` was allocated by the writer.
+    uint8_t owned;
+    uint8_t overflow;
+    // Params written since `stratum_writer_begin_request()`.
+    uint8_t items;
+} stratum_writer_t;
+
+/**
+ * Write into the `size` bytes of `buf` (which MAY be NULL to only measure).
+ * If `grow` is set, the output moves to a heap buffer once `buf` is full,
+ * which must then be released with `stratum_writer_free()`.
+ **/
+void stratum_writer_init(stratum_writer_t *w, char *buf, size_t size,
+                         int grow);
+
+/* release the heap buffer the writer may have moved to */
+void stratum_writer_free(stratum_writer_t *w);
+
+/**
+ * Terminate the output with '\0' and return its length.
+ * The output is only complete if the returned length is less than `w->size`.
+ **/
+size_t stratum_writer_finish(stratum_writer_t *w);
+
+/* write `size` bytes of `data` as is */
+void stratum_writer_raw(stratum_writer_t *w, const char *data, size_t size);
+
+/* write `str` as a quoted JSON string, escaping it as needed */
+void stratum_writer_string(stratum_writer_t *w, const char *str);
+
+void stratum_writer_long(stratum_writer_t *w, long value);
+
+/**
+ * Write `{"id": <id>, "method": "<method>", "params": <params>}\n`,
+ * `params` is a raw JSON array and an `id` of 0 is written as null.
+ **/
+void stratum_writer_request(stratum_writer_t *w, long id, const char *method,
+                            const char *params);
+
+/**
+ * Write `{"id": <id>, "method": "<method>", "params": [`,
+ * an `id` of 0 is written as null.
+ **/
+void stratum_writer_begin_request(stratum_writer_t *w, long id,
+                                  const char *method);
+
+/* add the string param `str` (NULL is written as null) to the request */
+void stratum_writer_param(stratum_writer_t *w, const char *str);
+
+/* add the raw JSON value `json` as a param to the request */
+void stratum_writer_param_raw(stratum_writer_t *w, const char *json);
+
+/* write `]}\n` */
+void stratum_writer_end_request(stratum_writer_t *w);
+
+/**
+ * Write `{"id": <id>, "result": <result>, "error": <error>}\n`,
+ * `result` and `error` are raw JSON values, NULL is written as null.
+ **/
+void stratum_writer_result(stratum_writer_t *w, long id, const char *result,
+                           const char *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSTRATUM_WRITER_H */
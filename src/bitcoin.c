@@ -0,0 +1,183 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#include "libstratum/bitcoin.h"
+
+#include "libstratum/hex.h"
+
+// Coinbases hashed side by side, one per SIMD lane.
+#define LANES 8
+
+/* decode `hex` into exactly `size` bytes */
+static int bitcoin_field(uint8_t *out, size_t size, const char *hex) {
+    return strlen(hex) == 2 * size &&
+                   stratum_hex_decode(hex, out, size) == (int)size
+               ? 0
+               : -1;
+}
+
+/* decode the big-endian hex u32 `hex` in little-endian, as in the header */
+static int bitcoin_u32(uint8_t *out, const char *hex) {
+    uint8_t be[4];
+
+    if (bitcoin_field(be, sizeof(be), hex) == -1)
+        return -1;
+
+    for (int i = 0; i < 4; i++)
+        out[i] = be[3 - i];
+
+    return 0;
+}
+
+/* append the hex `hex` to the coinbase of `job` */
+static int bitcoin_append(stratum_bitcoin_job_t *job, const char *hex) {
+    size_t size = strlen(hex) / 2;
+
+    if (size > sizeof(job->coinbase) - job->coinbase_size ||
+        bitcoin_field(job->coinbase + job->coinbase_size, size, hex) == -1)
+        return -1;
+
+    job->coinbase_size += size;
+
+    return 0;
+}
+
+/* decode the JSON array of hex strings `json` into the merkle branches */
+static int bitcoin_branches(stratum_bitcoin_job_t *job, const char *json) {
+    const char *p = json;
+
+    if (*p++ != '[')
+        return -1;
+
+    while ((p = strchr(p, '"')) != NULL) {
+        char hex[65];
+        const char *end = strchr(++p, '"');
+
+        if (end == NULL || end - p != 64 ||
+            job->nbranches == STRATUM_BITCOIN_MAX_BRANCHES)
+            return -1;
+
+        memcpy(hex, p, 64);
+        hex[64] = '\0';
+
+        if (bitcoin_field(job->branches[job->nbranches++], 32, hex) == -1)
+            return -1;
+
+        p = end + 1;
+    }
+
+    return 0;
+}
+
+int stratum_bitcoin_job_from_notify(stratum_bitcoin_job_t *job,
+                                    const stratum_response_t *res,
+                                    const stratum_session_t *session) {
+    // [JOB_ID, PREVHASH, COINB1, COINB2, [BRANCHES], VERSION, NBITS, NTIME,
+    //  CLEAN_JOBS]
+    char *const *params = res->params;
+    uint8_t prevhash[32];
+
+    if (stratum_method_from_string(res->method) != STRATUM_METHOD_NOTIFY)
+        return -1;
+
+    for (int i = 0; i < 9; i++)
+        if (params[i] == NULL)
+            return -1;
+
+    if (strlen(params[0]) > STRATUM_JOB_ID_SIZE ||
+        session->nonce_2_size == 0 ||
+        session->nonce_2_size > STRATUM_NONCE_SIZE)
+        return -1;
+
+    memset(job, 0, sizeof(stratum_bitcoin_job_t));
+    strcpy(job->job_id, params[0]);
+
+    // PREVHASH is sent with the bytes of each 32-bit word swapped.
+    if (bitcoin_field(prevhash, sizeof(prevhash), params[1]) == -1)
+        return -1;
+
+    for (int i = 0; i < 32; i++)
+        job->header[4 + i] = prevhash[(i & ~3) + 3 - (i & 3)];
+
+    if (bitcoin_u32(job->header, params[5]) == -1 ||
+        bitcoin_u32(job->header + 72, params[6]) == -1 ||
+        bitcoin_u32(job->header + STRATUM_BITCOIN_HEADER_TIME, params[7]) ==
+            -1)
+        return -1;
+
+    if (bitcoin_append(job, params[2]) == -1 ||
+        bitcoin_append(job, session->nonce_1) == -1)
+        return -1;
+
+    job->nonce_2_offset = job->coinbase_size;
+    job->nonce_2_size = session->nonce_2_size;
+
+    if (job->nonce_2_size > sizeof(job->coinbase) - job->coinbase_size)
+        return -1;
+
+    job->coinbase_size += job->nonce_2_size;
+
+    if (bitcoin_append(job, params[3]) == -1 ||
+        bitcoin_branches(job, params[4]) == -1)
+        return -1;
+
+    stratum_sha256_init(&job->midstate);
+    stratum_sha256_update(&job->midstate, job->coinbase,
+                          job->nonce_2_offset & ~63);
+
+    job->clean = strcmp(params[8], "true") == 0;
+    job->has_target = session->has_target;
+    job->target = session->target;
+
+    return 0;
+}
+
+void stratum_bitcoin_merkle_roots(const stratum_bitcoin_job_t *job,
+                                  const uint8_t *nonce_2, size_t n,
+                                  uint8_t (*roots)[32]) {
+    // What is left of the coinbase after the midstate, for each lane.
+    uint8_t tails[LANES][STRATUM_BITCOIN_COINBASE_SIZE];
+    size_t skip = job->midstate.count;
+    size_t size = job->coinbase_size - skip;
+    uint8_t pairs[LANES][64];
+
+    for (size_t i = 0; i < LANES && i < n; i++)
+        memcpy(tails[i], job->coinbase + skip, size);
+
+    for (; n > 0; n -= n < LANES ? n : LANES) {
+        size_t lanes = n < LANES ? n : LANES;
+
+        for (size_t i = 0; i < lanes; i++)
+            memcpy(tails[i] + job->nonce_2_offset - skip,
+                   nonce_2 + i * job->nonce_2_size, job->nonce_2_size);
+
+        stratum_sha256d_many(&job->midstate, tails[0], size,
+                             sizeof(tails[0]), lanes, roots);
+
+        for (int b = 0; b < job->nbranches; b++) {
+            for (size_t i = 0; i < lanes; i++) {
+                memcpy(pairs[i], roots[i], 32);
+                memcpy(pairs[i] + 32, job->branches[b], 32);
+            }
+
+            stratum_sha256d_many(NULL, pairs[0], sizeof(pairs[0]),
+                                 sizeof(pairs[0]), lanes, roots);
+        }
+
+        nonce_2 += lanes * job->nonce_2_size;
+        roots += lanes;
+    }
+}
+
+void stratum_bitcoin_header(const stratum_bitcoin_job_t *job,
+                            const uint8_t *nonce_2,
+                            uint8_t header[STRATUM_BITCOIN_HEADER_SIZE]) {
+    memcpy(header, job->header, STRATUM_BITCOIN_HEADER_SIZE);
+    stratum_bitcoin_merkle_roots(
+        job, nonce_2, 1,
+        (uint8_t(*)[32])(header + STRATUM_BITCOIN_HEADER_MERKLE_ROOT));
+}
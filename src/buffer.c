@@ -0,0 +1,83 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libstratum/buffer.h"
+
+#define MIN_CAPACITY 1024
+
+void stratum_buffer_init(stratum_buffer_t *buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void stratum_buffer_free(stratum_buffer_t *buf) {
+    free(buf->data);
+    stratum_buffer_init(buf);
+}
+
+int stratum_buffer_reserve(stratum_buffer_t *buf, size_t size) {
+    size_t cap = buf->cap ? buf->cap : MIN_CAPACITY;
+    char *data;
+
+    if (buf->len + size <= buf->cap)
+        return 0;
+
+    while (cap < buf->len + size)
+        cap *= 2;
+
+    if ((data = realloc(buf->data, cap)) == NULL)
+        return -1;
+
+    buf->data = data;
+    buf->cap = cap;
+
+    return 0;
+}
+
+int stratum_buffer_append(stratum_buffer_t *buf, const void *data,
+                          size_t size) {
+    if (stratum_buffer_reserve(buf, size) == -1)
+        return -1;
+
+    memcpy(buf->data + buf->len, data, size);
+    buf->len += size;
+
+    return 0;
+}
+
+void stratum_buffer_consume(stratum_buffer_t *buf, size_t size) {
+    if (size >= buf->len) {
+        buf->len = 0;
+        return;
+    }
+
+    memmove(buf->data, buf->data + size, buf->len - size);
+    buf->len -= size;
+}
+
+char *stratum_buffer_next_line(stratum_buffer_t *buf, size_t *offset) {
+    char *line, *end;
+
+    if (*offset >= buf->len)
+        return NULL;
+
+    line = buf->data + *offset;
+
+    if ((end = memchr(line, '\n', buf->len - *offset)) == NULL)
+        return NULL;
+
+    *end = '\0';
+    *offset = end - buf->data + 1;
+
+    // Tolerate "\r\n" terminated lines.
+    if (end > line && end[-1] == '\r')
+        end[-1] = '\0';
+
+    return line;
+}
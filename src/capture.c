@@ -0,0 +1,324 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libstratum/capture.h"
+
+#include "libstratum/buffer.h"
+#include "libstratum/session.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+#define MAGIC_SIZE (sizeof(STRATUM_CAPTURE_MAGIC) - 1)
+#define RECORD_SIZE sizeof(stratum_capture_record_t)
+
+// The capture every socket writes to, -1 when not capturing.
+static int capture_fd = -1;
+// Writers between loading `capture_fd` and being done with it.
+static int capture_writers;
+
+typedef struct {
+    uint16_t socket;
+    stratum_buffer_t buf;
+} replay_stream_t;
+
+struct stratum_replay {
+    uint8_t *data;
+    size_t size;
+    // Partial lines received on each recorded socket.
+    replay_stream_t *streams;
+    size_t nstreams;
+};
+
+static uint64_t capture_now(int clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Make `fd` the capture, then close the previous one once no writer can
+ * still be using it, so its number is never written to after being reused.
+ **/
+static void capture_swap(int fd) {
+    fd = __atomic_exchange_n(&capture_fd, fd, __ATOMIC_SEQ_CST);
+
+    if (fd == -1)
+        return;
+
+    // Writers counted from now on load the new fd.
+    while (__atomic_load_n(&capture_writers, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    close(fd);
+}
+
+int stratum_capture_open(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+
+    if (fd == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size == 0 &&
+         write(fd, STRATUM_CAPTURE_MAGIC, MAGIC_SIZE) != MAGIC_SIZE)) {
+        close(fd);
+        return -1;
+    }
+
+    capture_swap(fd);
+
+    DEBUG_LOG("Capturing traffic to %s", path);
+
+    return 0;
+}
+
+void stratum_capture_close(void) { capture_swap(-1); }
+
+void stratum_capture_write(int socket, stratum_capture_dir_t dir,
+                           const void *data, size_t size) {
+    stratum_capture_record_t record;
+    int fd;
+    struct iovec iov[2];
+    // `iov_base` is not const, even though writev() only reads from it.
+    union {
+        const void *in;
+        void *out;
+    } payload = {data};
+
+    if (size == 0 || __atomic_load_n(&capture_fd, __ATOMIC_RELAXED) == -1)
+        return;
+
+    // Counted before loading the fd, so closing it waits for this write.
+    __atomic_add_fetch(&capture_writers, 1, __ATOMIC_SEQ_CST);
+
+    if ((fd = __atomic_load_n(&capture_fd, __ATOMIC_SEQ_CST)) == -1) {
+        __atomic_sub_fetch(&capture_writers, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    record.time = htole64(capture_now(CLOCK_REALTIME));
+    record.size = htole32(size);
+    record.socket = htole16(socket);
+    record.dir = dir;
+    record.reserved = 0;
+
+    iov[0].iov_base = &record;
+    iov[0].iov_len = RECORD_SIZE;
+    iov[1].iov_base = payload.out;
+    iov[1].iov_len = size;
+
+    // A single O_APPEND write keeps records from concurrent threads whole.
+    if (writev(fd, iov, 2) != (ssize_t)(RECORD_SIZE + size)) {
+        CRITICAL_LOG("Failed to capture %zu bytes of fd(%d)", size, socket);
+    }
+
+    __atomic_sub_fetch(&capture_writers, 1, __ATOMIC_RELEASE);
+}
+
+stratum_replay_t *stratum_replay_open(const char *path) {
+    stratum_replay_t *replay = calloc(1, sizeof(stratum_replay_t));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    void *data;
+
+    if (replay == NULL || fd == -1 || fstat(fd, &st) == -1 ||
+        (size_t)st.st_size < MAGIC_SIZE) {
+        if (fd != -1)
+            close(fd);
+
+        free(replay);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd,
+                0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        free(replay);
+        return NULL;
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    replay->data = data;
+    replay->size = st.st_size;
+
+    if (memcmp(replay->data, STRATUM_CAPTURE_MAGIC, MAGIC_SIZE) != 0) {
+        stratum_replay_close(replay);
+        return NULL;
+    }
+
+    return replay;
+}
+
+void stratum_replay_close(stratum_replay_t *replay) {
+    for (size_t i = 0; i < replay->nstreams; i++)
+        stratum_buffer_free(&replay->streams[i].buf);
+
+    munmap(replay->data, replay->size);
+    free(replay->streams);
+    free(replay);
+}
+
+static stratum_buffer_t *replay_stream(stratum_replay_t *replay,
+                                       uint16_t socket) {
+    replay_stream_t *streams;
+
+    for (size_t i = 0; i < replay->nstreams; i++)
+        if (replay->streams[i].socket == socket)
+            return &replay->streams[i].buf;
+
+    streams = realloc(replay->streams,
+                      (replay->nstreams + 1) * sizeof(replay_stream_t));
+
+    if (streams == NULL)
+        return NULL;
+
+    replay->streams = streams;
+    streams += replay->nstreams++;
+    streams->socket = socket;
+    stratum_buffer_init(&streams->buf);
+
+    return &streams->buf;
+}
+
+static void replay_lines(stratum_buffer_t *buf, int socket, stratum_cb_t cb,
+                         stratum_replay_stats_t *stats) {
+    stratum_session_t *session = stratum_session_lookup(socket);
+    size_t offset = 0;
+    char *line;
+
+    while ((line = stratum_buffer_next_line(buf, &offset)) != NULL) {
+        if (!strlen(line))
+            continue;
+
+        stratum_response_t *res = stratum_parse_response(line);
+
+        if (res == NULL || res->id == -1) {
+            DEBUG_LOG("Failed to parse `%s`", line);
+            stats->errors++;
+        } else {
+            if (session != NULL)
+                stratum_session_handle_response(session, res);
+
+            if (cb != NULL)
+                cb(res, socket);
+
+            stats->lines++;
+        }
+
+        stratum_response_free(res);
+    }
+
+    stratum_buffer_consume(buf, offset);
+}
+
+static void replay_wait(uint64_t start, uint64_t delay) {
+    struct timespec ts;
+    uint64_t deadline = start + delay;
+
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+int stratum_replay_run(stratum_replay_t *replay, int flags, stratum_cb_t cb,
+                       stratum_replay_stats_t *stats) {
+    stratum_replay_stats_t local;
+    uint64_t start = capture_now(CLOCK_MONOTONIC), first = 0;
+    size_t offset = MAGIC_SIZE;
+    int ret = 0;
+
+    if (stats == NULL)
+        stats = &local;
+
+    memset(stats, 0, sizeof(stratum_replay_stats_t));
+
+    while (offset < replay->size) {
+        stratum_capture_record_t record;
+        stratum_buffer_t *buf;
+
+        if (replay->size - offset < RECORD_SIZE) {
+            ret = -1;
+            break;
+        }
+
+        memcpy(&record, replay->data + offset, RECORD_SIZE);
+        record.time = le64toh(record.time);
+        record.size = le32toh(record.size);
+        record.socket = le16toh(record.socket);
+        offset += RECORD_SIZE;
+
+        if (replay->size - offset < record.size) {
+            ret = -1;
+            break;
+        }
+
+        if (stats->records++ == 0)
+            first = record.time;
+        else if ((flags & STRATUM_REPLAY_PACED) && record.time > first)
+            replay_wait(start, record.time - first);
+
+        stats->bytes += record.size;
+
+        // What we sent is only there for its timing.
+        if (record.dir == STRATUM_CAPTURE_RX) {
+            if ((buf = replay_stream(replay, record.socket)) == NULL ||
+                stratum_buffer_append(buf, replay->data + offset,
+                                      record.size) == -1) {
+                ret = -1;
+                break;
+            }
+
+            replay_lines(buf, record.socket, cb, stats);
+        }
+
+        offset += record.size;
+    }
+
+    stats->elapsed_ns = capture_now(CLOCK_MONOTONIC) - start;
+
+    // Partial lines do not carry over to the next run.
+    for (size_t i = 0; i < replay->nstreams; i++)
+        stratum_buffer_consume(&replay->streams[i].buf,
+                               replay->streams[i].buf.len);
+
+    return ret;
+}
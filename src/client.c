@@ -0,0 +1,971 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "libstratum/client.h"
+
+#include "libstratum/buffer.h"
+#include "libstratum/capture.h"
+#include "libstratum/connection.h"
+#include "libstratum/writer.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+#define READ_SIZE 4096
+// Requests waiting for a reply, indexed by id.
+#define MAX_INFLIGHT STRATUM_CLIENT_MAX_INFLIGHT
+// A server sending more than this without a '\n' is misbehaving.
+#define MAX_LINE_SIZE (64 * 1024)
+#define DEFAULT_REQUEST_TIMEOUT 30000
+// Messages of a read handed to `stratum_coalesce()` at once.
+#define MAX_BATCH 64
+// Bytes sent per wakeup before the other connections of the loop get a turn.
+#define FLUSH_QUANTUM (16 * 1024)
+
+// Outbound queues, a class is only sent once the ones before it are empty.
+typedef enum {
+    CLIENT_PRIORITY_SUBMIT = 0,
+    // mining.subscribe and mining.authorize.
+    CLIENT_PRIORITY_SESSION,
+    // mining.suggest_target, and anything else that can wait.
+    CLIENT_PRIORITY_BACKGROUND,
+    CLIENT_PRIORITIES,
+} client_priority_t;
+
+typedef struct {
+    long id;
+    stratum_client_reply_cb_t cb;
+    void *arg;
+    stratum_client_t *client;
+    // Fails the request if the server takes too long to reply.
+    stratum_timer_t timer;
+} client_request_t;
+
+struct stratum_client {
+    stratum_loop_t *loop;
+    stratum_loop_handler_t handler;
+    stratum_session_t session;
+    char *hostname;
+    char *port;
+    // Resolved once by `stratum_client_init()`, reconnects reuse them.
+    struct addrinfo *addrs;
+
+    int connected;
+    int closed;
+    int reconnecting;
+    int freed;
+    // Bumped on every (re)connection, to notice one from within a callback.
+    uint32_t conn;
+    uint32_t events;
+    stratum_buffer_t rx;
+    stratum_buffer_t tx[CLIENT_PRIORITIES];
+    // Bytes left of a line cut short by a partial send, at the front of
+    // `tx[partial_class]`. It is finished before anything else is sent.
+    size_t partial;
+    int partial_class;
+
+    long next_id;
+    client_request_t inflight[MAX_INFLIGHT];
+
+    // In milliseconds, 0 when disabled.
+    uint64_t request_timeout;
+    uint64_t idle_timeout;
+    // Reconnects once the server has been silent for `idle_timeout`.
+    stratum_timer_t idle;
+
+    stratum_client_connect_cb_t connect_cb;
+    void *connect_arg;
+    stratum_client_notify_cb_t notify_cb;
+    void *notify_arg;
+    stratum_client_close_cb_t close_cb;
+    void *close_arg;
+};
+
+typedef void (*client_write_t)(stratum_writer_t *w, long id, const void *arg);
+
+struct addrinfo *stratum_client_resolve(const char *hostname,
+                                        const char *port) {
+    struct addrinfo hints, *res;
+    int ret;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((ret = getaddrinfo(hostname, port, &hints, &res)) != 0) {
+        CRITICAL_LOG("Failed to convert hostname to ip: %s",
+                     gai_strerror(ret));
+        return NULL;
+    }
+
+    return res;
+}
+
+/* start connecting to the first of `addrs` that takes it, without DNS */
+static int client_connect(const struct addrinfo *addrs) {
+    const struct addrinfo *p;
+    int sock = -1, one = 1;
+
+    for (p = addrs; p != NULL; p = p->ai_next) {
+        sock = socket(p->ai_family,
+                      p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      p->ai_protocol);
+
+        if (sock == -1)
+            continue;
+
+        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0 ||
+            errno == EINPROGRESS)
+            break;
+
+        CRITICAL_LOG("Failed to connect, retrying...");
+        close(sock);
+        sock = -1;
+    }
+
+    if (sock != -1)
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return sock;
+}
+
+static size_t client_pending(const stratum_client_t *client) {
+    size_t len = 0;
+
+    for (int i = 0; i < CLIENT_PRIORITIES; i++)
+        len += client->tx[i].len;
+
+    return len;
+}
+
+static uint32_t client_events(const stratum_client_t *client) {
+    if (!client->connected || client_pending(client) > 0)
+        return EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+
+    return EPOLLIN | EPOLLRDHUP;
+}
+
+static int client_update_events(stratum_client_t *client) {
+    uint32_t events = client_events(client);
+
+    if (events == client->events)
+        return 0;
+
+    client->events = events;
+
+    return stratum_loop_mod(client->loop, &client->handler, events);
+}
+
+static void client_reset_tx(stratum_client_t *client) {
+    for (int i = 0; i < CLIENT_PRIORITIES; i++)
+        stratum_buffer_consume(&client->tx[i], client->tx[i].len);
+
+    client->partial = 0;
+}
+
+/**
+ * Send what is queued in priority order with a single syscall, the line cut
+ * short by the previous send first. Returns the number of bytes sent.
+ **/
+static ssize_t client_send(stratum_client_t *client) {
+    struct iovec iov[CLIENT_PRIORITIES + 1];
+    int classes[CLIENT_PRIORITIES + 1];
+    struct msghdr msg = {.msg_iov = iov};
+    ssize_t ret;
+    size_t left;
+
+    if (client->partial > 0) {
+        iov[0].iov_base = client->tx[client->partial_class].data;
+        iov[0].iov_len = client->partial;
+        classes[msg.msg_iovlen++] = client->partial_class;
+    }
+
+    for (int i = 0; i < CLIENT_PRIORITIES; i++) {
+        size_t skip = i == client->partial_class ? client->partial : 0;
+
+        if (client->tx[i].len == skip)
+            continue;
+
+        iov[msg.msg_iovlen].iov_base = client->tx[i].data + skip;
+        iov[msg.msg_iovlen].iov_len = client->tx[i].len - skip;
+        classes[msg.msg_iovlen++] = i;
+    }
+
+    if ((ret = sendmsg(client->handler.fd, &msg, MSG_NOSIGNAL)) <= 0)
+        return ret;
+
+    left = ret;
+
+    // Earlier iovs are always sent whole before later ones get a byte.
+    for (size_t i = 0; i < msg.msg_iovlen && left > 0; i++) {
+        stratum_buffer_t *tx = &client->tx[classes[i]];
+        size_t size = left < iov[i].iov_len ? left : iov[i].iov_len;
+
+        // The bytes sent are at the front of `tx` by now: consuming the
+        // line cut short moved the rest of its buffer, `iov_base` with it.
+        stratum_capture_write(client->handler.fd, STRATUM_CAPTURE_TX,
+                              tx->data, size);
+        stratum_buffer_consume(tx, size);
+        left -= size;
+
+        if (i == 0 && client->partial > 0) {
+            client->partial -= size;
+        } else if (size < iov[i].iov_len) {
+            // Stopped in the middle of a line, which must be finished first.
+            char *end = memchr(tx->data, '\n', tx->len);
+
+            client->partial = end != NULL ? (size_t)(end - tx->data) + 1
+                                          : tx->len;
+            client->partial_class = classes[i];
+        }
+    }
+
+    return ret;
+}
+
+static int client_flush(stratum_client_t *client) {
+    size_t sent = 0;
+
+    if (!client->connected)
+        return 0;
+
+    // Level triggered EPOLLOUT brings us back for the rest once every other
+    // ready connection had its turn.
+    while (client_pending(client) > 0 && sent < FLUSH_QUANTUM) {
+        ssize_t ret = client_send(client);
+
+        if (ret == -1) {
+            if (errno == EAGAIN)
+                break;
+
+            return -1;
+        }
+
+        sent += ret;
+
+        if (client->session.timing != NULL)
+            stratum_timing_sent(client->session.timing, ret);
+    }
+
+    return client_update_events(client);
+}
+
+static void client_free_task(stratum_loop_t *loop, void *arg) {
+    stratum_client_t *client = arg;
+
+    (void)loop;
+
+    stratum_buffer_free(&client->rx);
+
+    for (int i = 0; i < CLIENT_PRIORITIES; i++)
+        stratum_buffer_free(&client->tx[i]);
+
+    if (client->addrs != NULL)
+        freeaddrinfo(client->addrs);
+
+    free(client->hostname);
+    free(client->port);
+    free(client);
+}
+
+/* fail every pending request with a NULL reply */
+static void client_fail_requests(stratum_client_t *client) {
+    for (int i = 0; i < MAX_INFLIGHT; i++) {
+        client_request_t *slot = &client->inflight[i];
+        client_request_t req = *slot;
+
+        if (req.id == 0)
+            continue;
+
+        slot->id = 0;
+        stratum_loop_timer_del(client->loop, &slot->timer);
+        req.cb(client, NULL, req.arg);
+    }
+}
+
+/* tear the connection down, new requests MUST be refused meanwhile */
+static void client_disconnect(stratum_client_t *client) {
+    stratum_loop_del(client->loop, &client->handler);
+    stratum_loop_timer_del(client->loop, &client->idle);
+    close(client->handler.fd);
+    stratum_session_free(&client->session);
+
+    DEBUG_LOG("Closed connection to %s:%s", client->hostname, client->port);
+
+    client_fail_requests(client);
+}
+
+/* open a new connection for `client`, as if it had just been created */
+static int client_open(stratum_client_t *client) {
+    stratum_session_t *session = &client->session;
+    stratum_ratectl_t *ratectl = session->ratectl;
+    stratum_timing_t *timing = session->timing;
+    uint8_t coalesce = session->coalesce;
+    stratum_dedup_t *dedup = session->dedup;
+    stratum_workers_t *workers = session->workers;
+    stratum_journal_t *journal = session->journal;
+    char session_id[sizeof(session->session_id)];
+
+    // Resuming the session needs its id, see `stratum_client_subscribe()`.
+    memcpy(session_id, session->session_id, sizeof(session_id));
+
+    if ((client->handler.fd = client_connect(client->addrs)) == -1)
+        return -1;
+
+    stratum_session_init(session, client->handler.fd);
+    memcpy(session->session_id, session_id, sizeof(session_id));
+    session->ratectl = ratectl;
+    session->coalesce = coalesce;
+    session->dedup = dedup;
+    session->workers = workers;
+
+    // The shares left unanswered by the previous connection wait for its
+    // first job.
+    if (journal != NULL)
+        stratum_session_enable_journal(session, journal);
+
+    if (timing != NULL &&
+        stratum_session_enable_timing(session, timing) == -1) {
+        CRITICAL_LOG("Failed to keep timing %s:%s", client->hostname,
+                     client->port);
+    }
+
+    client->connected = 0;
+    client->conn++;
+    client->events = client_events(client);
+
+    if (stratum_loop_add(client->loop, &client->handler, client->events) ==
+        -1) {
+        stratum_session_free(session);
+        close(client->handler.fd);
+        return -1;
+    }
+
+    // Covers connecting, until the server sends its first message.
+    if (client->idle_timeout != 0)
+        stratum_loop_timer_add(client->loop, &client->idle,
+                               client->idle_timeout);
+
+    return 0;
+}
+
+void stratum_client_close(stratum_client_t *client) {
+    if (client->closed)
+        return;
+
+    client->closed = 1;
+
+    // `stratum_client_reconnect()` notices it and finishes the job.
+    if (client->reconnecting)
+        return;
+
+    client_disconnect(client);
+
+    if (client->close_cb != NULL)
+        client->close_cb(client, client->close_arg);
+}
+
+void stratum_client_cancel(stratum_client_t *client, long id) {
+    client_request_t *slot = &client->inflight[id % MAX_INFLIGHT];
+
+    if (id <= 0 || slot->id != id)
+        return;
+
+    slot->id = 0;
+    stratum_loop_timer_del(client->loop, &slot->timer);
+}
+
+int stratum_client_reconnect(stratum_client_t *client) {
+    if (client->reconnecting)
+        return 0;
+
+    client->reconnecting = 1;
+
+    if (!client->closed)
+        client_disconnect(client);
+    else
+        client->closed = client->freed;
+
+    // What was queued for the old connection is meaningless to the new one.
+    stratum_buffer_consume(&client->rx, client->rx.len);
+    client_reset_tx(client);
+
+    // A failing request's callback may have closed the client meanwhile.
+    if (client->closed || client_open(client) == -1) {
+        CRITICAL_LOG("Failed to reconnect to %s:%s", client->hostname,
+                     client->port);
+
+        client->closed = 1;
+        client->reconnecting = 0;
+
+        if (!client->freed && client->close_cb != NULL)
+            client->close_cb(client, client->close_arg);
+
+        return -1;
+    }
+
+    client->reconnecting = 0;
+
+    DEBUG_LOG("Reconnecting to %s:%s", client->hostname, client->port);
+
+    return 0;
+}
+
+static void client_idle_cb(stratum_loop_t *loop, stratum_timer_t *timer) {
+    stratum_client_t *client = timer->ctx;
+
+    (void)loop;
+
+    CRITICAL_LOG("%s:%s has been silent for %llums, reconnecting",
+                 client->hostname, client->port,
+                 (unsigned long long)client->idle_timeout);
+
+    stratum_client_reconnect(client);
+}
+
+static void client_request_timeout_cb(stratum_loop_t *loop,
+                                      stratum_timer_t *timer) {
+    client_request_t *slot = timer->ctx;
+    client_request_t req = *slot;
+
+    (void)loop;
+
+    DEBUG_LOG("Request %ld timed out", req.id);
+
+    slot->id = 0;
+    req.cb(req.client, NULL, req.arg);
+}
+
+static long client_resubmit(const stratum_journal_share_t *share, void *arg);
+
+static void client_handle_response(stratum_client_t *client,
+                                   stratum_response_t *res, uint64_t parsed) {
+    stratum_timing_t *timing = client->session.timing;
+    int resubmit = client->session.resubmit;
+
+    if (timing != NULL) {
+        stratum_timing_record(timing, STRATUM_STAGE_WIRE_TO_PARSED,
+                              timing->rx_wire, parsed);
+
+        if (res->id != 0)
+            stratum_timing_ack(timing, res->id);
+    }
+
+    stratum_session_handle_response(&client->session, res);
+
+    // The first job tells whether the journaled shares are still valid, a
+    // clean one pruned them already.
+    if (resubmit && res->id == 0 &&
+        stratum_method_from_string(res->method) == STRATUM_METHOD_NOTIFY) {
+        client->session.resubmit = 0;
+        stratum_journal_resubmit(client->session.journal, client_resubmit,
+                                 client);
+    }
+
+    if (res->id == 0) {
+        if (client->notify_cb != NULL)
+            client->notify_cb(client, res, client->notify_arg);
+    } else if (res->id > 0) {
+        client_request_t *slot = &client->inflight[res->id % MAX_INFLIGHT];
+
+        if (slot->id == res->id) {
+            client_request_t req = *slot;
+
+            slot->id = 0;
+            stratum_loop_timer_del(client->loop, &slot->timer);
+            req.cb(client, res, req.arg);
+        } else {
+            DEBUG_LOG("Reply to unknown request id %ld", res->id);
+        }
+    } else {
+        DEBUG_LOG("Ignoring reply with invalid id %ld", res->id);
+    }
+
+    // The callback may have closed the client, and the session with it.
+    if (timing != NULL && !client->closed && client->session.timing == timing)
+        stratum_timing_record(timing, STRATUM_STAGE_PARSED_TO_DISPATCHED,
+                              parsed, stratum_timing_now());
+}
+
+/* handle the messages of `batch` then free them, see `stratum_coalesce()` */
+static void client_dispatch(stratum_client_t *client,
+                            stratum_response_t **batch, size_t n) {
+    uint64_t parsed =
+        client->session.timing != NULL ? stratum_timing_now() : 0;
+    uint32_t conn = client->conn;
+
+    if (client->session.coalesce)
+        n = stratum_coalesce(batch, n);
+
+    for (size_t i = 0; i < n; i++) {
+        if (!client->closed && client->conn == conn)
+            client_handle_response(client, batch[i], parsed);
+
+        stratum_response_free(batch[i]);
+    }
+}
+
+static void client_handle_lines(stratum_client_t *client) {
+    stratum_response_t *batch[MAX_BATCH];
+    uint32_t conn = client->conn;
+    size_t offset = 0, n = 0;
+    char *line;
+
+    while (!client->closed && client->conn == conn &&
+           (line = stratum_buffer_next_line(&client->rx, &offset))) {
+        if (!strlen(line))
+            continue;
+
+        stratum_response_t *res = stratum_parse_response(line);
+
+        if (res == NULL || res->id == -1) {
+            DEBUG_LOG("Ignoring unparsable message `%s`", line);
+            stratum_response_free(res);
+            continue;
+        }
+
+        batch[n++] = res;
+
+        // Without coalescing, every message is handled as soon as parsed.
+        if (!client->session.coalesce || n == MAX_BATCH) {
+            client_dispatch(client, batch, n);
+            n = 0;
+        }
+    }
+
+    client_dispatch(client, batch, n);
+
+    // A callback closed or reconnected the client, dropping what was left.
+    if (client->closed || client->conn != conn)
+        return;
+
+    stratum_buffer_consume(&client->rx, offset);
+
+    if (client->rx.len > MAX_LINE_SIZE)
+        stratum_client_close(client);
+}
+
+/* read and handle everything received, returns -1 once the peer is gone */
+static int client_read(stratum_client_t *client) {
+    stratum_timing_t *timing = client->session.timing;
+    uint32_t conn = client->conn;
+
+    while (!client->closed && client->conn == conn) {
+        if (stratum_buffer_reserve(&client->rx, READ_SIZE) == -1)
+            return -1;
+
+        // Lines are handled chunk by chunk to keep their receive timestamp.
+        ssize_t ret = socket_recv(
+            client->handler.fd, client->rx.data + client->rx.len,
+            client->rx.cap - client->rx.len,
+            timing != NULL ? &timing->rx_wire : NULL);
+
+        if (ret > 0) {
+            client->rx.len += ret;
+
+            if (client->idle_timeout != 0)
+                stratum_loop_timer_add(client->loop, &client->idle,
+                                       client->idle_timeout);
+
+            client_handle_lines(client);
+            continue;
+        }
+
+        if (ret == -1 && errno == EAGAIN)
+            return 0;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static void client_cb(stratum_loop_t *loop, stratum_loop_handler_t *handler,
+                      uint32_t events) {
+    stratum_client_t *client = handler->ctx;
+    int eof = 0;
+
+    (void)loop;
+
+    if (client->closed)
+        return;
+
+    if (!client->connected && (events & (EPOLLOUT | EPOLLERR))) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if (getsockopt(handler->fd, SOL_SOCKET, SO_ERROR, &error, &len) ==
+                -1 ||
+            error != 0) {
+            CRITICAL_LOG("Failed to connect to %s:%s", client->hostname,
+                         client->port);
+            stratum_client_close(client);
+            return;
+        }
+
+        DEBUG_LOG("Connected to the server - %s:%s", client->hostname,
+                  client->port);
+        // Anything queued before the connection was made goes out now.
+        client->connected = 1;
+
+        if (client->connect_cb != NULL) {
+            uint32_t conn = client->conn;
+
+            client->connect_cb(client, client->connect_arg);
+
+            if (client->closed || client->conn != conn)
+                return;
+        }
+    }
+
+    if ((events & EPOLLOUT) && client_flush(client) == -1) {
+        stratum_client_close(client);
+        return;
+    }
+
+    // Transmit timestamps are queued on the error queue, raising EPOLLERR.
+    if ((events & EPOLLERR) && client->session.timing != NULL)
+        stratum_timing_poll_tx(client->session.timing, handler->fd);
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+        eof = client_read(client) == -1;
+
+    if (eof)
+        stratum_client_close(client);
+}
+
+stratum_client_t *stratum_client_init(stratum_loop_t *loop,
+                                      const char *hostname, const char *port) {
+    struct addrinfo *addrs = stratum_client_resolve(hostname, port);
+
+    if (addrs == NULL)
+        return NULL;
+
+    return stratum_client_init_resolved(loop, hostname, port, addrs);
+}
+
+stratum_client_t *stratum_client_init_resolved(stratum_loop_t *loop,
+                                               const char *hostname,
+                                               const char *port,
+                                               struct addrinfo *addrs) {
+    stratum_client_t *client = calloc(1, sizeof(stratum_client_t));
+
+    if (client == NULL) {
+        freeaddrinfo(addrs);
+        return NULL;
+    }
+
+    client->loop = loop;
+    client->addrs = addrs;
+    client->hostname = strdup(hostname);
+    client->port = strdup(port);
+    client->next_id = 1;
+    client->request_timeout = DEFAULT_REQUEST_TIMEOUT;
+    stratum_buffer_init(&client->rx);
+
+    for (int i = 0; i < CLIENT_PRIORITIES; i++)
+        stratum_buffer_init(&client->tx[i]);
+
+    client->handler.cb = client_cb;
+    client->handler.ctx = client;
+    stratum_timer_init(&client->idle, client_idle_cb, client);
+
+    for (int i = 0; i < MAX_INFLIGHT; i++) {
+        client->inflight[i].client = client;
+        stratum_timer_init(&client->inflight[i].timer,
+                           client_request_timeout_cb, &client->inflight[i]);
+    }
+
+    if (client->hostname == NULL || client->port == NULL ||
+        client_open(client) == -1) {
+        client_free_task(loop, client);
+        return NULL;
+    }
+
+    return client;
+}
+
+void stratum_client_free(stratum_client_t *client) {
+    client->freed = 1;
+    stratum_client_close(client);
+
+    if (stratum_loop_post(client->loop, client_free_task, client) == -1) {
+        CRITICAL_LOG("Leaking client %s:%s", client->hostname, client->port);
+    }
+}
+
+void stratum_client_set_timeouts(stratum_client_t *client,
+                                 uint64_t request_ms, uint64_t idle_ms) {
+    client->request_timeout = request_ms;
+    client->idle_timeout = idle_ms;
+
+    if (client->closed)
+        return;
+
+    if (idle_ms != 0)
+        stratum_loop_timer_add(client->loop, &client->idle, idle_ms);
+    else
+        stratum_loop_timer_del(client->loop, &client->idle);
+}
+
+void stratum_client_on_connect(stratum_client_t *client,
+                               stratum_client_connect_cb_t cb, void *arg) {
+    client->connect_cb = cb;
+    client->connect_arg = arg;
+}
+
+void stratum_client_on_notify(stratum_client_t *client,
+                              stratum_client_notify_cb_t cb, void *arg) {
+    client->notify_cb = cb;
+    client->notify_arg = arg;
+}
+
+void stratum_client_on_close(stratum_client_t *client,
+                             stratum_client_close_cb_t cb, void *arg) {
+    client->close_cb = cb;
+    client->close_arg = arg;
+}
+
+int stratum_client_enable_timing(stratum_client_t *client,
+                                 stratum_timing_t *timing) {
+    return stratum_session_enable_timing(&client->session, timing);
+}
+
+stratum_session_t *stratum_client_session(stratum_client_t *client) {
+    return &client->session;
+}
+
+stratum_loop_t *stratum_client_loop(stratum_client_t *client) {
+    return client->loop;
+}
+
+int stratum_client_closed(const stratum_client_t *client) {
+    return client->closed;
+}
+
+static long client_request(stratum_client_t *client, client_write_t write,
+                           const void *args, stratum_client_reply_cb_t cb,
+                           void *arg, client_priority_t priority) {
+    stratum_timing_t *timing = client->session.timing;
+    uint64_t start = timing != NULL ? stratum_timing_now() : 0;
+    long id = client->next_id;
+    client_request_t *slot = &client->inflight[id % MAX_INFLIGHT];
+    stratum_buffer_t *tx = &client->tx[priority];
+    size_t pending = client_pending(client);
+    stratum_writer_t w;
+
+    if (client->closed || client->reconnecting)
+        return -1;
+
+    // Skip the ids whose slot still waits for the reply to an older request,
+    // instead of failing every request until it comes back.
+    for (int i = 0; cb != NULL && slot->id != 0; i++) {
+        if (i == MAX_INFLIGHT - 1)
+            return -1;
+
+        id = id == LONG_MAX ? 1 : id + 1;
+        slot = &client->inflight[id % MAX_INFLIGHT];
+    }
+
+    // Serialize straight into the output buffer, growing it if needed.
+    for (;;) {
+        stratum_writer_init(&w, tx->data + tx->len, tx->cap - tx->len, 0);
+        write(&w, id, args);
+
+        if (!w.overflow)
+            break;
+
+        if (stratum_buffer_reserve(tx, w.len + 1) == -1)
+            return -1;
+    }
+
+    // Ids wrap around before they could be confused with null (0).
+    client->next_id = id == LONG_MAX ? 1 : id + 1;
+    tx->len += w.len;
+
+    if (cb != NULL) {
+        slot->id = id;
+        slot->cb = cb;
+        slot->arg = arg;
+
+        if (client->request_timeout != 0)
+            stratum_loop_timer_add(client->loop, &slot->timer,
+                                   client->request_timeout);
+    }
+
+    // Submits only wait for the line being sent, and the submits before them.
+    if (timing != NULL && priority == CLIENT_PRIORITY_SUBMIT) {
+        size_t ahead = client->partial_class != CLIENT_PRIORITY_SUBMIT
+                           ? client->partial
+                           : 0;
+
+        stratum_timing_submit(timing, id, timing->tx_bytes + ahead + tx->len,
+                              start);
+    }
+
+    if (pending == 0 && client_flush(client) == -1) {
+        stratum_client_close(client);
+        return -1;
+    }
+
+    return id;
+}
+
+typedef struct {
+    const char *strings[5];
+} client_args_t;
+
+static void write_subscribe(stratum_writer_t *w, long id, const void *arg) {
+    const client_args_t *args = arg;
+
+    stratum_write_subscribe(w, id, args->strings[0], args->strings[1],
+                            args->strings[2], args->strings[3]);
+}
+
+static void write_authorize(stratum_writer_t *w, long id, const void *arg) {
+    const client_args_t *args = arg;
+
+    stratum_write_authorize(w, id, args->strings[0], args->strings[1]);
+}
+
+static void write_submit(stratum_writer_t *w, long id, const void *arg) {
+    const client_args_t *args = arg;
+
+    stratum_write_submit(w, id, args->strings[0], args->strings[1],
+                         args->strings[2], args->strings[3], args->strings[4]);
+}
+
+static void write_suggest_target(stratum_writer_t *w, long id,
+                                 const void *arg) {
+    const client_args_t *args = arg;
+
+    stratum_write_suggest_target(w, id, args->strings[0]);
+}
+
+/* route the reply to the request `id` to `worker`, if workers are tracked */
+static void client_track(stratum_client_t *client, long id,
+                         const char *worker, stratum_worker_request_t type) {
+    stratum_workers_t *workers = client->session.workers;
+
+    if (id != -1 && workers != NULL &&
+        stratum_workers_track(workers, id, worker, type) == -1) {
+        CRITICAL_LOG("Failed to track the worker `%s`", worker);
+    }
+}
+
+/* submit a share of the journal again, it was already filtered and recorded */
+static long client_resubmit(const stratum_journal_share_t *share, void *arg) {
+    stratum_client_t *client = arg;
+    client_args_t args = {{share->worker, share->job_id, share->time,
+                           share->nonce_2, share->solution}};
+    long id = client_request(client, write_submit, &args, NULL, NULL,
+                             CLIENT_PRIORITY_SUBMIT);
+
+    client_track(client, id, share->worker, STRATUM_WORKER_SUBMIT);
+
+    return id;
+}
+
+long stratum_client_subscribe(stratum_client_t *client,
+                              const char *user_agent, const char *session_id,
+                              stratum_client_reply_cb_t cb, void *arg) {
+    client_args_t args = {
+        {user_agent, session_id, client->hostname, client->port, NULL}};
+    long id = client_request(client, write_subscribe, &args, cb, arg,
+                             CLIENT_PRIORITY_SESSION);
+
+    if (id != -1)
+        client->session.subscribe_id = id;
+
+    return id;
+}
+
+long stratum_client_authorize(stratum_client_t *client, const char *username,
+                              const char *password,
+                              stratum_client_reply_cb_t cb, void *arg) {
+    client_args_t args = {{username, password, NULL, NULL, NULL}};
+    long id = client_request(client, write_authorize, &args, cb, arg,
+                             CLIENT_PRIORITY_SESSION);
+
+    client_track(client, id, username, STRATUM_WORKER_AUTHORIZE);
+
+    return id;
+}
+
+long stratum_client_submit(stratum_client_t *client, const char *worker,
+                           const char *job_id, const char *time,
+                           const char *nonce_2, const char *solution,
+                           stratum_client_reply_cb_t cb, void *arg) {
+    client_args_t args = {{worker, job_id, time, nonce_2, solution}};
+    stratum_dedup_t *dedup = client->session.dedup;
+    stratum_journal_t *journal = client->session.journal;
+    char hex[65];
+    long id;
+
+    if (dedup != NULL &&
+        !stratum_dedup_check(dedup, job_id, time, nonce_2, solution)) {
+        DEBUG_LOG("Dropping duplicate share for job %s", job_id);
+        return -2;
+    }
+
+    id = client_request(client, write_submit, &args, cb, arg,
+                        CLIENT_PRIORITY_SUBMIT);
+    client_track(client, id, worker, STRATUM_WORKER_SUBMIT);
+
+    // Not sent, so retrying it must not find it a duplicate.
+    if (id == -1 && dedup != NULL)
+        stratum_dedup_forget(dedup, job_id, time, nonce_2, solution);
+
+    if (id != -1 && journal != NULL &&
+        stratum_journal_append(journal, id, client->session.session_id,
+                               client->session.nonce_1, worker, job_id, time,
+                               nonce_2, solution) == -1) {
+        CRITICAL_LOG("The journal is full, share for job %s not recorded",
+                     job_id);
+    }
+
+    // Queued behind the share, see `stratum_session_enable_ratectl()`.
+    if (id != -1 && stratum_session_rate_share(&client->session, hex))
+        stratum_client_suggest_target(client, hex, NULL, NULL);
+
+    return id;
+}
+
+long stratum_client_suggest_target(stratum_client_t *client,
+                                   const char *target,
+                                   stratum_client_reply_cb_t cb, void *arg) {
+    client_args_t args = {{target, NULL, NULL, NULL, NULL}};
+
+    return client_request(client, write_suggest_target, &args, cb, arg,
+                          CLIENT_PRIORITY_BACKGROUND);
+}
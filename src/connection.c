@@ -4,15 +4,23 @@
 //          https://www.boost.org/LICENSE_1_0.txt)
 
 #include <err.h>
+#include <errno.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+// After the libc headers, which define `struct timespec`.
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
 #include "libstratum/connection.h"
 
+#include "libstratum/capture.h"
+
 #ifdef ENABLE_DEBUG_LOGGING
 #define DEBUG_LOG(...)                                                         \
     {                                                                          \
@@ -31,6 +39,11 @@
 
 #define RETRY_COUNT 3
 
+#define TIMESTAMPING_FLAGS                                                     \
+    (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |             \
+     SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE |               \
+     SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY)
+
 int socket_init(const char *hostname, const char *port) {
     struct addrinfo hints, *res, *p;
     int ret, sock = -1;
@@ -42,9 +55,11 @@ int socket_init(const char *hostname, const char *port) {
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
 
-    if ((ret = getaddrinfo(hostname, port, &hints, &res)) != 0)
-        err(EXIT_FAILURE, "Failed to convert hostname to ip: %s",
-            gai_strerror(ret));
+    if ((ret = getaddrinfo(hostname, port, &hints, &res)) != 0) {
+        CRITICAL_LOG("Failed to convert hostname to ip: %s",
+                     gai_strerror(ret));
+        return -1;
+    }
 
     p = res;
 
@@ -61,8 +76,10 @@ int socket_init(const char *hostname, const char *port) {
             ptr = &((struct sockaddr_in6 *)p->ai_addr)->sin6_addr;
             break;
         default:
-            err(EXIT_FAILURE, "sanity check? got %d as `p->ai_family`",
-                p->ai_family);
+            CRITICAL_LOG("sanity check? got %d as `p->ai_family`",
+                         p->ai_family);
+            p = p->ai_next;
+            continue;
         }
 
         inet_ntop(p->ai_family, ptr, ipstr, sizeof(ipstr));
@@ -74,6 +91,8 @@ int socket_init(const char *hostname, const char *port) {
             CRITICAL_LOG("Failed to initialize the socket, retrying...");
         } else if (connect(sock, p->ai_addr, p->ai_addrlen) == -1) {
             CRITICAL_LOG("Failed to connect, retrying...");
+            close(sock);
+            sock = -1;
         } else {
             DEBUG_LOG("Connected to the server - %s / %s:%s", hostname, ipstr,
                       port);
@@ -88,34 +107,153 @@ int socket_init(const char *hostname, const char *port) {
     return sock;
 }
 
-void socket_send(int socket, const char *data) {
+int socket_send(int socket, const char *data) {
+    return socket_write(socket, data, strlen(data));
+}
+
+int socket_write(int socket, const void *data, size_t size) {
+    const char *left = data;
     int retries = 0;
-    ssize_t ret = -1;
 
-    do {
+    // A short send leaves the rest of the line to be sent, not dropped.
+    while (size > 0) {
+        ssize_t ret;
+
         if (retries == RETRY_COUNT) {
-            err(EXIT_FAILURE, "Aborting after %d retries.", RETRY_COUNT);
+            CRITICAL_LOG("Aborting after %d retries.", RETRY_COUNT);
+            return -1;
         } else if (retries > 0) {
-            DEBUG_LOG("Retry count: %d, resending data: %s", retries, data);
+            DEBUG_LOG("Retry count: %d, resending %zu bytes", retries, size);
             perror("socket_send");
         }
 
-        ret = send(socket, data, strlen(data), 0);
+        ret = send(socket, left, size, 0);
         DEBUG_LOG("Sending data to the socket fd(%d)", socket);
 
-        if (ret == -1)
+        if (ret == -1) {
+            // Interrupted, or the send timeout expired, see
+            // `socket_set_timeout()`.
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                CRITICAL_LOG("Send failure for fd(%d)", socket);
+                return -1;
+            }
+
             retries++;
+            continue;
+        }
+
+        stratum_capture_write(socket, STRATUM_CAPTURE_TX, left, ret);
+        left += ret;
+        size -= ret;
+        retries = 0;
+    }
 
-    } while (ret == -1);
+    return 0;
 }
 
-void socket_read(int socket, void *buffer, size_t bufsize) {
-    ssize_t ret = read(socket, buffer, bufsize);
+ssize_t socket_read(int socket, void *buffer, size_t bufsize) {
+    ssize_t ret = socket_recv(socket, buffer, bufsize, NULL);
 
-    if (ret == -1)
-        err(EXIT_FAILURE, "Read failure for fd(%d) with bufsize (%ld)", socket,
-            bufsize);
-    else if (ret < (ssize_t)bufsize) {
+    if (ret == -1) {
+        CRITICAL_LOG("Read failure for fd(%d) with bufsize (%ld)", socket,
+                     bufsize);
+    } else if (ret < (ssize_t)bufsize) {
         DEBUG_LOG("Read %ld bytes with a %ld buffer size", ret, bufsize);
     }
+
+    return ret;
+}
+
+int socket_set_timeout(int socket, uint64_t ms) {
+    struct timeval tv = {.tv_sec = ms / 1000, .tv_usec = ms % 1000 * 1000};
+
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+        return -1;
+
+    return setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int socket_enable_timestamping(int socket) {
+    int flags = TIMESTAMPING_FLAGS;
+
+    return setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+                      sizeof(flags));
+}
+
+/* the hardware timestamp if the NIC made one, the software one otherwise */
+static uint64_t socket_timestamp(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        struct scm_timestamping ts;
+
+        if (cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_TIMESTAMPING)
+            continue;
+
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+        if (ts.ts[2].tv_sec != 0 || ts.ts[2].tv_nsec != 0)
+            ts.ts[0] = ts.ts[2];
+
+        return (uint64_t)ts.ts[0].tv_sec * 1000000000 + ts.ts[0].tv_nsec;
+    }
+
+    return 0;
+}
+
+ssize_t socket_recv(int socket, void *buffer, size_t bufsize,
+                    uint64_t *rx_ns) {
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct iovec iov = {.iov_base = buffer, .iov_len = bufsize};
+    struct msghdr msg = {.msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = control,
+                         .msg_controllen = sizeof(control)};
+    ssize_t ret;
+
+    if (rx_ns == NULL) {
+        ret = read(socket, buffer, bufsize);
+    } else {
+        ret = recvmsg(socket, &msg, 0);
+        *rx_ns = ret > 0 ? socket_timestamp(&msg) : 0;
+    }
+
+    if (ret > 0)
+        stratum_capture_write(socket, STRATUM_CAPTURE_RX, buffer, ret);
+
+    return ret;
+}
+
+int socket_tx_timestamp(int socket, uint32_t *key, uint64_t *ns) {
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                 CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in6))];
+
+    for (;;) {
+        struct msghdr msg = {.msg_control = control,
+                             .msg_controllen = sizeof(control)};
+        struct sock_extended_err *serr = NULL;
+
+        if (recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            return 0;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_IP &&
+                 cmsg->cmsg_type == IP_RECVERR) ||
+                (cmsg->cmsg_level == SOL_IPV6 &&
+                 cmsg->cmsg_type == IPV6_RECVERR))
+                serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        }
+
+        // Skip anything but the "sent to the wire" timestamps.
+        if (serr == NULL || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+            serr->ee_info != SCM_TSTAMP_SND)
+            continue;
+
+        *key = serr->ee_data;
+        *ns = socket_timestamp(&msg);
+
+        return 1;
+    }
 }
@@ -0,0 +1,196 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libstratum/dedup.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+// A forgotten share, kept so the shares probed past it are still found.
+#define TOMBSTONE UINT64_MAX
+
+/* FNV-1a of `str` and its terminator, so fields cannot run into each other */
+static uint64_t dedup_hash(uint64_t h, const char *str) {
+    do {
+        h ^= (uint8_t)*str;
+        h *= FNV_PRIME;
+    } while (*str++ != '\0');
+
+    return h;
+}
+
+/**
+ * Spread the bits of `h` (splitmix64's finalizer), never returning 0 or
+ * TOMBSTONE.
+ **/
+static uint64_t dedup_mix(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return h != 0 && h != TOMBSTONE ? h : 1;
+}
+
+/* the fingerprint of a share of the job hashed as `job` */
+static uint64_t dedup_key(uint64_t job, const char *time, const char *nonce_2,
+                          const char *solution) {
+    // The job is part of the key, so leftovers of a previous job in the same
+    // slot never match.
+    uint64_t key = dedup_hash(job, time);
+
+    key = dedup_hash(key, nonce_2);
+
+    return dedup_mix(dedup_hash(key, solution));
+}
+
+int stratum_dedup_init(stratum_dedup_t *dedup, size_t shares) {
+    size_t capacity = 16;
+    uint64_t *keys;
+
+    while (capacity < 2 * shares)
+        capacity *= 2;
+
+    if ((keys = calloc(STRATUM_DEDUP_JOBS * capacity, sizeof(uint64_t))) ==
+        NULL)
+        return -1;
+
+    memset(dedup, 0, sizeof(stratum_dedup_t));
+    dedup->capacity = capacity;
+
+    for (int i = 0; i < STRATUM_DEDUP_JOBS; i++)
+        dedup->jobs[i].keys = keys + i * capacity;
+
+    return 0;
+}
+
+void stratum_dedup_free(stratum_dedup_t *dedup) {
+    free(dedup->jobs[0].keys);
+    memset(dedup, 0, sizeof(stratum_dedup_t));
+}
+
+static void dedup_empty(stratum_dedup_t *dedup, stratum_dedup_job_t *slot) {
+    for (size_t i = 0; i < dedup->capacity; i++)
+        __atomic_store_n(&slot->keys[i], 0, __ATOMIC_RELAXED);
+}
+
+/* the slot of the job hashed as `job`, taking one over if it has none */
+static stratum_dedup_job_t *dedup_slot(stratum_dedup_t *dedup, uint64_t job) {
+    stratum_dedup_job_t *victim = &dedup->jobs[job % STRATUM_DEDUP_JOBS];
+    uint64_t expected;
+
+    for (int i = 0; i < STRATUM_DEDUP_JOBS; i++)
+        if (__atomic_load_n(&dedup->jobs[i].job, __ATOMIC_ACQUIRE) == job)
+            return &dedup->jobs[i];
+
+    // Threads racing for a new job all try the same first free slot.
+    for (int i = 0; i < STRATUM_DEDUP_JOBS; i++) {
+        expected = 0;
+
+        if (__atomic_compare_exchange_n(&dedup->jobs[i].job, &expected, job,
+                                        0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE) ||
+            expected == job)
+            return &dedup->jobs[i];
+    }
+
+    // Every slot is taken, the job picks its victim so racing threads agree.
+    expected = __atomic_load_n(&victim->job, __ATOMIC_ACQUIRE);
+
+    if (expected != job &&
+        __atomic_compare_exchange_n(&victim->job, &expected, job, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        dedup_empty(dedup, victim);
+
+    return victim;
+}
+
+int stratum_dedup_check(stratum_dedup_t *dedup, const char *job_id,
+                        const char *time, const char *nonce_2,
+                        const char *solution) {
+    uint64_t job = dedup_mix(dedup_hash(FNV_OFFSET, job_id));
+    stratum_dedup_job_t *slot = dedup_slot(dedup, job);
+    uint64_t key = dedup_key(job, time, nonce_2, solution);
+    size_t mask = dedup->capacity - 1;
+
+    for (size_t i = 0, b = key & mask; i < dedup->capacity;
+         i++, b = (b + 1) & mask) {
+        uint64_t seen = __atomic_load_n(&slot->keys[b], __ATOMIC_ACQUIRE);
+
+        if (seen == 0 &&
+            __atomic_compare_exchange_n(&slot->keys[b], &seen, key, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return 1;
+
+        if (seen == key)
+            return 0;
+    }
+
+    // Full, let the pool sort it out.
+    return 1;
+}
+
+void stratum_dedup_forget(stratum_dedup_t *dedup, const char *job_id,
+                          const char *time, const char *nonce_2,
+                          const char *solution) {
+    uint64_t job = dedup_mix(dedup_hash(FNV_OFFSET, job_id));
+    uint64_t key = dedup_key(job, time, nonce_2, solution);
+    size_t mask = dedup->capacity - 1;
+
+    for (int i = 0; i < STRATUM_DEDUP_JOBS; i++) {
+        stratum_dedup_job_t *slot = &dedup->jobs[i];
+
+        if (__atomic_load_n(&slot->job, __ATOMIC_ACQUIRE) != job)
+            continue;
+
+        for (size_t j = 0, b = key & mask; j < dedup->capacity;
+             j++, b = (b + 1) & mask) {
+            uint64_t seen = __atomic_load_n(&slot->keys[b], __ATOMIC_ACQUIRE);
+
+            if (seen == 0)
+                break;
+
+            // Tombstones are never reused, so checks racing this one still
+            // agree on where the share is.
+            if (seen == key &&
+                __atomic_compare_exchange_n(&slot->keys[b], &seen, TOMBSTONE,
+                                            0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE))
+                break;
+        }
+    }
+}
+
+void stratum_dedup_retire(stratum_dedup_t *dedup, const char *job_id) {
+    uint64_t job = dedup_mix(dedup_hash(FNV_OFFSET, job_id));
+
+    for (int i = 0; i < STRATUM_DEDUP_JOBS; i++) {
+        stratum_dedup_job_t *slot = &dedup->jobs[i];
+        uint64_t expected = job;
+
+        if (__atomic_load_n(&slot->job, __ATOMIC_ACQUIRE) != job)
+            continue;
+
+        // Emptied before being released, so the next job starts clean.
+        dedup_empty(dedup, slot);
+        __atomic_compare_exchange_n(&slot->job, &expected, 0, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+}
+
+void stratum_dedup_clear(stratum_dedup_t *dedup) {
+    for (int i = 0; i < STRATUM_DEDUP_JOBS; i++) {
+        stratum_dedup_job_t *slot = &dedup->jobs[i];
+        uint64_t job = __atomic_load_n(&slot->job, __ATOMIC_ACQUIRE);
+
+        if (job == 0)
+            continue;
+
+        dedup_empty(dedup, slot);
+        __atomic_compare_exchange_n(&slot->job, &job, 0, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE);
+    }
+}
@@ -0,0 +1,48 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#include "libstratum/hex.h"
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+int stratum_hex_decode(const char *hex, uint8_t *out, size_t size) {
+    size_t len = strlen(hex);
+
+    if (len % 2 != 0 || len / 2 > size)
+        return -1;
+
+    for (size_t i = 0; i < len / 2; i++) {
+        int hi = hex_value(hex[2 * i]), lo = hex_value(hex[2 * i + 1]);
+
+        if (hi == -1 || lo == -1)
+            return -1;
+
+        out[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    return (int)(len / 2);
+}
+
+void stratum_hex_encode(const uint8_t *data, size_t size, char *out) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < size; i++) {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 0xf];
+    }
+
+    out[2 * size] = '\0';
+}
@@ -0,0 +1,63 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#include "libstratum/job.h"
+
+#include "libstratum/hex.h"
+
+static int job_field(uint8_t *out, size_t size, const char *hex) {
+    return hex != NULL && strlen(hex) == 2 * size &&
+                   stratum_hex_decode(hex, out, size) == (int)size
+               ? 0
+               : -1;
+}
+
+int stratum_job_from_notify(stratum_job_t *job, const stratum_response_t *res,
+                            const stratum_session_t *session) {
+    // The header fields as sent in the params, with their size.
+    static const struct {
+        int param;
+        size_t offset;
+        size_t size;
+    } fields[] = {
+        {1, 0, 4},                   // VERSION
+        {2, 4, 32},                  // PREVHASH
+        {3, 36, 32},                 // MERKLEROOT
+        {4, 68, 32},                 // RESERVED
+        {5, STRATUM_HEADER_TIME, 4}, // TIME
+        {6, 104, 4},                 // BITS
+    };
+    int nonce_1_size;
+
+    if (stratum_method_from_string(res->method) != STRATUM_METHOD_NOTIFY ||
+        res->params[0] == NULL || res->params[7] == NULL ||
+        strlen(res->params[0]) > STRATUM_JOB_ID_SIZE)
+        return -1;
+
+    memset(job, 0, sizeof(stratum_job_t));
+    strcpy(job->job_id, res->params[0]);
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (job_field(job->header + fields[i].offset, fields[i].size,
+                      res->params[fields[i].param]) == -1)
+            return -1;
+    }
+
+    nonce_1_size = stratum_hex_decode(session->nonce_1,
+                                      job->header + STRATUM_HEADER_NONCE,
+                                      STRATUM_NONCE_SIZE);
+
+    if (nonce_1_size == -1)
+        return -1;
+
+    job->nonce_1_size = nonce_1_size;
+    job->clean = strcmp(res->params[7], "true") == 0;
+    job->has_target = session->has_target;
+    job->target = session->target;
+
+    return 0;
+}
@@ -0,0 +1,359 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libstratum/journal.h"
+
+#define MAGIC_SIZE (sizeof(STRATUM_JOURNAL_MAGIC) - 1)
+// MAGIC || TAIL
+#define HEADER_SIZE (MAGIC_SIZE + sizeof(uint64_t))
+#define RECORD_SIZE sizeof(stratum_journal_record_t)
+#define FIELDS 7
+
+struct stratum_journal {
+    uint8_t *data;
+    size_t size;
+    size_t pending;
+    // Compacted into "PATH.tmp", then renamed over it.
+    char *path;
+};
+
+static uint64_t *journal_tail(const stratum_journal_t *journal) {
+    return (uint64_t *)(journal->data + MAGIC_SIZE);
+}
+
+static stratum_journal_record_t *journal_record(stratum_journal_t *journal,
+                                                size_t offset) {
+    return (stratum_journal_record_t *)(journal->data + offset);
+}
+
+/* 1 if a valid record starts at `offset`, before `tail` */
+static int journal_valid(stratum_journal_t *journal, size_t offset,
+                         size_t tail) {
+    stratum_journal_record_t *record = journal_record(journal, offset);
+
+    return tail - offset >= RECORD_SIZE && record->size >= RECORD_SIZE &&
+           record->size % 8 == 0 && record->size <= tail - offset;
+}
+
+stratum_journal_t *stratum_journal_open(const char *path, size_t size) {
+    stratum_journal_t *journal = calloc(1, sizeof(stratum_journal_t));
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    size_t tail, offset;
+    struct stat st;
+    void *data;
+
+    if (journal == NULL || fd == -1 || fstat(fd, &st) == -1 ||
+        (st.st_size == 0 && ftruncate(fd, size) == -1) ||
+        (journal->path = strdup(path)) == NULL) {
+        if (fd != -1)
+            close(fd);
+
+        if (journal != NULL)
+            free(journal->path);
+
+        free(journal);
+        return NULL;
+    }
+
+    if (st.st_size != 0)
+        size = st.st_size;
+
+    data = size >= HEADER_SIZE ? mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fd, 0)
+                               : MAP_FAILED;
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        free(journal->path);
+        free(journal);
+        return NULL;
+    }
+
+    journal->data = data;
+    journal->size = size;
+
+    if (st.st_size == 0) {
+        memcpy(journal->data, STRATUM_JOURNAL_MAGIC, MAGIC_SIZE);
+        *journal_tail(journal) = HEADER_SIZE;
+    } else if (memcmp(journal->data, STRATUM_JOURNAL_MAGIC, MAGIC_SIZE) != 0 ||
+               *journal_tail(journal) < HEADER_SIZE ||
+               *journal_tail(journal) > size) {
+        stratum_journal_close(journal);
+        return NULL;
+    }
+
+    // A record is only counted once the tail moved past it, so a crash
+    // while appending leaves no torn record behind.
+    tail = *journal_tail(journal);
+
+    for (offset = HEADER_SIZE; offset < tail;
+         offset += journal_record(journal, offset)->size) {
+        if (!journal_valid(journal, offset, tail)) {
+            stratum_journal_close(journal);
+            return NULL;
+        }
+
+        if (journal_record(journal, offset)->state == STRATUM_JOURNAL_PENDING)
+            journal->pending++;
+    }
+
+    return journal;
+}
+
+void stratum_journal_close(stratum_journal_t *journal) {
+    munmap(journal->data, journal->size);
+    free(journal->path);
+    free(journal);
+}
+
+/* flush the directory holding `path`, so a rename into it is durable */
+static int journal_sync_dir(const char *path) {
+    char *copy = strdup(path);
+    int fd = -1, ret = -1;
+
+    if (copy != NULL)
+        fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd != -1) {
+        ret = fsync(fd);
+        close(fd);
+    }
+
+    free(copy);
+
+    return ret;
+}
+
+/**
+ * Copy the pending records to the start of a new journal, then rename it
+ * over the current one once on disk, so a crash or a power loss leaves
+ * either of them whole.
+ * Returns -1 if it could not be written, the journal is left as is then.
+ **/
+static int journal_compact(stratum_journal_t *journal) {
+    size_t tail = *journal_tail(journal), to = HEADER_SIZE;
+    size_t length = strlen(journal->path) + sizeof(".tmp");
+    char *tmp = malloc(length);
+    uint8_t *data = MAP_FAILED;
+    int fd = -1;
+
+    if (tmp != NULL) {
+        snprintf(tmp, length, "%s.tmp", journal->path);
+        fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+
+    if (fd != -1 && ftruncate(fd, journal->size) == 0)
+        data = mmap(NULL, journal->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+
+    if (data == MAP_FAILED) {
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+
+        free(tmp);
+        return -1;
+    }
+
+    memcpy(data, STRATUM_JOURNAL_MAGIC, MAGIC_SIZE);
+
+    for (size_t offset = HEADER_SIZE; offset < tail;) {
+        stratum_journal_record_t *record = journal_record(journal, offset);
+        size_t size = record->size;
+
+        if (record->state == STRATUM_JOURNAL_PENDING) {
+            memcpy(data + to, record, size);
+            to += size;
+        }
+
+        offset += size;
+    }
+
+    memcpy(data + MAGIC_SIZE, &to, sizeof(uint64_t));
+
+    // Renamed before being written out, a power loss could leave the
+    // journal empty.
+    if (msync(data, journal->size, MS_SYNC) == -1 || fsync(fd) == -1 ||
+        rename(tmp, journal->path) == -1) {
+        munmap(data, journal->size);
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    close(fd);
+
+    // The journal already is the new file, only a power loss could bring
+    // the old one back, which is still whole.
+    journal_sync_dir(journal->path);
+
+    munmap(journal->data, journal->size);
+    journal->data = data;
+    free(tmp);
+
+    return 0;
+}
+
+int stratum_journal_append(stratum_journal_t *journal, long id,
+                           const char *session_id, const char *nonce_1,
+                           const char *worker, const char *job_id,
+                           const char *time, const char *nonce_2,
+                           const char *solution) {
+    const char *fields[FIELDS] = {session_id, nonce_1, worker, job_id,
+                                  time, nonce_2, solution};
+    size_t lengths[FIELDS], size = RECORD_SIZE, tail;
+    stratum_journal_record_t *record;
+    uint8_t *p;
+
+    for (int i = 0; i < FIELDS; i++)
+        size += (lengths[i] = strlen(fields[i]) + 1);
+
+    size = (size + 7) & ~(size_t)7;
+
+    if (journal->size - *journal_tail(journal) < size &&
+        journal_compact(journal) == -1)
+        return -1;
+
+    tail = *journal_tail(journal);
+
+    if (journal->size - tail < size)
+        return -1;
+
+    record = journal_record(journal, tail);
+    record->size = size;
+    record->state = STRATUM_JOURNAL_PENDING;
+    memset(record->reserved, 0, sizeof(record->reserved));
+    record->id = id;
+    p = (uint8_t *)(record + 1);
+
+    for (int i = 0; i < FIELDS; i++) {
+        memcpy(p, fields[i], lengths[i]);
+        p += lengths[i];
+    }
+
+    memset(p, 0, journal->data + tail + size - p);
+
+    // Published once whole.
+    __atomic_store_n(journal_tail(journal), tail + size, __ATOMIC_RELEASE);
+    journal->pending++;
+
+    return 0;
+}
+
+/* mark `record` done, and forget every record once none is pending */
+static void journal_done(stratum_journal_t *journal,
+                         stratum_journal_record_t *record) {
+    record->state = STRATUM_JOURNAL_DONE;
+
+    if (--journal->pending == 0)
+        __atomic_store_n(journal_tail(journal), HEADER_SIZE, __ATOMIC_RELEASE);
+}
+
+void stratum_journal_ack(stratum_journal_t *journal, long id) {
+    size_t tail = *journal_tail(journal);
+
+    for (size_t offset = HEADER_SIZE; offset < tail;) {
+        stratum_journal_record_t *record = journal_record(journal, offset);
+
+        if (record->state == STRATUM_JOURNAL_PENDING && record->id == id) {
+            journal_done(journal, record);
+            return;
+        }
+
+        offset += record->size;
+    }
+}
+
+void stratum_journal_prune(stratum_journal_t *journal) {
+    journal->pending = 0;
+    __atomic_store_n(journal_tail(journal), HEADER_SIZE, __ATOMIC_RELEASE);
+}
+
+/* the fields of `record` as a share */
+static void journal_share(stratum_journal_record_t *record,
+                          stratum_journal_share_t *share) {
+    const char *fields[FIELDS];
+    const char *p = (const char *)(record + 1);
+
+    for (int i = 0; i < FIELDS; i++) {
+        fields[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    share->id = record->id;
+    share->session_id = fields[0];
+    share->nonce_1 = fields[1];
+    share->worker = fields[2];
+    share->job_id = fields[3];
+    share->time = fields[4];
+    share->nonce_2 = fields[5];
+    share->solution = fields[6];
+}
+
+void stratum_journal_prune_stale(stratum_journal_t *journal,
+                                 const char *session_id, const char *nonce_1,
+                                 const char *job_id) {
+    size_t tail = *journal_tail(journal);
+
+    for (size_t offset = HEADER_SIZE; offset < tail;) {
+        stratum_journal_record_t *record = journal_record(journal, offset);
+        stratum_journal_share_t share;
+
+        offset += record->size;
+
+        if (record->state != STRATUM_JOURNAL_PENDING)
+            continue;
+
+        journal_share(record, &share);
+
+        // A session id is only compared once both sides know theirs.
+        if (strcmp(share.nonce_1, nonce_1) != 0 ||
+            strcmp(share.job_id, job_id) != 0 ||
+            (*share.session_id != '\0' && *session_id != '\0' &&
+             strcmp(share.session_id, session_id) != 0))
+            journal_done(journal, record);
+    }
+}
+
+size_t stratum_journal_pending(const stratum_journal_t *journal) {
+    return journal->pending;
+}
+
+size_t stratum_journal_resubmit(stratum_journal_t *journal,
+                                stratum_journal_submit_t submit, void *arg) {
+    size_t tail = *journal_tail(journal), count = 0;
+
+    for (size_t offset = HEADER_SIZE; offset < tail;) {
+        stratum_journal_record_t *record = journal_record(journal, offset);
+        stratum_journal_share_t share;
+        long id;
+
+        offset += record->size;
+
+        if (record->state != STRATUM_JOURNAL_PENDING)
+            continue;
+
+        journal_share(record, &share);
+
+        if ((id = submit(&share, arg)) == -1)
+            continue;
+
+        record->id = id;
+        count++;
+    }
+
+    return count;
+}
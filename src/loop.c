@@ -0,0 +1,470 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libstratum/loop.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+#define MAX_EVENTS 64
+
+// 4 levels of 64 slots of 1ms ticks cover ~4.6 hours, later timers are
+// parked in the last level until they come in range.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+typedef struct loop_task {
+    stratum_loop_task_t task;
+    void *arg;
+    struct loop_task *_Atomic next;
+} loop_task_t;
+
+/**
+ * Tasks are posted through an intrusive multi-producer single-consumer queue:
+ * producers only swap `head`, and the loop thread owns `tail`.
+ * `stub` keeps the queue non empty so neither side ever touches the other's
+ * end, and `wake_pending` saves the eventfd write while the loop has not yet
+ * picked up a previous wakeup.
+ **/
+struct stratum_loop {
+    int epfd;
+    int running;
+    stratum_loop_handler_t wake;
+
+    loop_task_t *_Atomic head;
+    loop_task_t *tail;
+    loop_task_t stub;
+    atomic_int wake_pending;
+
+    /**
+     * Timer wheel, level `l` slot `s` holds the timers expiring within the
+     * 64^l ticks starting at the tick whose bits [6l, 6l + 6) are `s`.
+     * Every tick before `tick` has been run, `occupied` has a bit set for
+     * each non empty slot so idle ticks can be skipped.
+     **/
+    struct timespec epoch;
+    uint64_t tick;
+    uint64_t occupied[WHEEL_LEVELS];
+    stratum_timer_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+static void loop_wake_cb(stratum_loop_t *loop, stratum_loop_handler_t *handler,
+                         uint32_t events) {
+    uint64_t value;
+
+    (void)loop;
+    (void)events;
+
+    if (read(handler->fd, &value, sizeof(value)) == -1) {
+        CRITICAL_LOG("Failed to drain the wakeup fd(%d)", handler->fd);
+    }
+}
+
+static void loop_wake(stratum_loop_t *loop) {
+    uint64_t value = 1;
+
+    if (write(loop->wake.fd, &value, sizeof(value)) == -1) {
+        CRITICAL_LOG("Failed to wake up the loop fd(%d)", loop->wake.fd);
+    }
+}
+
+static void loop_push(stratum_loop_t *loop, loop_task_t *task) {
+    loop_task_t *prev;
+
+    atomic_store_explicit(&task->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&loop->head, task, memory_order_acq_rel);
+    // Until this store the consumer sees the queue end at `prev`.
+    atomic_store_explicit(&prev->next, task, memory_order_release);
+}
+
+/* the oldest task, NULL if empty or a producer is still linking it */
+static loop_task_t *loop_pop(stratum_loop_t *loop) {
+    loop_task_t *tail = loop->tail;
+    loop_task_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &loop->stub) {
+        if (next == NULL)
+            return NULL;
+
+        loop->tail = tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next != NULL) {
+        loop->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&loop->head, memory_order_acquire))
+        return NULL;
+
+    // `tail` is the last task, put the stub behind it to take it out.
+    loop_push(loop, &loop->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (next == NULL)
+        return NULL;
+
+    loop->tail = next;
+    return tail;
+}
+
+static void loop_run_tasks(stratum_loop_t *loop) {
+    loop_task_t *task;
+
+    // Posts from now on must wake the loop again.
+    atomic_store(&loop->wake_pending, 0);
+
+    while ((task = loop_pop(loop)) != NULL) {
+        task->task(loop, task->arg);
+        free(task);
+    }
+}
+
+static uint64_t loop_now(const stratum_loop_t *loop) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((ts.tv_sec - loop->epoch.tv_sec) * 1000000000 + ts.tv_nsec -
+            loop->epoch.tv_nsec) /
+           1000000;
+}
+
+static void timer_unlink(stratum_timer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+/* append `timer` to the list headed by the sentinel `head` */
+static void timer_link(stratum_timer_t *head, stratum_timer_t *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void wheel_insert(stratum_loop_t *loop, stratum_timer_t *timer) {
+    uint64_t expires = timer->expires, delta;
+    int level = 0, slot;
+
+    if (expires < loop->tick)
+        expires = loop->tick;
+
+    delta = expires - loop->tick;
+
+    // Park far away timers at the edge of the wheel, `expires` is kept.
+    if (delta >= WHEEL_RANGE)
+        expires = loop->tick + WHEEL_RANGE - 1;
+
+    while (level < WHEEL_LEVELS - 1 &&
+           (expires - loop->tick) >> (WHEEL_BITS * (level + 1)) != 0)
+        level++;
+
+    slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer_link(&loop->wheel[level][slot], timer);
+    loop->occupied[level] |= 1ULL << slot;
+}
+
+static void wheel_remove(stratum_loop_t *loop, stratum_timer_t *timer) {
+    stratum_timer_t *head = timer->next;
+
+    timer_unlink(timer);
+
+    // Clear the occupied bit if `timer` was alone in a wheel slot.
+    if (head == head->next && head >= &loop->wheel[0][0] &&
+        head <= &loop->wheel[WHEEL_LEVELS - 1][WHEEL_SLOTS - 1]) {
+        size_t i = head - &loop->wheel[0][0];
+
+        loop->occupied[i / WHEEL_SLOTS] &= ~(1ULL << (i % WHEEL_SLOTS));
+    }
+}
+
+/* move the timers of a wheel slot to the list headed by `head` */
+static void wheel_take(stratum_loop_t *loop, int level, int slot,
+                       stratum_timer_t *head) {
+    stratum_timer_t *from = &loop->wheel[level][slot];
+
+    head->next = head->prev = head;
+
+    if (from->next == from)
+        return;
+
+    head->next = from->next;
+    head->prev = from->prev;
+    head->next->prev = head;
+    head->prev->next = head;
+    from->next = from->prev = from;
+    loop->occupied[level] &= ~(1ULL << slot);
+}
+
+/* run the timers expiring at `loop->tick` and move past it */
+static void wheel_run_tick(stratum_loop_t *loop) {
+    uint64_t tick = loop->tick;
+    stratum_timer_t expired, *timer;
+
+    // Entering a new range of a level brings its timers a level closer.
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+        if ((tick & ((1ULL << (WHEEL_BITS * level)) - 1)) != 0)
+            continue;
+
+        wheel_take(loop, level,
+                   (tick >> (WHEEL_BITS * level)) & WHEEL_MASK, &expired);
+
+        while ((timer = expired.next) != &expired) {
+            timer_unlink(timer);
+            wheel_insert(loop, timer);
+        }
+    }
+
+    wheel_take(loop, 0, tick & WHEEL_MASK, &expired);
+    // Timers armed by the callbacks below expire at the next tick at best.
+    loop->tick = tick + 1;
+
+    // The list stays valid if a callback disarms a timer that is in it.
+    while ((timer = expired.next) != &expired) {
+        timer_unlink(timer);
+        timer->cb(loop, timer);
+    }
+}
+
+/* the first tick after `loop->tick` at which the wheel has something to do */
+static uint64_t wheel_next_tick(const stratum_loop_t *loop) {
+    uint64_t next = UINT64_MAX;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        // Slots of higher levels are due when their range starts.
+        uint64_t base = (loop->tick + (1ULL << shift) - 1) >> shift;
+        uint64_t occupied = loop->occupied[level];
+        int rot = base & WHEEL_MASK, d;
+
+        if (occupied == 0)
+            continue;
+
+        // Rotate so that the bit of the slot at `base` comes first.
+        occupied = occupied >> rot | (rot ? occupied << (64 - rot) : 0);
+        d = __builtin_ctzll(occupied);
+
+        if ((base + d) << shift < next)
+            next = (base + d) << shift;
+    }
+
+    return next;
+}
+
+static void loop_run_timers(stratum_loop_t *loop) {
+    uint64_t now = loop_now(loop);
+
+    while (loop->tick <= now) {
+        uint64_t next = wheel_next_tick(loop);
+
+        // Skip the ticks with nothing to run.
+        if (next > now) {
+            loop->tick = now + 1;
+            break;
+        }
+
+        loop->tick = next;
+        wheel_run_tick(loop);
+    }
+}
+
+/* milliseconds epoll_wait() may sleep before the next timer, -1 for none */
+static int loop_timeout(const stratum_loop_t *loop) {
+    uint64_t next = wheel_next_tick(loop), now;
+
+    if (next == UINT64_MAX)
+        return -1;
+
+    now = loop_now(loop);
+
+    if (next <= now)
+        return 0;
+
+    return next - now > INT32_MAX ? INT32_MAX : (int)(next - now);
+}
+
+void stratum_timer_init(stratum_timer_t *timer, stratum_timer_cb_t cb,
+                        void *ctx) {
+    timer->cb = cb;
+    timer->ctx = ctx;
+    timer->expires = 0;
+    timer->next = timer->prev = NULL;
+}
+
+int stratum_timer_pending(const stratum_timer_t *timer) {
+    return timer->next != NULL;
+}
+
+void stratum_loop_timer_add(stratum_loop_t *loop, stratum_timer_t *timer,
+                            uint64_t ms) {
+    if (stratum_timer_pending(timer))
+        wheel_remove(loop, timer);
+
+    timer->expires = loop_now(loop) + ms;
+    wheel_insert(loop, timer);
+}
+
+void stratum_loop_timer_del(stratum_loop_t *loop, stratum_timer_t *timer) {
+    if (stratum_timer_pending(timer))
+        wheel_remove(loop, timer);
+}
+
+stratum_loop_t *stratum_loop_init(void) {
+    stratum_loop_t *loop = calloc(1, sizeof(stratum_loop_t));
+
+    if (loop == NULL)
+        return NULL;
+
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        free(loop);
+        return NULL;
+    }
+
+    loop->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->wake.cb = loop_wake_cb;
+
+    if (loop->wake.fd == -1 ||
+        stratum_loop_add(loop, &loop->wake, EPOLLIN) == -1) {
+        if (loop->wake.fd != -1)
+            close(loop->wake.fd);
+
+        close(loop->epfd);
+        free(loop);
+        return NULL;
+    }
+
+    atomic_init(&loop->stub.next, NULL);
+    atomic_init(&loop->head, &loop->stub);
+    atomic_init(&loop->wake_pending, 0);
+    loop->tail = &loop->stub;
+    loop->running = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &loop->epoch);
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+            loop->wheel[level][slot].next = loop->wheel[level][slot].prev =
+                &loop->wheel[level][slot];
+
+    return loop;
+}
+
+void stratum_loop_free(stratum_loop_t *loop) {
+    // Tasks still queued may own memory, let them run one last time.
+    loop_run_tasks(loop);
+
+    close(loop->wake.fd);
+    close(loop->epfd);
+    free(loop);
+}
+
+int stratum_loop_add(stratum_loop_t *loop, stratum_loop_handler_t *handler,
+                     uint32_t events) {
+    struct epoll_event ev = {.events = events, .data.ptr = handler};
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, handler->fd, &ev);
+}
+
+int stratum_loop_mod(stratum_loop_t *loop, stratum_loop_handler_t *handler,
+                     uint32_t events) {
+    struct epoll_event ev = {.events = events, .data.ptr = handler};
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, handler->fd, &ev);
+}
+
+int stratum_loop_del(stratum_loop_t *loop, stratum_loop_handler_t *handler) {
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, handler->fd, NULL);
+}
+
+int stratum_loop_post(stratum_loop_t *loop, stratum_loop_task_t task,
+                      void *arg) {
+    loop_task_t *t = malloc(sizeof(loop_task_t));
+
+    if (t == NULL)
+        return -1;
+
+    t->task = task;
+    t->arg = arg;
+    loop_push(loop, t);
+
+    // Only the first post since the loop last ran its tasks needs a wakeup.
+    if (atomic_exchange(&loop->wake_pending, 1) == 0)
+        loop_wake(loop);
+
+    return 0;
+}
+
+void stratum_loop_run(stratum_loop_t *loop) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (__atomic_load_n(&loop->running, __ATOMIC_ACQUIRE)) {
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, loop_timeout(loop));
+
+        if (n == -1) {
+            CRITICAL_LOG("epoll_wait failed on fd(%d)", loop->epfd);
+            n = 0;
+        }
+
+        for (int i = 0; i < n; i++) {
+            stratum_loop_handler_t *handler = events[i].data.ptr;
+            handler->cb(loop, handler, events[i].events);
+        }
+
+        loop_run_timers(loop);
+        loop_run_tasks(loop);
+    }
+
+    DEBUG_LOG("Event loop epfd(%d) stopped", loop->epfd);
+}
+
+void stratum_loop_stop(stratum_loop_t *loop) {
+    __atomic_store_n(&loop->running, 0, __ATOMIC_RELEASE);
+    loop_wake(loop);
+}
+
+int stratum_loop_pin(int cpu) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (ncpu < 1)
+        return -1;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0
+                                                                          : -1;
+}
@@ -0,0 +1,103 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#include "libstratum/nonce.h"
+
+#include "libstratum/hex.h"
+
+static int mask_bits(uint64_t mask) {
+    return mask == 0 ? 0 : 64 - __builtin_clzll(mask);
+}
+
+static void nonce_write(const stratum_nonce_range_t *range, uint64_t value,
+                        uint8_t *nonce_2) {
+    size_t size = range->nonce_2_size;
+
+    // Big-endian in the trailing bytes, anything above 64 bits stays zero.
+    memset(nonce_2, 0, size);
+
+    for (size_t i = 0; i < size && i < 8; i++)
+        nonce_2[size - 1 - i] = value >> (8 * i);
+}
+
+int stratum_nonce_range_init(stratum_nonce_range_t *range,
+                             const char *nonce_1) {
+    int size;
+
+    memset(range, 0, sizeof(stratum_nonce_range_t));
+
+    size = stratum_hex_decode(nonce_1, range->nonce_1, STRATUM_NONCE_SIZE);
+
+    // NONCE_2 MUST leave at least one byte to the miner.
+    if (size == -1 || size == STRATUM_NONCE_SIZE)
+        return -1;
+
+    range->nonce_1_size = size;
+    range->nonce_2_size = STRATUM_NONCE_SIZE - size;
+    range->mask = range->nonce_2_size >= 8
+                      ? UINT64_MAX
+                      : ((uint64_t)1 << (8 * range->nonce_2_size)) - 1;
+
+    return 0;
+}
+
+int stratum_nonce_range_split(const stratum_nonce_range_t *range, size_t parts,
+                              size_t index, stratum_nonce_range_t *out) {
+    int bits = mask_bits(range->mask), part_bits = 0;
+
+    if (parts == 0 || index >= parts)
+        return -1;
+
+    while (((size_t)1 << part_bits) < parts)
+        part_bits++;
+
+    if (part_bits > bits)
+        return -1;
+
+    *out = *range;
+    out->taken = 0;
+
+    if (part_bits == 0)
+        return 0;
+
+    // The partition index takes the top bits of the parent range.
+    bits -= part_bits;
+    out->mask = bits == 0 ? 0 : range->mask >> part_bits;
+    out->base = range->base + ((uint64_t)index << bits);
+
+    return 0;
+}
+
+int stratum_nonce_next(stratum_nonce_range_t *range, uint8_t *nonce_2) {
+    uint64_t n = range->taken;
+
+    if (n > range->mask)
+        return -1;
+
+    range->taken++;
+    nonce_write(range, range->base + n, nonce_2);
+
+    return 0;
+}
+
+int stratum_nonce_next_shared(stratum_nonce_range_t *range, uint8_t *nonce_2) {
+    uint64_t n = __atomic_fetch_add(&range->taken, 1, __ATOMIC_RELAXED);
+
+    if (n > range->mask)
+        return -1;
+
+    nonce_write(range, range->base + n, nonce_2);
+
+    return 0;
+}
+
+void stratum_nonce_build(const stratum_nonce_range_t *range,
+                         const uint8_t *nonce_2,
+                         uint8_t nonce[STRATUM_NONCE_SIZE]) {
+    memcpy(nonce, range->nonce_1, range->nonce_1_size);
+    memcpy(nonce + range->nonce_1_size, nonce_2, range->nonce_2_size);
+}
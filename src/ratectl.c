@@ -0,0 +1,65 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include "libstratum/ratectl.h"
+
+#define DEFAULT_WINDOW 60.0
+#define DEFAULT_MIN_SHARES 32
+// Never move the target by more than this factor at once.
+#define MAX_STEP 16.0
+
+void stratum_ratectl_init(stratum_ratectl_t *ctl, double rate,
+                          double hysteresis, double now) {
+    ctl->rate = rate;
+    ctl->hysteresis = hysteresis;
+    ctl->window = DEFAULT_WINDOW;
+    ctl->min_shares = DEFAULT_MIN_SHARES;
+
+    stratum_ratectl_reset(ctl, now);
+}
+
+void stratum_ratectl_reset(stratum_ratectl_t *ctl, double now) {
+    ctl->since = now;
+    ctl->shares = 0;
+}
+
+void stratum_ratectl_share(stratum_ratectl_t *ctl) {
+    ctl->shares++;
+}
+
+int stratum_ratectl_update(stratum_ratectl_t *ctl,
+                           const stratum_target_t *current, double now,
+                           stratum_target_t *suggested) {
+    double elapsed = now - ctl->since, measured, factor;
+
+    if (elapsed <= 0 || ctl->rate <= 0)
+        return 0;
+
+    // Wait for enough samples, unless the window is over.
+    if (ctl->shares < ctl->min_shares && elapsed < ctl->window)
+        return 0;
+
+    measured = ctl->shares / elapsed;
+
+    if (measured <= ctl->rate * (1 + ctl->hysteresis) &&
+        measured >= ctl->rate / (1 + ctl->hysteresis)) {
+        stratum_ratectl_reset(ctl, now);
+        return 0;
+    }
+
+    // The share rate is proportional to the target.
+    factor = measured > 0 ? ctl->rate / measured : MAX_STEP;
+
+    if (factor > MAX_STEP)
+        factor = MAX_STEP;
+    else if (factor < 1 / MAX_STEP)
+        factor = 1 / MAX_STEP;
+
+    *suggested = *current;
+    stratum_target_scale(suggested, factor);
+    stratum_ratectl_reset(ctl, now);
+
+    return 1;
+}
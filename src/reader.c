@@ -0,0 +1,419 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "libstratum/reader.h"
+
+#include "libstratum/buffer.h"
+#include "libstratum/connection.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+#define BUFSIZE 4096
+#define CACHE_LINE 64
+
+typedef struct {
+    stratum_response_t *_Atomic res;
+    _Atomic uint64_t rx_ns;
+    // Whether `res` may be evicted, so the reader never has to look at a
+    // message the consumer may be freeing.
+    _Atomic uint8_t notify;
+} reader_slot_t;
+
+/**
+ * `head` is only moved by the consumer, and by the reader when it evicts a
+ * notification, both with a CAS. `tail` is only moved by the reader.
+ * Either side sets its `waiting` flag before sleeping on its eventfd, so
+ * the other side only pays for a write when someone actually sleeps.
+ **/
+struct stratum_reader {
+    uint32_t size;
+    stratum_overflow_t overflow;
+    int socket;
+    int timestamps;
+    pthread_t thread;
+    int started;
+
+    // Written once to stop the thread.
+    int stop_fd;
+    // Messages were queued, or the reader stopped, while the consumer slept.
+    int ready_fd;
+    // Room was made while the reader slept.
+    int space_fd;
+
+    _Atomic int stopped;
+    _Atomic uint64_t dropped;
+
+    _Alignas(CACHE_LINE) _Atomic uint64_t head;
+    _Atomic int consumer_waiting;
+    _Alignas(CACHE_LINE) _Atomic uint64_t tail;
+    _Atomic int reader_waiting;
+
+    _Alignas(CACHE_LINE) reader_slot_t slots[];
+};
+
+static void reader_signal(int fd) {
+    uint64_t value = 1;
+
+    if (write(fd, &value, sizeof(value)) == -1) {
+        CRITICAL_LOG("Failed to signal fd(%d)", fd);
+    }
+}
+
+stratum_reader_t *stratum_reader_init(uint32_t size,
+                                      stratum_overflow_t overflow) {
+    size_t bytes = sizeof(stratum_reader_t) + size * sizeof(reader_slot_t);
+    stratum_reader_t *reader;
+
+    if (size == 0 || (size & (size - 1)) != 0)
+        return NULL;
+
+    // aligned_alloc() wants a multiple of the alignment.
+    bytes = (bytes + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+
+    if ((reader = aligned_alloc(CACHE_LINE, bytes)) == NULL)
+        return NULL;
+
+    memset(reader, 0, bytes);
+    reader->size = size;
+    reader->overflow = overflow;
+    reader->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reader->ready_fd = eventfd(0, EFD_CLOEXEC);
+    reader->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    atomic_init(&reader->stopped, 1);
+
+    if (reader->stop_fd == -1 || reader->ready_fd == -1 ||
+        reader->space_fd == -1) {
+        stratum_reader_free(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+/* 1 if `fd` has a pending error, rather than only queued TX timestamps */
+static int reader_error(int fd) {
+    socklen_t size = sizeof(int);
+    int error = 0;
+
+    return getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) == -1 ||
+           error != 0;
+}
+
+/**
+ * Wait until `fd` is readable, returns -1 once the reader is being stopped.
+ **/
+static int reader_wait_fd(stratum_reader_t *reader, int fd) {
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {reader->stop_fd, POLLIN, 0}};
+
+    for (;;) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        if (fds[1].revents != 0)
+            return -1;
+
+        // A hang up is read as the end of the stream.
+        if (fds[0].revents & (POLLIN | POLLHUP))
+            return 0;
+
+        // Let the read report the error.
+        if ((fds[0].revents & POLLERR) && reader_error(fd))
+            return 0;
+
+        // Only TX timestamps are queued, which are the consumer's to take
+        // (see `stratum_timing_poll_tx()`) and keep POLLERR set until then:
+        // wait a bit on the stop fd alone instead of spinning.
+        if ((fds[0].revents & POLLERR) && poll(&fds[1], 1, 1) == 1)
+            return -1;
+    }
+}
+
+/* 1 if `res` is a `mining.notify` a later one supersedes */
+static int reader_notify(const stratum_response_t *res) {
+    return res->id == 0 &&
+           stratum_method_from_string(res->method) == STRATUM_METHOD_NOTIFY;
+}
+
+/**
+ * Queue `res` according to the overflow policy.
+ * Returns -1 if it could not be, the caller still owns it then.
+ **/
+static int reader_push(stratum_reader_t *reader, stratum_response_t *res,
+                       uint64_t rx_ns) {
+    uint64_t tail = atomic_load_explicit(&reader->tail, memory_order_relaxed);
+    uint64_t head, value;
+    reader_slot_t *slot;
+
+    for (;;) {
+        head = atomic_load(&reader->head);
+
+        if (tail - head < reader->size)
+            break;
+
+        if (reader->overflow == STRATUM_OVERFLOW_FAIL) {
+            CRITICAL_LOG("Inbound ring of fd(%d) overflowed", reader->socket);
+            return -1;
+        }
+
+        if (reader->overflow == STRATUM_OVERFLOW_DROP_NOTIFY) {
+            reader_slot_t *next = &reader->slots[head & (reader->size - 1)];
+            // Only the reader writes slots, the consumer only moves `head`.
+            stratum_response_t *oldest =
+                atomic_load_explicit(&next->res, memory_order_relaxed);
+
+            // Racing the consumer for it, whoever moves `head` owns it.
+            if (atomic_load_explicit(&next->notify, memory_order_relaxed) &&
+                atomic_compare_exchange_strong(&reader->head, &head,
+                                               head + 1)) {
+                DEBUG_LOG("Dropping job %s of fd(%d)", oldest->params[0],
+                          reader->socket);
+                stratum_response_free(oldest);
+                atomic_fetch_add_explicit(&reader->dropped, 1,
+                                          memory_order_relaxed);
+                continue;
+            }
+        }
+
+        atomic_store(&reader->reader_waiting, 1);
+
+        // The consumer may have made room before seeing the flag.
+        if (atomic_load(&reader->head) != head) {
+            atomic_store(&reader->reader_waiting, 0);
+            continue;
+        }
+
+        if (reader_wait_fd(reader, reader->space_fd) == -1)
+            return -1;
+
+        if (read(reader->space_fd, &value, sizeof(value)) == -1 &&
+            errno != EAGAIN) {
+            CRITICAL_LOG("Failed to drain fd(%d)", reader->space_fd);
+        }
+    }
+
+    slot = &reader->slots[tail & (reader->size - 1)];
+    atomic_store_explicit(&slot->res, res, memory_order_relaxed);
+    atomic_store_explicit(&slot->rx_ns, rx_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->notify, reader_notify(res),
+                          memory_order_relaxed);
+    atomic_store(&reader->tail, tail + 1);
+
+    if (atomic_exchange(&reader->consumer_waiting, 0))
+        reader_signal(reader->ready_fd);
+
+    return 0;
+}
+
+static void *reader_run(void *arg) {
+    stratum_reader_t *reader = arg;
+    stratum_buffer_t rx;
+
+    stratum_buffer_init(&rx);
+
+    while (reader_wait_fd(reader, reader->socket) == 0) {
+        uint64_t rx_ns = 0;
+        size_t offset = 0;
+        ssize_t ret;
+        char *line;
+
+        if (stratum_buffer_reserve(&rx, BUFSIZE) == -1)
+            break;
+
+        if (reader->timestamps)
+            ret = socket_recv(reader->socket, rx.data + rx.len, BUFSIZE,
+                              &rx_ns);
+        else
+            ret = socket_read(reader->socket, rx.data + rx.len, BUFSIZE);
+
+        if (ret <= 0) {
+            CRITICAL_LOG("Read failure for fd(%d)", reader->socket);
+            break;
+        }
+
+        rx.len += ret;
+
+        while ((line = stratum_buffer_next_line(&rx, &offset)) != NULL) {
+            stratum_response_t *res;
+
+            if (*line == '\0')
+                continue;
+
+            res = stratum_parse_response(line);
+
+            if (res == NULL || res->id == -1) {
+                CRITICAL_LOG("Skipping unparsable line from fd(%d): %s",
+                             reader->socket, line);
+                stratum_response_free(res);
+                continue;
+            }
+
+            if (reader_push(reader, res, rx_ns) == -1) {
+                stratum_response_free(res);
+                goto out;
+            }
+        }
+
+        stratum_buffer_consume(&rx, offset);
+    }
+
+out:
+    stratum_buffer_free(&rx);
+
+    // The consumer drains what is left, then fails.
+    atomic_store(&reader->stopped, 1);
+    reader_signal(reader->ready_fd);
+
+    return NULL;
+}
+
+int stratum_reader_start(stratum_reader_t *reader, int socket,
+                         int timestamps) {
+    uint64_t value;
+
+    if (reader->started)
+        return -1;
+
+    // Left over by a previous `stratum_reader_stop()`.
+    if (read(reader->stop_fd, &value, sizeof(value)) == -1 &&
+        errno != EAGAIN) {
+        CRITICAL_LOG("Failed to drain fd(%d)", reader->stop_fd);
+    }
+
+    reader->socket = socket;
+    reader->timestamps = timestamps;
+    atomic_store(&reader->stopped, 0);
+
+    if (pthread_create(&reader->thread, NULL, reader_run, reader) != 0) {
+        atomic_store(&reader->stopped, 1);
+        return -1;
+    }
+
+    reader->started = 1;
+
+    return 0;
+}
+
+void stratum_reader_stop(stratum_reader_t *reader) {
+    if (!reader->started)
+        return;
+
+    reader_signal(reader->stop_fd);
+    pthread_join(reader->thread, NULL);
+    reader->started = 0;
+}
+
+void stratum_reader_free(stratum_reader_t *reader) {
+    stratum_response_t *res;
+
+    stratum_reader_stop(reader);
+
+    while (stratum_reader_pop(reader, &res, NULL) == 1)
+        stratum_response_free(res);
+
+    if (reader->stop_fd != -1)
+        close(reader->stop_fd);
+
+    if (reader->ready_fd != -1)
+        close(reader->ready_fd);
+
+    if (reader->space_fd != -1)
+        close(reader->space_fd);
+
+    free(reader);
+}
+
+int stratum_reader_pop(stratum_reader_t *reader, stratum_response_t **res,
+                       uint64_t *rx_ns) {
+    for (;;) {
+        uint64_t head = atomic_load(&reader->head);
+        reader_slot_t *slot = &reader->slots[head & (reader->size - 1)];
+        stratum_response_t *msg;
+        uint64_t ns;
+
+        if (head == atomic_load(&reader->tail))
+            return atomic_load(&reader->stopped) &&
+                           head == atomic_load(&reader->tail)
+                       ? -1
+                       : 0;
+
+        msg = atomic_load_explicit(&slot->res, memory_order_relaxed);
+        ns = atomic_load_explicit(&slot->rx_ns, memory_order_relaxed);
+
+        // Lost to the reader evicting it, the next one is up.
+        if (!atomic_compare_exchange_strong(&reader->head, &head, head + 1))
+            continue;
+
+        if (atomic_exchange(&reader->reader_waiting, 0))
+            reader_signal(reader->space_fd);
+
+        *res = msg;
+
+        if (rx_ns != NULL)
+            *rx_ns = ns;
+
+        return 1;
+    }
+}
+
+int stratum_reader_wait(stratum_reader_t *reader) {
+    uint64_t value;
+
+    for (;;) {
+        if (atomic_load(&reader->head) != atomic_load(&reader->tail))
+            return 0;
+
+        if (atomic_load(&reader->stopped))
+            return atomic_load(&reader->head) != atomic_load(&reader->tail)
+                       ? 0
+                       : -1;
+
+        atomic_store(&reader->consumer_waiting, 1);
+
+        // The reader may have queued something before seeing the flag.
+        if (atomic_load(&reader->head) != atomic_load(&reader->tail) ||
+            atomic_load(&reader->stopped)) {
+            atomic_store(&reader->consumer_waiting, 0);
+            continue;
+        }
+
+        if (read(reader->ready_fd, &value, sizeof(value)) == -1 &&
+            errno != EINTR)
+            return -1;
+    }
+}
+
+uint64_t stratum_reader_dropped(const stratum_reader_t *reader) {
+    return atomic_load_explicit(&reader->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,219 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libstratum/runtime.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+typedef struct {
+    int index;
+    stratum_loop_t *loop;
+    pthread_t thread;
+} runtime_shard_t;
+
+struct stratum_runtime {
+    int nshards;
+    int started;
+    runtime_shard_t *shards;
+    // Round robin cursor for `stratum_runtime_connect()`.
+    unsigned int next;
+};
+
+typedef struct {
+    stratum_runtime_connect_cb_t cb;
+    void *arg;
+    char *hostname;
+    char *port;
+    // Resolved by the caller, so DNS never blocks the shard.
+    struct addrinfo *addrs;
+} runtime_connect_t;
+
+static __thread int runtime_current = -1;
+
+static void *runtime_shard_run(void *arg) {
+    runtime_shard_t *shard = arg;
+
+    runtime_current = shard->index;
+
+    if (stratum_loop_pin(shard->index) == -1) {
+        CRITICAL_LOG("Failed to pin shard %d", shard->index);
+    }
+
+    stratum_loop_run(shard->loop);
+
+    DEBUG_LOG("Shard %d stopped", shard->index);
+
+    return NULL;
+}
+
+stratum_runtime_t *stratum_runtime_init(int shards) {
+    stratum_runtime_t *runtime = calloc(1, sizeof(stratum_runtime_t));
+
+    if (runtime == NULL)
+        return NULL;
+
+    if (shards < 1) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        shards = ncpu > 0 ? ncpu : 1;
+    }
+
+    runtime->shards = calloc(shards, sizeof(runtime_shard_t));
+
+    if (runtime->shards == NULL) {
+        free(runtime);
+        return NULL;
+    }
+
+    for (; runtime->nshards < shards; runtime->nshards++) {
+        runtime_shard_t *shard = &runtime->shards[runtime->nshards];
+
+        shard->index = runtime->nshards;
+
+        if ((shard->loop = stratum_loop_init()) == NULL)
+            break;
+    }
+
+    if (runtime->nshards != shards) {
+        stratum_runtime_free(runtime);
+        return NULL;
+    }
+
+    return runtime;
+}
+
+static void runtime_join(stratum_runtime_t *runtime, int nthreads) {
+    for (int i = 0; i < nthreads; i++)
+        stratum_loop_stop(runtime->shards[i].loop);
+
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(runtime->shards[i].thread, NULL);
+}
+
+int stratum_runtime_start(stratum_runtime_t *runtime) {
+    for (int i = 0; i < runtime->nshards; i++) {
+        if (pthread_create(&runtime->shards[i].thread, NULL, runtime_shard_run,
+                           &runtime->shards[i]) != 0) {
+            // Only join the threads which were actually created.
+            runtime_join(runtime, i);
+            return -1;
+        }
+    }
+
+    runtime->started = 1;
+
+    return 0;
+}
+
+void stratum_runtime_stop(stratum_runtime_t *runtime) {
+    if (!runtime->started)
+        return;
+
+    runtime_join(runtime, runtime->nshards);
+    runtime->started = 0;
+}
+
+void stratum_runtime_free(stratum_runtime_t *runtime) {
+    stratum_runtime_stop(runtime);
+
+    for (int i = 0; i < runtime->nshards; i++)
+        stratum_loop_free(runtime->shards[i].loop);
+
+    free(runtime->shards);
+    free(runtime);
+}
+
+int stratum_runtime_shards(const stratum_runtime_t *runtime) {
+    return runtime->nshards;
+}
+
+stratum_loop_t *stratum_runtime_loop(stratum_runtime_t *runtime, int shard) {
+    return runtime->shards[shard % runtime->nshards].loop;
+}
+
+int stratum_runtime_current(void) { return runtime_current; }
+
+int stratum_runtime_post(stratum_runtime_t *runtime, int shard,
+                         stratum_loop_task_t task, void *arg) {
+    return stratum_loop_post(stratum_runtime_loop(runtime, shard), task, arg);
+}
+
+static void runtime_connect_free(runtime_connect_t *connect) {
+    if (connect->addrs != NULL)
+        freeaddrinfo(connect->addrs);
+
+    free(connect->hostname);
+    free(connect->port);
+    free(connect);
+}
+
+static void runtime_connect_task(stratum_loop_t *loop, void *arg) {
+    runtime_connect_t *connect = arg;
+    stratum_client_t *client = stratum_client_init_resolved(
+        loop, connect->hostname, connect->port, connect->addrs);
+
+    // Owned by the client now, even if it failed.
+    connect->addrs = NULL;
+
+    if (client == NULL) {
+        CRITICAL_LOG("Failed to connect to %s:%s", connect->hostname,
+                     connect->port);
+    }
+
+    connect->cb(client, connect->arg);
+    runtime_connect_free(connect);
+}
+
+int stratum_runtime_connect(stratum_runtime_t *runtime, int shard,
+                            const char *hostname, const char *port,
+                            stratum_runtime_connect_cb_t cb, void *arg) {
+    runtime_connect_t *connect = calloc(1, sizeof(runtime_connect_t));
+
+    if (connect == NULL)
+        return -1;
+
+    if (shard < 0)
+        shard = __atomic_fetch_add(&runtime->next, 1, __ATOMIC_RELAXED) %
+                runtime->nshards;
+    else
+        shard %= runtime->nshards;
+
+    connect->cb = cb;
+    connect->arg = arg;
+    connect->hostname = strdup(hostname);
+    connect->port = strdup(port);
+
+    if (connect->hostname == NULL || connect->port == NULL ||
+        (connect->addrs = stratum_client_resolve(hostname, port)) == NULL ||
+        stratum_runtime_post(runtime, shard, runtime_connect_task, connect) ==
+            -1) {
+        runtime_connect_free(connect);
+        return -1;
+    }
+
+    return shard;
+}
@@ -0,0 +1,271 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libstratum/sched.h"
+
+#define CACHE_LINE 64
+
+typedef struct {
+    // Odd while the job is being written, the generation is `seq / 2`.
+    _Alignas(CACHE_LINE) _Atomic uint64_t seq;
+    stratum_job_t job;
+    // Whether `job` may be worked on, cleared by `stratum_sched_retire()`.
+    uint8_t live;
+
+    // Outside of the seqlock, so picking only copies the chosen job.
+    _Atomic uint8_t has_job;
+    _Atomic double job_time;
+    _Atomic uint32_t weight;
+
+    _Atomic uint64_t work;
+    _Atomic uint64_t accepted;
+    _Atomic uint64_t rejected;
+} sched_pool_t;
+
+struct stratum_sched {
+    double max_age;
+    _Atomic int count;
+    sched_pool_t pools[STRATUM_SCHED_POOLS];
+};
+
+static inline void sched_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+stratum_sched_t *stratum_sched_init(double max_age) {
+    stratum_sched_t *sched = aligned_alloc(CACHE_LINE, sizeof(stratum_sched_t));
+
+    if (sched == NULL)
+        return NULL;
+
+    memset(sched, 0, sizeof(stratum_sched_t));
+    sched->max_age = max_age;
+
+    return sched;
+}
+
+void stratum_sched_free(stratum_sched_t *sched) { free(sched); }
+
+int stratum_sched_add(stratum_sched_t *sched, uint32_t weight) {
+    int pool = atomic_load_explicit(&sched->count, memory_order_relaxed);
+
+    if (pool == STRATUM_SCHED_POOLS)
+        return -1;
+
+    atomic_store_explicit(&sched->pools[pool].weight, weight,
+                          memory_order_relaxed);
+    // Solvers only look at the pools counted.
+    atomic_store_explicit(&sched->count, pool + 1, memory_order_release);
+
+    return pool;
+}
+
+void stratum_sched_set_weight(stratum_sched_t *sched, int pool,
+                              uint32_t weight) {
+    atomic_store_explicit(&sched->pools[pool].weight, weight,
+                          memory_order_relaxed);
+}
+
+/* the fraction of the shares of `p` that were accepted, 1 until answered */
+static double sched_ratio(const sched_pool_t *p) {
+    uint64_t accepted =
+        atomic_load_explicit(&p->accepted, memory_order_relaxed);
+    uint64_t rejected =
+        atomic_load_explicit(&p->rejected, memory_order_relaxed);
+
+    return (accepted + 1.0) / (accepted + rejected + 1.0);
+}
+
+/* the accepted work of `p` per part of its weight, lowest is picked first */
+static double sched_score(const sched_pool_t *p, uint32_t weight) {
+    return atomic_load_explicit(&p->work, memory_order_relaxed) *
+           sched_ratio(p) / weight;
+}
+
+/* 1 if the job of `p` may be picked at `now` */
+static int sched_eligible(const stratum_sched_t *sched, const sched_pool_t *p,
+                          uint32_t weight, double now) {
+    return weight != 0 &&
+           atomic_load_explicit(&p->has_job, memory_order_acquire) &&
+           (sched->max_age == 0 ||
+            now - atomic_load_explicit(&p->job_time, memory_order_relaxed) <=
+                sched->max_age);
+}
+
+/* let `pool` start level with the lowest score of the other pools */
+static void sched_level(stratum_sched_t *sched, int pool, double now) {
+    sched_pool_t *p = &sched->pools[pool];
+    uint32_t weight = atomic_load_explicit(&p->weight, memory_order_relaxed);
+    int count = atomic_load_explicit(&sched->count, memory_order_acquire);
+    double floor = -1;
+    uint64_t work;
+
+    for (int i = 0; i < count; i++) {
+        sched_pool_t *other = &sched->pools[i];
+        uint32_t w = atomic_load_explicit(&other->weight, memory_order_relaxed);
+        double score;
+
+        if (i == pool || !sched_eligible(sched, other, w, now))
+            continue;
+
+        score = sched_score(other, w);
+
+        if (floor < 0 || score < floor)
+            floor = score;
+    }
+
+    if (floor < 0 || weight == 0)
+        return;
+
+    work = floor * weight / sched_ratio(p);
+
+    if (work > atomic_load_explicit(&p->work, memory_order_relaxed))
+        atomic_store_explicit(&p->work, work, memory_order_relaxed);
+}
+
+/* write the job slot of `p`, only the thread handling the pool may call it */
+static void sched_write(sched_pool_t *p, const stratum_job_t *job) {
+    uint64_t seq = atomic_load_explicit(&p->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&p->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (job != NULL)
+        memcpy(&p->job, job, sizeof(stratum_job_t));
+
+    p->live = job != NULL;
+    atomic_store_explicit(&p->seq, seq + 2, memory_order_release);
+}
+
+void stratum_sched_publish(stratum_sched_t *sched, int pool,
+                           const stratum_job_t *job, double now) {
+    sched_pool_t *p = &sched->pools[pool];
+
+    if (!atomic_load_explicit(&p->has_job, memory_order_relaxed))
+        sched_level(sched, pool, now);
+
+    sched_write(p, job);
+    atomic_store_explicit(&p->job_time, now, memory_order_relaxed);
+    atomic_store_explicit(&p->has_job, 1, memory_order_release);
+}
+
+int stratum_sched_handle_notify(stratum_sched_t *sched, int pool,
+                                const stratum_response_t *res,
+                                const stratum_session_t *session,
+                                double now) {
+    stratum_job_t job;
+
+    if (stratum_job_from_notify(&job, res, session) == -1)
+        return -1;
+
+    stratum_sched_publish(sched, pool, &job, now);
+
+    return 0;
+}
+
+void stratum_sched_retire(stratum_sched_t *sched, int pool) {
+    sched_pool_t *p = &sched->pools[pool];
+
+    atomic_store_explicit(&p->has_job, 0, memory_order_relaxed);
+    sched_write(p, NULL);
+}
+
+void stratum_sched_share(stratum_sched_t *sched, int pool, int accepted) {
+    sched_pool_t *p = &sched->pools[pool];
+
+    atomic_fetch_add_explicit(accepted ? &p->accepted : &p->rejected, 1,
+                              memory_order_relaxed);
+}
+
+/**
+ * Copy a consistent snapshot of the job of `p` into `job`.
+ * Returns its generation, 0 if it was retired meanwhile.
+ **/
+static uint64_t sched_read(sched_pool_t *p, stratum_job_t *job) {
+    for (;;) {
+        uint64_t seq = atomic_load_explicit(&p->seq, memory_order_acquire);
+        uint8_t live;
+
+        if (seq & 1) {
+            sched_pause();
+            continue;
+        }
+
+        memcpy(job, &p->job, sizeof(stratum_job_t));
+        live = p->live;
+        atomic_thread_fence(memory_order_acquire);
+
+        // Retry if the job changed while it was copied.
+        if (atomic_load_explicit(&p->seq, memory_order_relaxed) == seq)
+            return live ? seq / 2 : 0;
+    }
+}
+
+int stratum_sched_pick(stratum_sched_t *sched, double now, uint64_t work,
+                       stratum_job_t *job, uint64_t *generation) {
+    int count = atomic_load_explicit(&sched->count, memory_order_acquire);
+
+    // A pool retired between the choice and the copy is left out next time.
+    for (int attempt = 0; attempt < STRATUM_SCHED_POOLS; attempt++) {
+        double best_score = 0, best_time = 0;
+        int best = -1;
+        uint64_t gen;
+
+        for (int i = 0; i < count; i++) {
+            sched_pool_t *p = &sched->pools[i];
+            uint32_t weight =
+                atomic_load_explicit(&p->weight, memory_order_relaxed);
+            double score, time;
+
+            if (!sched_eligible(sched, p, weight, now))
+                continue;
+
+            score = sched_score(p, weight);
+            time = atomic_load_explicit(&p->job_time, memory_order_relaxed);
+
+            // On a tie, the freshest job wins.
+            if (best == -1 || score < best_score ||
+                (score <= best_score && time > best_time)) {
+                best = i;
+                best_score = score;
+                best_time = time;
+            }
+        }
+
+        if (best == -1)
+            return -1;
+
+        if ((gen = sched_read(&sched->pools[best], job)) == 0)
+            continue;
+
+        // Charged up front, so concurrent solvers spread over the pools.
+        atomic_fetch_add_explicit(&sched->pools[best].work, work,
+                                  memory_order_relaxed);
+
+        if (generation != NULL)
+            *generation = gen;
+
+        return best;
+    }
+
+    return -1;
+}
+
+uint64_t stratum_sched_generation(const stratum_sched_t *sched, int pool) {
+    return atomic_load_explicit(&sched->pools[pool].seq,
+                                memory_order_acquire) /
+           2;
+}
+
+uint64_t stratum_sched_work(const stratum_sched_t *sched, int pool) {
+    return atomic_load_explicit(&sched->pools[pool].work,
+                                memory_order_relaxed);
+}
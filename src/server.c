@@ -0,0 +1,535 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "libstratum/server.h"
+
+#include "libstratum/buffer.h"
+#include "libstratum/loop.h"
+#include "libstratum/runtime.h"
+#include "libstratum/writer.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+#define READ_SIZE 4096
+#define LINE_SIZE 4096
+// A client sending more than this without a '\n' is misbehaving.
+#define MAX_LINE_SIZE (64 * 1024)
+
+typedef struct server_shard server_shard_t;
+
+struct stratum_server_client {
+    stratum_loop_handler_t handler;
+    server_shard_t *shard;
+    stratum_buffer_t rx;
+    stratum_buffer_t tx;
+    void *data;
+    int closed;
+
+    stratum_server_client_t *prev;
+    stratum_server_client_t *next;
+};
+
+struct server_shard {
+    stratum_server_t *server;
+    int index;
+    // Run by the shard of `runtime` with the same index.
+    stratum_loop_t *loop;
+    stratum_loop_handler_t listener;
+    stratum_server_client_t *clients;
+};
+
+struct stratum_server {
+    stratum_server_cb_t cb;
+    // The threads and loops of the shards.
+    stratum_runtime_t *runtime;
+    int nshards;
+    server_shard_t *shards;
+};
+
+// A serialized notification shared by every shard it is broadcast to.
+typedef struct {
+    int refs;
+    size_t len;
+    char *data;
+} server_line_t;
+
+typedef struct {
+    server_shard_t *shard;
+    server_line_t *line;
+} server_broadcast_t;
+
+static int server_listen(const char *host, const char *port) {
+    struct addrinfo hints, *res, *p;
+    int ret, sock = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if ((ret = getaddrinfo(host, port, &hints, &res)) != 0) {
+        CRITICAL_LOG("Failed to resolve %s:%s: %s", host, port,
+                     gai_strerror(ret));
+        return -1;
+    }
+
+    for (p = res; p != NULL; p = p->ai_next) {
+        sock = socket(p->ai_family,
+                      p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      p->ai_protocol);
+
+        if (sock == -1)
+            continue;
+
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ==
+                -1 ||
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) ==
+                -1 ||
+            bind(sock, p->ai_addr, p->ai_addrlen) == -1 ||
+            listen(sock, SOMAXCONN) == -1) {
+            CRITICAL_LOG("Failed to listen on %s:%s, retrying...", host, port);
+            close(sock);
+            sock = -1;
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo(res);
+
+    return sock;
+}
+
+static void server_client_free(stratum_loop_t *loop, void *arg) {
+    stratum_server_client_t *client = arg;
+
+    (void)loop;
+
+    stratum_buffer_free(&client->rx);
+    stratum_buffer_free(&client->tx);
+    free(client);
+}
+
+void stratum_server_close(stratum_server_client_t *client) {
+    server_shard_t *shard = client->shard;
+
+    if (client->closed)
+        return;
+
+    client->closed = 1;
+    stratum_loop_del(shard->loop, &client->handler);
+    close(client->handler.fd);
+
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        shard->clients = client->next;
+
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+
+    shard->server->cb(client, NULL);
+
+    // Events for this client may still be pending in the current iteration.
+    if (stratum_loop_post(shard->loop, server_client_free, client) == -1) {
+        CRITICAL_LOG("Leaking client fd(%d)", client->handler.fd);
+    }
+}
+
+static int server_client_flush(stratum_server_client_t *client) {
+    while (client->tx.len > 0) {
+        ssize_t ret = send(client->handler.fd, client->tx.data, client->tx.len,
+                           MSG_NOSIGNAL);
+
+        if (ret == -1) {
+            if (errno == EAGAIN)
+                return 0;
+
+            return -1;
+        }
+
+        stratum_buffer_consume(&client->tx, ret);
+    }
+
+    return stratum_loop_mod(client->shard->loop, &client->handler,
+                            EPOLLIN | EPOLLRDHUP);
+}
+
+static int server_client_send(stratum_server_client_t *client,
+                              const char *data, size_t len) {
+    ssize_t ret = 0;
+
+    if (client->closed)
+        return -1;
+
+    // Keep ordering, only write directly when nothing is queued.
+    if (client->tx.len == 0) {
+        ret = send(client->handler.fd, data, len, MSG_NOSIGNAL);
+
+        if (ret == -1 && errno != EAGAIN) {
+            stratum_server_close(client);
+            return -1;
+        } else if (ret == (ssize_t)len) {
+            return 0;
+        } else if (ret == -1) {
+            ret = 0;
+        }
+
+        if (stratum_loop_mod(client->shard->loop, &client->handler,
+                             EPOLLIN | EPOLLOUT | EPOLLRDHUP) == -1) {
+            stratum_server_close(client);
+            return -1;
+        }
+    }
+
+    if (stratum_buffer_append(&client->tx, data + ret, len - ret) == -1) {
+        stratum_server_close(client);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void server_client_handle_lines(stratum_server_client_t *client) {
+    size_t offset = 0;
+    char *line;
+
+    while (!client->closed &&
+           (line = stratum_buffer_next_line(&client->rx, &offset))) {
+        if (!strlen(line))
+            continue;
+
+        DEBUG_LOG("Parsing request %s", line);
+        stratum_response_t *req = stratum_parse_request(line);
+
+        if (req == NULL || req->id == -1) {
+            DEBUG_LOG("Dropping fd(%d) after an invalid request",
+                      client->handler.fd);
+            stratum_response_free(req);
+            stratum_server_close(client);
+            return;
+        }
+
+        client->shard->server->cb(client, req);
+        stratum_response_free(req);
+    }
+
+    if (client->closed)
+        return;
+
+    stratum_buffer_consume(&client->rx, offset);
+
+    if (client->rx.len > MAX_LINE_SIZE)
+        stratum_server_close(client);
+}
+
+static void server_client_cb(stratum_loop_t *loop,
+                             stratum_loop_handler_t *handler,
+                             uint32_t events) {
+    stratum_server_client_t *client = handler->ctx;
+    int eof = 0;
+
+    (void)loop;
+
+    if (client->closed)
+        return;
+
+    if (events & EPOLLERR) {
+        stratum_server_close(client);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && server_client_flush(client) == -1) {
+        stratum_server_close(client);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+        for (;;) {
+            if (stratum_buffer_reserve(&client->rx, READ_SIZE) == -1) {
+                eof = 1;
+                break;
+            }
+
+            ssize_t ret = read(handler->fd, client->rx.data + client->rx.len,
+                               client->rx.cap - client->rx.len);
+
+            // Handled read by read, so a peer never sending a newline is
+            // closed once past MAX_LINE_SIZE instead of growing `rx`.
+            if (ret > 0) {
+                client->rx.len += ret;
+                server_client_handle_lines(client);
+
+                if (client->closed)
+                    return;
+
+                continue;
+            }
+
+            if (ret == 0 || (errno != EAGAIN))
+                eof = 1;
+
+            break;
+        }
+    }
+
+    if (eof)
+        stratum_server_close(client);
+}
+
+static void server_accept_cb(stratum_loop_t *loop,
+                             stratum_loop_handler_t *handler,
+                             uint32_t events) {
+    server_shard_t *shard = handler->ctx;
+    int fd, one = 1;
+
+    (void)events;
+
+    while ((fd = accept4(handler->fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        stratum_server_client_t *client =
+            calloc(1, sizeof(stratum_server_client_t));
+
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        client->handler.fd = fd;
+        client->handler.cb = server_client_cb;
+        client->handler.ctx = client;
+        client->shard = shard;
+        stratum_buffer_init(&client->rx);
+        stratum_buffer_init(&client->tx);
+
+        if (stratum_loop_add(loop, &client->handler, EPOLLIN | EPOLLRDHUP) ==
+            -1) {
+            close(fd);
+            free(client);
+            continue;
+        }
+
+        client->next = shard->clients;
+        if (shard->clients != NULL)
+            shard->clients->prev = client;
+        shard->clients = client;
+
+        DEBUG_LOG("Accepted fd(%d) on shard %d", fd, shard->index);
+    }
+}
+
+stratum_server_t *stratum_server_init(const char *host, const char *port,
+                                      int shards, stratum_server_cb_t cb) {
+    stratum_server_t *server = calloc(1, sizeof(stratum_server_t));
+
+    if (server == NULL)
+        return NULL;
+
+    if (shards < 1)
+        shards = 1;
+
+    server->cb = cb;
+    server->shards = calloc(shards, sizeof(server_shard_t));
+
+    if (server->shards == NULL ||
+        (server->runtime = stratum_runtime_init(shards)) == NULL) {
+        free(server->shards);
+        free(server);
+        return NULL;
+    }
+
+    for (; server->nshards < shards; server->nshards++) {
+        server_shard_t *shard = &server->shards[server->nshards];
+
+        shard->server = server;
+        shard->index = server->nshards;
+        shard->loop = stratum_runtime_loop(server->runtime, shard->index);
+
+        if ((shard->listener.fd = server_listen(host, port)) == -1)
+            break;
+
+        shard->listener.cb = server_accept_cb;
+        shard->listener.ctx = shard;
+
+        if (stratum_loop_add(shard->loop, &shard->listener, EPOLLIN) == -1) {
+            close(shard->listener.fd);
+            break;
+        }
+    }
+
+    if (server->nshards != shards) {
+        stratum_server_free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+int stratum_server_start(stratum_server_t *server) {
+    return stratum_runtime_start(server->runtime);
+}
+
+void stratum_server_stop(stratum_server_t *server) {
+    stratum_runtime_stop(server->runtime);
+}
+
+void stratum_server_free(stratum_server_t *server) {
+    stratum_server_stop(server);
+
+    for (int i = 0; i < server->nshards; i++) {
+        server_shard_t *shard = &server->shards[i];
+
+        while (shard->clients != NULL)
+            stratum_server_close(shard->clients);
+
+        close(shard->listener.fd);
+    }
+
+    // The clients closed above are freed along with the loops.
+    stratum_runtime_free(server->runtime);
+    free(server->shards);
+    free(server);
+}
+
+int stratum_server_reply(stratum_server_client_t *client, long id,
+                         const char *result, const char *error) {
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    int ret = -1;
+
+    stratum_writer_init(&w, line, sizeof(line), 1);
+    stratum_writer_result(&w, id, result, error);
+
+    if (!w.overflow)
+        ret = server_client_send(client, w.buf, stratum_writer_finish(&w));
+
+    stratum_writer_free(&w);
+
+    return ret;
+}
+
+int stratum_server_notify(stratum_server_client_t *client, const char *method,
+                          const char *params) {
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    int ret = -1;
+
+    stratum_writer_init(&w, line, sizeof(line), 1);
+    stratum_writer_request(&w, 0, method, params);
+
+    if (!w.overflow)
+        ret = server_client_send(client, w.buf, stratum_writer_finish(&w));
+
+    stratum_writer_free(&w);
+
+    return ret;
+}
+
+static void server_broadcast_task(stratum_loop_t *loop, void *arg) {
+    server_broadcast_t *broadcast = arg;
+    stratum_server_client_t *client, *next;
+
+    (void)loop;
+
+    for (client = broadcast->shard->clients; client != NULL; client = next) {
+        // Sending may close (and unlink) the client.
+        next = client->next;
+        server_client_send(client, broadcast->line->data, broadcast->line->len);
+    }
+
+    if (__atomic_sub_fetch(&broadcast->line->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(broadcast->line->data);
+        free(broadcast->line);
+    }
+
+    free(broadcast);
+}
+
+int stratum_server_broadcast(stratum_server_t *server, const char *method,
+                             const char *params) {
+    server_line_t *line = calloc(1, sizeof(server_line_t));
+
+    if (line == NULL)
+        return -1;
+
+    if ((line->data = stratum_serialize_notification(method, params)) ==
+        NULL) {
+        free(line);
+        return -1;
+    }
+
+    line->len = strlen(line->data);
+    line->refs = server->nshards;
+
+    for (int i = 0; i < server->nshards; i++) {
+        server_broadcast_t *broadcast = malloc(sizeof(server_broadcast_t));
+
+        if (broadcast == NULL) {
+            if (__atomic_sub_fetch(&line->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                free(line->data);
+                free(line);
+            }
+
+            continue;
+        }
+
+        broadcast->shard = &server->shards[i];
+        broadcast->line = line;
+
+        if (stratum_loop_post(server->shards[i].loop, server_broadcast_task,
+                              broadcast) == -1) {
+            free(broadcast);
+
+            if (__atomic_sub_fetch(&line->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                free(line->data);
+                free(line);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void stratum_server_set_data(stratum_server_client_t *client, void *data) {
+    client->data = data;
+}
+
+void *stratum_server_get_data(stratum_server_client_t *client) {
+    return client->data;
+}
+
+int stratum_server_shard(stratum_server_client_t *client) {
+    return client->shard->index;
+}
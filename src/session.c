@@ -0,0 +1,325 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libstratum/session.h"
+
+#include "libstratum/hex.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+// Sessions are looked up by their socket fd.
+#define MAX_SESSIONS 65536
+
+static stratum_session_t *sessions[MAX_SESSIONS];
+
+static double session_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int stratum_session_init(stratum_session_t *session, int socket) {
+    memset(session, 0, sizeof(stratum_session_t));
+    stratum_buffer_init(&session->rx);
+    session->socket = socket;
+    // The id used by `stratum_mining_subscribe()`.
+    session->subscribe_id = 1;
+    session->next_id = STRATUM_WORKERS_FIRST_ID;
+
+    if (socket < 0 || socket >= MAX_SESSIONS)
+        return -1;
+
+    __atomic_store_n(&sessions[socket], session, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void stratum_session_free(stratum_session_t *session) {
+    stratum_session_t *expected = session;
+
+    stratum_buffer_free(&session->rx);
+
+    if (session->socket < 0 || session->socket >= MAX_SESSIONS)
+        return;
+
+    // Only detach if the fd has not been reused by another session.
+    __atomic_compare_exchange_n(&sessions[session->socket], &expected, NULL, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+stratum_session_t *stratum_session_lookup(int socket) {
+    if (socket < 0 || socket >= MAX_SESSIONS)
+        return NULL;
+
+    return __atomic_load_n(&sessions[socket], __ATOMIC_ACQUIRE);
+}
+
+static void session_copy(char *dst, size_t size, const char *src) {
+    if (src == NULL || strlen(src) >= size) {
+        DEBUG_LOG("Ignoring invalid subscribe result `%s`", src);
+        return;
+    }
+
+    strcpy(dst, src);
+}
+
+/* the new target from `mining.set_target` or `mining.set_difficulty` */
+static int session_next_target(stratum_session_t *session,
+                               const stratum_response_t *res) {
+    if (res->params[0] == NULL)
+        return -1;
+
+    if (stratum_method_from_string(res->method) ==
+        STRATUM_METHOD_SET_DIFFICULTY)
+        return stratum_target_from_difficulty(&session->next_target,
+                                              strtod(res->params[0], NULL));
+
+    return stratum_target_from_hex(&session->next_target, res->params[0]);
+}
+
+/* 1 if the `mining.notify` `res` has CLEAN_JOBS set, its last param */
+static int session_clean(const stratum_response_t *res) {
+    for (int i = STRATUM_MAX_PARAMS - 1; i >= 0; i--)
+        if (res->params[i] != NULL)
+            return strcmp(res->params[i], "true") == 0;
+
+    return 0;
+}
+
+void stratum_session_handle_response(stratum_session_t *session,
+                                     const stratum_response_t *res) {
+    if (session->workers != NULL)
+        stratum_workers_handle_response(session->workers, res);
+
+    // Accepted or not, the share got an answer. The ids of a previous
+    // connection are only matched once its shares were submitted again.
+    if (session->journal != NULL && !session->resubmit && res->id > 0 &&
+        res->id != session->subscribe_id)
+        stratum_journal_ack(session->journal, res->id);
+
+    // The result of `mining.subscribe`: [SESSION_ID, NONCE_1], or
+    // [[SUBSCRIPTIONS], EXTRANONCE_1, EXTRANONCE_2_SIZE] for Bitcoin-style
+    // pools.
+    if (res->id == session->subscribe_id && res->result[0] != NULL &&
+        strcmp(res->result[0], "null") != 0) {
+        if (res->result[0][0] != '[')
+            session_copy(session->session_id, sizeof(session->session_id),
+                         res->result[0]);
+
+        session_copy(session->nonce_1, sizeof(session->nonce_1),
+                     res->result[1]);
+
+        if (res->result[2] != NULL)
+            session->nonce_2_size = strtoul(res->result[2], NULL, 10);
+
+        return;
+    }
+
+    switch (stratum_method_from_string(res->method)) {
+    case STRATUM_METHOD_SET_TARGET:
+    case STRATUM_METHOD_SET_DIFFICULTY:
+        if (session_next_target(session, res) == -1) {
+            DEBUG_LOG("Ignoring invalid target `%s`", res->params[0]);
+            break;
+        }
+
+        session->has_next_target = 1;
+
+        if (session->ratectl != NULL)
+            stratum_ratectl_reset(session->ratectl, session_now());
+
+        // Nothing to mine yet, the target applies to the first job.
+        if (!session->has_target) {
+            session->target = session->next_target;
+            session->has_target = 1;
+        }
+        break;
+    case STRATUM_METHOD_NOTIFY:
+        // Every previous job is retired, and their shares with them.
+        if (session->dedup != NULL && session_clean(res))
+            stratum_dedup_clear(session->dedup);
+
+        if (session->journal != NULL && session_clean(res))
+            stratum_journal_prune(session->journal);
+
+        // Only the shares of this session's live job can be submitted again.
+        if (session->journal != NULL && session->resubmit &&
+            res->params[0] != NULL)
+            stratum_journal_prune_stale(session->journal, session->session_id,
+                                        session->nonce_1, res->params[0]);
+
+        if (session->has_next_target) {
+            session->target = session->next_target;
+            session->has_target = 1;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+int stratum_session_check_share(const stratum_session_t *session,
+                                const uint8_t *header, size_t header_size,
+                                const uint8_t *solution, size_t solution_size) {
+    if (!session->has_target)
+        return 1;
+
+    return stratum_share_check(&session->target, header, header_size, solution,
+                               solution_size);
+}
+
+void stratum_session_enable_ratectl(stratum_session_t *session,
+                                    stratum_ratectl_t *ctl, double rate,
+                                    double hysteresis) {
+    stratum_ratectl_init(ctl, rate, hysteresis, session_now());
+    session->ratectl = ctl;
+}
+
+int stratum_session_enable_timing(stratum_session_t *session,
+                                  stratum_timing_t *timing) {
+    if (stratum_timing_enable(timing, session->socket) == -1)
+        return -1;
+
+    session->timing = timing;
+
+    return 0;
+}
+
+void stratum_session_enable_coalescing(stratum_session_t *session) {
+    session->coalesce = 1;
+}
+
+void stratum_session_enable_dedup(stratum_session_t *session,
+                                  stratum_dedup_t *dedup) {
+    session->dedup = dedup;
+}
+
+void stratum_session_enable_workers(stratum_session_t *session,
+                                    stratum_workers_t *workers) {
+    session->workers = workers;
+}
+
+void stratum_session_enable_journal(stratum_session_t *session,
+                                    stratum_journal_t *journal) {
+    session->journal = journal;
+    session->resubmit = 1;
+}
+
+int stratum_session_enable_reader(stratum_session_t *session,
+                                  stratum_reader_t *reader) {
+    if (session->protocol == STRATUM_PROTOCOL_V2 ||
+        stratum_reader_start(reader, session->socket,
+                             session->timing != NULL) == -1)
+        return -1;
+
+    session->reader = reader;
+
+    return 0;
+}
+
+void stratum_session_enable_sv2(stratum_session_t *session) {
+    session->protocol = STRATUM_PROTOCOL_V2;
+}
+
+void stratum_session_handle_sv2(stratum_session_t *session,
+                                const stratum_sv2_message_t *msg) {
+    if (session->workers != NULL)
+        stratum_workers_handle_sv2(session->workers, msg);
+
+    switch (msg->type) {
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS: {
+        const stratum_sv2_open_standard_mining_channel_success_t *m =
+            &msg->body.open_standard_mining_channel_success;
+
+        session->channel_id = m->channel_id;
+        stratum_hex_encode(m->extranonce_prefix, m->extranonce_prefix_size,
+                           session->nonce_1);
+        stratum_sv2_target_from_u256(&session->target, m->target);
+        session->has_target = 1;
+
+        // The shares of the previous channels cannot be submitted on it.
+        if (session->journal != NULL && session->resubmit) {
+            session->resubmit = 0;
+            stratum_journal_prune(session->journal);
+        }
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS: {
+        const stratum_sv2_submit_shares_success_t *m =
+            &msg->body.submit_shares_success;
+
+        // It acknowledges the shares up to LAST_SEQUENCE_NUMBER at once.
+        for (uint32_t i = 0;
+             session->journal != NULL && i < m->new_submits_accepted_count; i++)
+            stratum_journal_ack(session->journal, m->last_sequence_number - i);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR:
+        if (session->journal != NULL)
+            stratum_journal_ack(session->journal,
+                                msg->body.submit_shares_error.sequence_number);
+        break;
+    case STRATUM_SV2_SET_NEW_PREV_HASH:
+        // The jobs on top of the previous block are retired.
+        if (session->dedup != NULL)
+            stratum_dedup_clear(session->dedup);
+        break;
+    case STRATUM_SV2_SET_TARGET:
+        if (msg->body.set_target.channel_id != session->channel_id)
+            break;
+
+        // Unlike `mining.set_target`, it applies to the current job too.
+        stratum_sv2_target_from_u256(&session->target,
+                                     msg->body.set_target.maximum_target);
+        session->has_target = 1;
+
+        if (session->ratectl != NULL)
+            stratum_ratectl_reset(session->ratectl, session_now());
+        break;
+    default:
+        break;
+    }
+}
+
+int stratum_session_rate_share(stratum_session_t *session, char hex[65]) {
+    stratum_target_t suggested;
+
+    if (session->ratectl == NULL || !session->has_target)
+        return 0;
+
+    stratum_ratectl_share(session->ratectl);
+
+    if (!stratum_ratectl_update(session->ratectl, &session->target,
+                                session_now(), &suggested))
+        return 0;
+
+    stratum_target_to_hex(&suggested, hex);
+    DEBUG_LOG("Suggesting target %s on fd(%d)", hex, session->socket);
+
+    return 1;
+}
+
+void stratum_session_handle_submit(stratum_session_t *session) {
+    char hex[65];
+
+    if (stratum_session_rate_share(session, hex))
+        stratum_mining_suggest_target(session->socket, hex);
+}
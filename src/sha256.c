@@ -0,0 +1,425 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86
+#endif
+
+#include "libstratum/sha256.h"
+
+typedef void (*sha256_compress_t)(uint32_t state[8], const uint8_t *data,
+                                  size_t blocks);
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t load_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+           (uint32_t)p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void sha256_compress_generic(uint32_t state[8], const uint8_t *data,
+                                    size_t blocks) {
+    uint32_t w[64];
+
+    for (; blocks > 0; blocks--, data += 64) {
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 16; i++)
+            w[i] = load_be32(data + 4 * i);
+
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^
+                          (w[i - 15] >> 3);
+            uint32_t s1 =
+                ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + K[i] + w[i];
+            uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sha,sse4.1"))) static void
+sha256_compress_shani(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i mask =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp, w[4];
+
+    // The SHA extensions want the state as ABEF / CDGH.
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]),
+                               0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i abef = state0, cdgh = state1;
+
+        for (int i = 0; i < 4; i++)
+            w[i] = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)(data + 16 * i)), mask);
+
+        for (int i = 0; i < 16; i++) {
+            __m128i msg = _mm_add_epi32(
+                w[i & 3], _mm_loadu_si128((const __m128i *)&K[4 * i]));
+
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                           _mm_shuffle_epi32(msg, 0x0E));
+
+            if (i < 12) {
+                // W[i + 4] replaces W[i] in the message schedule.
+                tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                tmp = _mm_add_epi32(
+                    tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+#ifdef HAVE_X86
+#define ROTR8(x, n)                                                            \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/* compress one block into each of the 8 states, lane `i` being `blocks[i]` */
+__attribute__((target("avx2"))) static void
+sha256_compress_x8(__m256i state[8], const uint8_t *const blocks[8]) {
+    __m256i w[64], s[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm256_setr_epi32(
+            load_be32(blocks[0] + 4 * i), load_be32(blocks[1] + 4 * i),
+            load_be32(blocks[2] + 4 * i), load_be32(blocks[3] + 4 * i),
+            load_be32(blocks[4] + 4 * i), load_be32(blocks[5] + 4 * i),
+            load_be32(blocks[6] + 4 * i), load_be32(blocks[7] + 4 * i));
+
+    for (int i = 16; i < 64; i++) {
+        __m256i s0 = _mm256_xor_si256(
+            _mm256_xor_si256(ROTR8(w[i - 15], 7), ROTR8(w[i - 15], 18)),
+            _mm256_srli_epi32(w[i - 15], 3));
+        __m256i s1 = _mm256_xor_si256(
+            _mm256_xor_si256(ROTR8(w[i - 2], 17), ROTR8(w[i - 2], 19)),
+            _mm256_srli_epi32(w[i - 2], 10));
+
+        w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0),
+                                _mm256_add_epi32(w[i - 7], s1));
+    }
+
+    for (int i = 0; i < 8; i++)
+        s[i] = state[i];
+
+    for (int i = 0; i < 64; i++) {
+        __m256i a = s[0], e = s[4];
+        __m256i s1 = _mm256_xor_si256(
+            _mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, s[5]),
+                                      _mm256_andnot_si256(e, s[6]));
+        __m256i t1 = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_add_epi32(s[7], s1), ch),
+            _mm256_add_epi32(_mm256_set1_epi32(K[i]), w[i]));
+        __m256i s0 = _mm256_xor_si256(
+            _mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+        __m256i maj = _mm256_xor_si256(
+            _mm256_and_si256(a, _mm256_xor_si256(s[1], s[2])),
+            _mm256_and_si256(s[1], s[2]));
+
+        s[7] = s[6];
+        s[6] = s[5];
+        s[5] = e;
+        s[4] = _mm256_add_epi32(s[3], t1);
+        s[3] = s[2];
+        s[2] = s[1];
+        s[1] = a;
+        s[0] = _mm256_add_epi32(t1, _mm256_add_epi32(s0, maj));
+    }
+
+    for (int i = 0; i < 8; i++)
+        state[i] = _mm256_add_epi32(state[i], s[i]);
+}
+#endif
+
+static sha256_compress_t sha256_compress_impl(void) {
+    static sha256_compress_t impl = NULL;
+    sha256_compress_t ret = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+
+    if (ret != NULL)
+        return ret;
+
+    ret = sha256_compress_generic;
+
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+        ret = sha256_compress_shani;
+#endif
+
+    __atomic_store_n(&impl, ret, __ATOMIC_RELAXED);
+
+    return ret;
+}
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+void stratum_sha256_init(stratum_sha256_t *ctx) {
+    memcpy(ctx->state, IV, sizeof(IV));
+    ctx->count = 0;
+}
+
+void stratum_sha256_update(stratum_sha256_t *ctx, const void *data,
+                           size_t size) {
+    sha256_compress_t compress = sha256_compress_impl();
+    const uint8_t *p = data;
+    size_t used = ctx->count % 64;
+
+    ctx->count += size;
+
+    if (used > 0) {
+        size_t n = 64 - used < size ? 64 - used : size;
+
+        memcpy(ctx->buf + used, p, n);
+        p += n;
+        size -= n;
+
+        if (used + n < 64)
+            return;
+
+        compress(ctx->state, ctx->buf, 1);
+    }
+
+    if (size >= 64) {
+        compress(ctx->state, p, size / 64);
+        p += size & ~(size_t)63;
+        size %= 64;
+    }
+
+    memcpy(ctx->buf, p, size);
+}
+
+void stratum_sha256_final(stratum_sha256_t *ctx, uint8_t out[32]) {
+    static const uint8_t pad[64] = {0x80};
+    uint64_t bits = ctx->count * 8;
+    uint8_t len[8];
+
+    for (int i = 0; i < 8; i++)
+        len[i] = bits >> (56 - 8 * i);
+
+    stratum_sha256_update(ctx, pad, 1 + (119 - ctx->count % 64) % 64);
+    stratum_sha256_update(ctx, len, sizeof(len));
+
+    for (int i = 0; i < 8; i++)
+        store_be32(out + 4 * i, ctx->state[i]);
+}
+
+void stratum_sha256d(const void *data, size_t size, uint8_t out[32]) {
+    stratum_sha256_t ctx;
+
+    stratum_sha256_init(&ctx);
+    stratum_sha256_update(&ctx, data, size);
+    stratum_sha256_final(&ctx, out);
+
+    stratum_sha256_init(&ctx);
+    stratum_sha256_update(&ctx, out, 32);
+    stratum_sha256_final(&ctx, out);
+}
+
+/**
+ * The `k`th padded block of a message made of `prefix` bytes already
+ * compressed followed by the `size` bytes of `data`. Blocks holding padding
+ * are built in `tmp`.
+ **/
+static const uint8_t *sha256_block(const uint8_t *data, size_t size,
+                                   uint64_t prefix, size_t k,
+                                   uint8_t tmp[64]) {
+    size_t start = 64 * k, n = size > start ? size - start : 0;
+    uint64_t bits = (prefix + size) * 8;
+
+    if (n >= 64)
+        return data + start;
+
+    memset(tmp, 0, 64);
+
+    if (n > 0)
+        memcpy(tmp, data + start, n);
+
+    if (start <= size)
+        tmp[n] = 0x80;
+
+    // The length ends the last block.
+    if (k == (size + 8) / 64)
+        for (int i = 0; i < 8; i++)
+            tmp[56 + i] = bits >> (56 - 8 * i);
+
+    return tmp;
+}
+
+/* the block hashing a 32 bytes digest, for the second round of SHA-256d */
+static void sha256_digest_block(const uint32_t state[8], uint8_t block[64]) {
+    memset(block, 0, 64);
+
+    for (int i = 0; i < 8; i++)
+        store_be32(block + 4 * i, state[i]);
+
+    block[32] = 0x80;
+    // 256 bits.
+    block[62] = 0x01;
+}
+
+static void sha256d_one(const uint32_t init[8], uint64_t prefix,
+                        const uint8_t *data, size_t size, uint8_t out[32]) {
+    sha256_compress_t compress = sha256_compress_impl();
+    uint32_t state[8];
+    uint8_t tmp[64];
+
+    memcpy(state, init, sizeof(state));
+
+    for (size_t k = 0; k <= (size + 8) / 64; k++)
+        compress(state, sha256_block(data, size, prefix, k, tmp), 1);
+
+    sha256_digest_block(state, tmp);
+    memcpy(state, IV, sizeof(IV));
+    compress(state, tmp, 1);
+
+    for (int i = 0; i < 8; i++)
+        store_be32(out + 4 * i, state[i]);
+}
+
+#ifdef HAVE_X86
+__attribute__((target("avx2"))) static void
+sha256d_x8(const uint32_t init[8], uint64_t prefix, const uint8_t *data,
+           size_t size, size_t stride, uint8_t (*out)[32]) {
+    const uint8_t *blocks[8];
+    uint8_t tmp[8][64];
+    uint32_t words[8][8];
+    __m256i state[8];
+
+    for (int i = 0; i < 8; i++)
+        state[i] = _mm256_set1_epi32(init[i]);
+
+    for (size_t k = 0; k <= (size + 8) / 64; k++) {
+        for (int j = 0; j < 8; j++)
+            blocks[j] = sha256_block(data + j * stride, size, prefix, k,
+                                     tmp[j]);
+
+        sha256_compress_x8(state, blocks);
+    }
+
+    // Transpose the lanes back into one digest per message.
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i *)words[i], state[i]);
+        state[i] = _mm256_set1_epi32(IV[i]);
+    }
+
+    for (int j = 0; j < 8; j++) {
+        uint32_t digest[8];
+
+        for (int i = 0; i < 8; i++)
+            digest[i] = words[i][j];
+
+        sha256_digest_block(digest, tmp[j]);
+        blocks[j] = tmp[j];
+    }
+
+    sha256_compress_x8(state, blocks);
+
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)words[i], state[i]);
+
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            store_be32(out[j] + 4 * i, words[i][j]);
+}
+
+static int sha256_have_avx2(void) {
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+void stratum_sha256d_many(const stratum_sha256_t *prefix, const uint8_t *data,
+                          size_t size, size_t stride, size_t n,
+                          uint8_t (*out)[32]) {
+    const uint32_t *init = prefix != NULL ? prefix->state : IV;
+    uint64_t count = prefix != NULL ? prefix->count : 0;
+    size_t i = 0;
+
+#ifdef HAVE_X86
+    // SHA-NI hashes a single message faster than AVX2 does eight.
+    if (sha256_compress_impl() == sha256_compress_generic &&
+        sha256_have_avx2()) {
+        for (; i + 8 <= n; i += 8)
+            sha256d_x8(init, count, data + i * stride, size, stride, out + i);
+    }
+#endif
+
+    for (; i < n; i++)
+        sha256d_one(init, count, data + i * stride, size, out[i]);
+}
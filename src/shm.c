@@ -0,0 +1,316 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libstratum/shm.h"
+
+#include "libstratum/hex.h"
+
+#ifdef ENABLE_DEBUG_LOGGING
+#define DEBUG_LOG(...)                                                         \
+    {                                                                          \
+        printf(__VA_ARGS__);                                                   \
+        puts("");                                                              \
+    }
+#else
+#define DEBUG_LOG(...)
+#endif
+
+#ifdef ENABLE_CRITICAL_LOGGING
+#define CRITICAL_LOG(...) warn(__VA_ARGS__)
+#else
+#define CRITICAL_LOG(...)
+#endif
+
+// "STRSHM01"
+#define SHM_MAGIC 0x31304d4853525453ULL
+#define CACHE_LINE 64
+
+/**
+ * A ring slot is ready to be pushed into when `seq` equals the push position,
+ * and ready to be popped once the producer set it to position + 1.
+ **/
+typedef struct {
+    _Atomic uint64_t seq;
+    stratum_shm_share_t share;
+} shm_slot_t;
+
+// The layout of the shared memory, identical in every process mapping it.
+typedef struct {
+    _Atomic uint64_t magic;
+    uint32_t ring_size;
+    uint32_t slot_size;
+    uint32_t job_size;
+
+    // Odd while the job is being written, the generation is `job_seq / 2`.
+    _Alignas(CACHE_LINE) _Atomic uint64_t job_seq;
+    stratum_job_t job;
+
+    _Alignas(CACHE_LINE) _Atomic uint64_t head;
+    _Alignas(CACHE_LINE) _Atomic uint64_t tail;
+    _Alignas(CACHE_LINE) shm_slot_t slots[];
+} shm_layout_t;
+
+struct stratum_shm {
+    shm_layout_t *map;
+    size_t size;
+};
+
+static inline void shm_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static stratum_shm_t *shm_map(int fd, size_t size) {
+    stratum_shm_t *shm = malloc(sizeof(stratum_shm_t));
+    void *map;
+
+    if (shm == NULL)
+        return NULL;
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        free(shm);
+        return NULL;
+    }
+
+    shm->map = map;
+    shm->size = size;
+
+    return shm;
+}
+
+stratum_shm_t *stratum_shm_create(const char *name, uint32_t ring_size) {
+    size_t size = sizeof(shm_layout_t) + ring_size * sizeof(shm_slot_t);
+    stratum_shm_t *shm;
+    int fd;
+
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0)
+        return NULL;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+        return NULL;
+
+    // Truncating first zeroes out whatever a previous run left behind.
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    shm = shm_map(fd, size);
+    close(fd);
+
+    if (shm == NULL)
+        return NULL;
+
+    shm->map->ring_size = ring_size;
+    shm->map->slot_size = sizeof(shm_slot_t);
+    shm->map->job_size = sizeof(stratum_job_t);
+
+    for (uint32_t i = 0; i < ring_size; i++)
+        atomic_init(&shm->map->slots[i].seq, i);
+
+    // Solvers only trust the layout once the magic is there.
+    atomic_store_explicit(&shm->map->magic, SHM_MAGIC, memory_order_release);
+
+    DEBUG_LOG("Created shm %s (%zu bytes)", name, size);
+
+    return shm;
+}
+
+stratum_shm_t *stratum_shm_open(const char *name) {
+    stratum_shm_t *shm;
+    struct stat st;
+    shm_layout_t *map;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR | O_CLOEXEC, 0)) == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(shm_layout_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    shm = shm_map(fd, st.st_size);
+    close(fd);
+
+    if (shm == NULL)
+        return NULL;
+
+    map = shm->map;
+
+    // Refuse a channel created by an incompatible build.
+    if (atomic_load_explicit(&map->magic, memory_order_acquire) != SHM_MAGIC ||
+        map->slot_size != sizeof(shm_slot_t) ||
+        map->job_size != sizeof(stratum_job_t) ||
+        shm->size <
+            sizeof(shm_layout_t) + map->ring_size * sizeof(shm_slot_t)) {
+        CRITICAL_LOG("Invalid shm %s", name);
+        stratum_shm_close(shm);
+        return NULL;
+    }
+
+    return shm;
+}
+
+void stratum_shm_close(stratum_shm_t *shm) {
+    munmap(shm->map, shm->size);
+    free(shm);
+}
+
+int stratum_shm_unlink(const char *name) { return shm_unlink(name); }
+
+void stratum_shm_publish(stratum_shm_t *shm, const stratum_job_t *job) {
+    shm_layout_t *map = shm->map;
+    uint64_t seq = atomic_load_explicit(&map->job_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&map->job_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&map->job, job, sizeof(stratum_job_t));
+    atomic_store_explicit(&map->job_seq, seq + 2, memory_order_release);
+}
+
+uint64_t stratum_shm_generation(const stratum_shm_t *shm) {
+    return atomic_load_explicit(&shm->map->job_seq, memory_order_acquire) / 2;
+}
+
+uint64_t stratum_shm_read_job(const stratum_shm_t *shm, stratum_job_t *job) {
+    shm_layout_t *map = shm->map;
+
+    for (;;) {
+        uint64_t seq =
+            atomic_load_explicit(&map->job_seq, memory_order_acquire);
+
+        if (seq & 1) {
+            shm_pause();
+            continue;
+        }
+
+        memcpy(job, &map->job, sizeof(stratum_job_t));
+        atomic_thread_fence(memory_order_acquire);
+
+        // Retry if the job changed while it was copied.
+        if (atomic_load_explicit(&map->job_seq, memory_order_relaxed) == seq)
+            return seq / 2;
+    }
+}
+
+int stratum_shm_push_share(stratum_shm_t *shm,
+                           const stratum_shm_share_t *share) {
+    shm_layout_t *map = shm->map;
+    uint64_t pos = atomic_load_explicit(&map->head, memory_order_relaxed);
+    shm_slot_t *slot;
+
+    for (;;) {
+        slot = &map->slots[pos & (map->ring_size - 1)];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&map->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // The slot still holds a share from the previous lap.
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&map->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(&slot->share, share, sizeof(stratum_shm_share_t));
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    return 0;
+}
+
+/* the oldest queued share, left in the ring until `shm_release()` */
+static shm_slot_t *shm_peek(stratum_shm_t *shm) {
+    shm_layout_t *map = shm->map;
+    uint64_t pos = atomic_load_explicit(&map->tail, memory_order_relaxed);
+    shm_slot_t *slot = &map->slots[pos & (map->ring_size - 1)];
+
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        return NULL;
+
+    return slot;
+}
+
+static void shm_release(stratum_shm_t *shm, shm_slot_t *slot) {
+    shm_layout_t *map = shm->map;
+    uint64_t pos = atomic_load_explicit(&map->tail, memory_order_relaxed);
+
+    // Hand the slot back to the producers for the next lap.
+    atomic_store_explicit(&slot->seq, pos + map->ring_size,
+                          memory_order_release);
+    atomic_store_explicit(&map->tail, pos + 1, memory_order_relaxed);
+}
+
+int stratum_shm_pop_share(stratum_shm_t *shm, stratum_shm_share_t *share) {
+    shm_slot_t *slot = shm_peek(shm);
+
+    if (slot == NULL)
+        return 0;
+
+    memcpy(share, &slot->share, sizeof(stratum_shm_share_t));
+    shm_release(shm, slot);
+
+    return 1;
+}
+
+int stratum_shm_submit_shares(stratum_shm_t *shm, stratum_client_t *client,
+                              const char *worker,
+                              stratum_client_reply_cb_t cb, void *arg) {
+    char time[2 * 4 + 1], nonce_2[2 * STRATUM_NONCE_SIZE + 1];
+    char solution[2 * STRATUM_SOLUTION_SIZE + 1];
+    shm_slot_t *slot;
+    int n = 0;
+    long ret;
+
+    while ((slot = shm_peek(shm)) != NULL) {
+        stratum_shm_share_t *share = &slot->share;
+
+        if (share->nonce_2_size > STRATUM_NONCE_SIZE ||
+            share->solution_size > STRATUM_SOLUTION_SIZE) {
+            CRITICAL_LOG("Dropping an invalid share for job %s",
+                         share->job_id);
+            shm_release(shm, slot);
+            continue;
+        }
+
+        share->job_id[STRATUM_JOB_ID_SIZE] = '\0';
+        stratum_hex_encode(share->time, sizeof(share->time), time);
+        stratum_hex_encode(share->nonce_2, share->nonce_2_size, nonce_2);
+        stratum_hex_encode(share->solution, share->solution_size, solution);
+
+        ret = stratum_client_submit(client, worker, share->job_id, time,
+                                    nonce_2, solution, cb, arg);
+
+        // Keep the share queued if the client cannot take it right now.
+        if (ret == -1)
+            break;
+
+        shm_release(shm, slot);
+
+        // A duplicate is not sent, but must not hold up the others.
+        if (ret != -2)
+            n++;
+    }
+
+    return n;
+}
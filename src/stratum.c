@@ -3,6 +3,8 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          https://www.boost.org/LICENSE_1_0.txt)
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <err.h>
 #include <stdio.h>
@@ -13,6 +15,8 @@
 
 #include "libstratum/connection.h"
 #include "libstratum/jsmn.h"
+#include "libstratum/reader.h"
+#include "libstratum/session.h"
 
 #ifdef ENABLE_DEBUG_LOGGING
 #define DEBUG_LOG(...)                                                         \
@@ -29,21 +33,113 @@
 #endif
 
 #define BUFSIZE 1024
+// Messages of a read handed to `stratum_coalesce()` at once.
+#define MAX_BATCH 64
+// Fits a mining.submit with a 1344 bytes Equihash solution, larger messages
+// are moved to the heap.
+#define LINE_SIZE 4096
+// Longest line `handle()` waits for the end of.
+#define MAX_LINE_SIZE (64 * 1024)
 
-char *stratum_serialize_data(stratum_data_t *data) {
-    size_t size =
-        snprintf(NULL, 0, "{\"id\": %d, \"method\": \"%s\", \"params\": %s}\n",
-                 data->id, data->method, data->params);
+static char *serialize(void (*write)(stratum_writer_t *, const void *),
+                       const void *arg) {
+    stratum_writer_t w;
+    char *dumped;
+
+    // Measure first, so the string is allocated exactly once.
+    stratum_writer_init(&w, NULL, 0, 0);
+    write(&w, arg);
 
-    char *dumped = calloc(1, size + 1);
+    if ((dumped = calloc(1, w.len + 1)) == NULL)
+        return NULL;
 
-    snprintf(dumped, size + 1,
-             "{\"id\": %d, \"method\": \"%s\", \"params\": %s}\n", data->id,
-             data->method, data->params);
+    stratum_writer_init(&w, dumped, w.len + 1, 0);
+    write(&w, arg);
+    stratum_writer_finish(&w);
 
     return dumped;
 }
 
+static void write_data(stratum_writer_t *w, const void *arg) {
+    const stratum_data_t *data = arg;
+
+    stratum_writer_request(w, data->id, data->method, data->params);
+}
+
+typedef struct {
+    long id;
+    const char *result;
+    const char *error;
+} result_args_t;
+
+static void write_result(stratum_writer_t *w, const void *arg) {
+    const result_args_t *args = arg;
+
+    stratum_writer_result(w, args->id, args->result, args->error);
+}
+
+static void write_notification(stratum_writer_t *w, const void *arg) {
+    const char *const *args = arg;
+
+    stratum_writer_request(w, 0, args[0], args[1]);
+}
+
+char *stratum_serialize_data(stratum_data_t *data) {
+    return serialize(write_data, data);
+}
+
+char *stratum_serialize_result(long id, const char *result,
+                               const char *error) {
+    result_args_t args = {.id = id, .result = result, .error = error};
+
+    return serialize(write_result, &args);
+}
+
+char *stratum_serialize_notification(const char *method, const char *params) {
+    const char *args[] = {method, params};
+
+    return serialize(write_notification, args);
+}
+
+void stratum_write_subscribe(stratum_writer_t *w, long id,
+                             const char *user_agent, const char *session_id,
+                             const char *host, const char *port) {
+    stratum_writer_begin_request(w, id, "mining.subscribe");
+    stratum_writer_param(w, user_agent);
+    stratum_writer_param(w, session_id);
+    stratum_writer_param(w, host);
+    // CONNECT_PORT is an int.
+    stratum_writer_param_raw(w, port);
+    stratum_writer_end_request(w);
+}
+
+void stratum_write_authorize(stratum_writer_t *w, long id,
+                             const char *username, const char *password) {
+    stratum_writer_begin_request(w, id, "mining.authorize");
+    stratum_writer_param(w, username);
+    stratum_writer_param(w, password);
+    stratum_writer_end_request(w);
+}
+
+void stratum_write_submit(stratum_writer_t *w, long id, const char *worker,
+                          const char *job_id, const char *time,
+                          const char *nonce_2, const char *solution) {
+    stratum_writer_begin_request(w, id, "mining.submit");
+    stratum_writer_param(w, worker);
+    stratum_writer_param(w, job_id);
+    stratum_writer_param(w, time);
+    stratum_writer_param(w, nonce_2);
+    stratum_writer_param(w, solution);
+    stratum_writer_end_request(w);
+}
+
+void stratum_write_suggest_target(stratum_writer_t *w, long id,
+                                  const char *target) {
+    stratum_writer_begin_request(w, id, "mining.suggest_target");
+    stratum_writer_param(w, target);
+    stratum_writer_end_request(w);
+}
+
 static int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
     if (tok->type == JSMN_STRING && (int)strlen(s) == tok->end - tok->start &&
         strncmp(json + tok->start, s, tok->end - tok->start) == 0)
@@ -52,6 +148,42 @@ static int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
     return -1;
 }
 
+/* the index of the token after `t[i]` and everything nested in it */
+static int json_skip(const jsmntok_t *t, int count, int i) {
+    int end = t[i].end;
+
+    for (i++; i < count && t[i].start < end; i++)
+        ;
+
+    return i;
+}
+
+static char *json_strdup(const char *json, const jsmntok_t *tok) {
+    return strndup(json + tok->start, tok->end - tok->start);
+}
+
+/**
+ * Copy up to `max` elements of the array `t[i]` into `out`, nested arrays
+ * and objects (e.g. the merkle branches of a Bitcoin-style `mining.notify`)
+ * are copied as raw JSON.
+ **/
+static void json_array(const char *json, const jsmntok_t *t, int count,
+                       int i, char **out, int max) {
+    int size = t[i].size;
+
+    i++;
+
+    for (int j = 0; j < size && i < count; j++) {
+        // A key sent twice replaces the first value instead of leaking it.
+        if (j < max) {
+            free(out[j]);
+            out[j] = json_strdup(json, &t[i]);
+        }
+
+        i = json_skip(t, count, i);
+    }
+}
+
 stratum_response_t *stratum_parse_response(const char *data) {
     // Assume data has been split by '\n'.
     assert(strchr(data, '\n') == NULL);
@@ -60,6 +192,9 @@ stratum_response_t *stratum_parse_response(const char *data) {
     jsmn_parser parser;
     jsmntok_t t[128];
 
+    if (stratum_data == NULL)
+        return NULL;
+
     jsmn_init(&parser);
 
     int ret =
@@ -71,209 +206,838 @@ stratum_response_t *stratum_parse_response(const char *data) {
         return stratum_data;
     }
 
-    for (int i = 1; i < ret; i++) {
+    // Keys and values alternate, values may span several tokens.
+    for (int i = 1; i + 1 < ret; i = json_skip(t, ret, i + 1)) {
         jsmntok_t *x = &t[i + 1];
-        size_t size;
-        char *tmp = NULL;
-
-        // printf("key: %.*s ", t[i].end - t[i].start, data + t[i].start);
-        // printf("value: %.*s\n", x->end - x->start, data + x->start);
 
         if (jsoneq(data, &t[i], "id") == 0) {
-            size =
-                snprintf(NULL, 0, "%.*s", x->end - x->start, data + x->start);
-            tmp = calloc(1, size + 1);
-            snprintf(tmp, size + 1, "%.*s", x->end - x->start, data + x->start);
-
             if (strncmp(data + x->start, "null", x->end - x->start) == 0)
                 stratum_data->id = 0;
             else
-                stratum_data->id = strtol(tmp, NULL, 10);
-
+                stratum_data->id = strtol(data + x->start, NULL, 10);
         } else if (jsoneq(data, &t[i], "result") == 0) {
             if (x->type != JSMN_ARRAY) {
-                size = snprintf(NULL, 0, "%.*s", x->end - x->start,
-                                data + x->start);
-                tmp = calloc(1, size + 1);
-                snprintf(tmp, size + 1, "%.*s", x->end - x->start,
-                         data + x->start);
-
-                stratum_data->result[0] = strdup(tmp);
-                stratum_data->result[1] = NULL;
-            } else {
-                for (int j = 0; j < x->size; j++) {
-                    jsmntok_t *g = &t[i + j + 2];
-                    size = snprintf(NULL, 0, "%.*s", g->end - g->start,
-                                    data + g->start);
-                    stratum_data->result[j] = calloc(1, size + 1);
-
-                    snprintf(stratum_data->result[j], size + 1, "%.*s",
-                             g->end - g->start, data + g->start);
-                }
-
-                i += t[i + 1].size + 1;
-            }
+                free(stratum_data->result[0]);
+                stratum_data->result[0] = json_strdup(data, x);
+            } else
+                json_array(data, t, ret, i + 1, stratum_data->result,
+                           STRATUM_MAX_RESULTS);
         } else if (jsoneq(data, &t[i], "method") == 0) {
-            size =
-                snprintf(NULL, 0, "%.*s", x->end - x->start, data + x->start);
-            tmp = calloc(1, size + 1);
-            snprintf(tmp, size + 1, "%.*s", x->end - x->start, data + x->start);
-
-            stratum_data->method = strdup(tmp);
+            free(stratum_data->method);
+            stratum_data->method = json_strdup(data, x);
         } else if (jsoneq(data, &t[i], "error") == 0) {
-            if (x->type != JSMN_ARRAY)
-                continue; // We expected an array of strings.
+            // We expected an array of strings.
+            if (x->type == JSMN_ARRAY)
+                json_array(data, t, ret, i + 1, stratum_data->error,
+                           STRATUM_MAX_ERRORS);
+        } else if (jsoneq(data, &t[i], "params") == 0) {
+            // We expected an array of strings.
+            if (x->type == JSMN_ARRAY)
+                json_array(data, t, ret, i + 1, stratum_data->params,
+                           STRATUM_MAX_PARAMS);
+        } else if (x->type == JSMN_STRING) {
+            DEBUG_LOG("Did not match any in parsing switch, got `%.*s`",
+                      x->end - x->start, data + x->start);
+        }
+    }
+
+    return stratum_data;
+}
 
-            for (int j = 0; j < x->size; j++) {
-                jsmntok_t *g = &t[i + j + 2];
-                size = snprintf(NULL, 0, "%.*s", g->end - g->start,
-                                data + g->start);
-                stratum_data->error[j] = calloc(1, size + 1);
+stratum_response_t *stratum_parse_request(const char *data) {
+    stratum_response_t *req = stratum_parse_response(data);
 
-                snprintf(stratum_data->error[j], size + 1, "%.*s",
-                         g->end - g->start, data + g->start);
-            }
+    if (req == NULL)
+        return NULL;
 
-            i += t[i + 1].size + 1;
-        } else if (jsoneq(data, &t[i], "params") == 0) {
-            if (x->type != JSMN_ARRAY)
-                continue; // We expected an array of strings.
+    // Requests MUST carry a method, notifications from the client (id null)
+    // are not part of zip-301.
+    if (req->method == NULL || req->id == 0)
+        req->id = -1;
 
-            for (int j = 0; j < x->size; j++) {
-                jsmntok_t *g = &t[i + j + 2];
-                size = snprintf(NULL, 0, "%.*s", g->end - g->start,
-                                data + g->start);
-                stratum_data->params[j] = calloc(1, size + 1);
+    return req;
+}
 
-                snprintf(stratum_data->params[j], size + 1, "%.*s",
-                         g->end - g->start, data + g->start);
-            }
+void stratum_response_free(stratum_response_t *res) {
+    if (res == NULL)
+        return;
+
+    for (int i = 0; i < STRATUM_MAX_RESULTS; i++)
+        free(res->result[i]);
+
+    for (int i = 0; i < STRATUM_MAX_ERRORS; i++)
+        free(res->error[i]);
+
+    for (int i = 0; i < STRATUM_MAX_PARAMS; i++)
+        free(res->params[i]);
+
+    free(res->method);
+    free(res);
+}
+
+stratum_method_t stratum_method_from_string(const char *method) {
+    static const struct {
+        const char *name;
+        stratum_method_t method;
+    } methods[] = {
+        {"mining.subscribe", STRATUM_METHOD_SUBSCRIBE},
+        {"mining.authorize", STRATUM_METHOD_AUTHORIZE},
+        {"mining.set_target", STRATUM_METHOD_SET_TARGET},
+        {"mining.notify", STRATUM_METHOD_NOTIFY},
+        {"mining.submit", STRATUM_METHOD_SUBMIT},
+        {"mining.suggest_target", STRATUM_METHOD_SUGGEST_TARGET},
+        {"client.reconnect", STRATUM_METHOD_RECONNECT},
+        {"mining.set_difficulty", STRATUM_METHOD_SET_DIFFICULTY},
+    };
+
+    if (method == NULL)
+        return STRATUM_METHOD_UNKNOWN;
+
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+        if (strcmp(method, methods[i].name) == 0)
+            return methods[i].method;
+
+    return STRATUM_METHOD_UNKNOWN;
+}
+
+/* the method of a server notification, UNKNOWN for replies */
+static stratum_method_t notification_method(const stratum_response_t *res) {
+    if (res->id != 0)
+        return STRATUM_METHOD_UNKNOWN;
+
+    return stratum_method_from_string(res->method);
+}
+
+/* 1 if `res` is a `mining.notify` asking to drop the previous jobs */
+static int notification_clean(const stratum_response_t *res) {
+    int last = STRATUM_MAX_PARAMS - 1;
+
+    if (notification_method(res) != STRATUM_METHOD_NOTIFY)
+        return 0;
+
+    // clean_jobs is the last param of both ZIP-301 and Bitcoin-style jobs.
+    while (last > 0 && res->params[last] == NULL)
+        last--;
+
+    return res->params[last] != NULL && strcmp(res->params[last], "true") == 0;
+}
+
+/* 1 if `res` sets the target of the next job */
+static int notification_target(const stratum_response_t *res) {
+    stratum_method_t method = notification_method(res);
+
+    return method == STRATUM_METHOD_SET_TARGET ||
+           method == STRATUM_METHOD_SET_DIFFICULTY;
+}
+
+size_t stratum_coalesce(stratum_response_t **batch, size_t n) {
+    size_t clean = n, target = n, len = 0;
+
+    // The last clean job supersedes every job sent before it...
+    for (size_t i = n; i-- > 0;) {
+        if (notification_clean(batch[i])) {
+            clean = i;
+            break;
+        }
+    }
+
+    if (clean == n)
+        return n;
+
+    // ...and only the last target sent before it still applies to it.
+    for (size_t i = clean; i-- > 0;) {
+        if (notification_target(batch[i])) {
+            target = i;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        int superseded =
+            notification_method(batch[i]) == STRATUM_METHOD_NOTIFY ||
+            (notification_target(batch[i]) && i != target);
+
+        if (i < clean && superseded) {
+            DEBUG_LOG("Dropping superseded %s", batch[i]->method);
+            stratum_response_free(batch[i]);
+            continue;
+        }
+
+        batch[len++] = batch[i];
+    }
+
+    return len;
+}
+
+/* send `str`, counting the bytes sent for the kernel timestamps */
+static int send_line(stratum_session_t *session, int socket, const char *str) {
+    if (socket_send(socket, str) == -1)
+        return -1;
+
+    if (session != NULL && session->timing != NULL)
+        stratum_timing_sent(session->timing, strlen(str));
+
+    return 0;
+}
+
+/**
+ * The id of a request made for `worker`, `id` unless the session tracks its
+ * workers or journals its shares, which need every request to have its own
+ * id.
+ **/
+static long worker_request_id(stratum_session_t *session, const char *worker,
+                              stratum_worker_request_t type, long id) {
+    if (session == NULL)
+        return id;
+
+    // Otherwise an authorize reply sharing the id of a share would ack it.
+    if (session->workers == NULL)
+        return session->journal != NULL ? session->next_id++ : id;
+
+    id = session->workers->next_id++;
+
+    if (stratum_workers_track(session->workers, id, worker, type) == -1) {
+        CRITICAL_LOG("Failed to track the worker `%s`", worker);
+    }
+
+    return id;
+}
+
+/* submit a share of the journal again, without waiting for its reply */
+static long resubmit(const stratum_journal_share_t *share, void *arg) {
+    stratum_session_t *session = arg;
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    long id;
+    int ret;
+
+    // A new channel has new jobs, Stratum V2 shares never outlive theirs.
+    if (session->protocol == STRATUM_PROTOCOL_V2)
+        return -1;
+
+    id = worker_request_id(session, share->worker, STRATUM_WORKER_SUBMIT, 2);
+
+    stratum_writer_init(&w, line, sizeof(line), 1);
+    stratum_write_submit(&w, id, share->worker, share->job_id, share->time,
+                         share->nonce_2, share->solution);
+    stratum_writer_finish(&w);
+
+    ret = w.overflow ? -1 : send_line(session, session->socket, w.buf);
+    stratum_writer_free(&w);
+
+    return ret == -1 ? -1 : id;
+}
+
+/* hand the messages of `batch` to the session and `cb`, then free them */
+static void dispatch(stratum_session_t *session, int socket, stratum_cb_t cb,
+                     long submit_id, stratum_response_t **batch, size_t n) {
+    stratum_timing_t *timing = session != NULL ? session->timing : NULL;
+    uint64_t parsed = timing != NULL ? stratum_timing_now() : 0;
+
+    if (session != NULL && session->coalesce)
+        n = stratum_coalesce(batch, n);
+
+    for (size_t i = 0; i < n; i++) {
+        stratum_response_t *res = batch[i];
+
+        if (timing != NULL)
+            stratum_timing_record(timing, STRATUM_STAGE_WIRE_TO_PARSED,
+                                  timing->rx_wire, parsed);
+
+        if (session != NULL)
+            stratum_session_handle_response(session, res);
+
+        if (timing != NULL && submit_id != 0 && res->id == submit_id)
+            stratum_timing_ack(timing, submit_id);
+
+        if (cb != NULL)
+            cb(res, socket);
+
+        if (timing != NULL)
+            stratum_timing_record(timing, STRATUM_STAGE_PARSED_TO_DISPATCHED,
+                                  parsed, stratum_timing_now());
+
+        // The first job tells whether the journaled shares are still valid.
+        if (session != NULL && session->resubmit &&
+            notification_method(res) == STRATUM_METHOD_NOTIFY) {
+            session->resubmit = 0;
+            stratum_journal_resubmit(session->journal, resubmit, session);
+        }
+
+        stratum_response_free(res);
+    }
+}
+
+/**
+ * Handle the messages queued by the reader of `session`, waiting for the
+ * first one. Returns -1 if the reader stopped.
+ **/
+static int handle_queued(stratum_session_t *session, int socket,
+                         stratum_cb_t cb, long submit_id) {
+    stratum_timing_t *timing = session->timing;
+    stratum_response_t *batch[MAX_BATCH];
+    stratum_response_t *res;
+    uint64_t rx_ns;
+    size_t n = 0;
+
+    if (stratum_reader_wait(session->reader) == -1)
+        return -1;
+
+    // At most a batch, so a reader outpacing us cannot keep us here.
+    for (int i = 0; i < MAX_BATCH &&
+                    stratum_reader_pop(session->reader, &res, &rx_ns) == 1;
+         i++) {
+        if (timing != NULL)
+            timing->rx_wire = rx_ns;
+
+        batch[n++] = res;
+
+        if (!session->coalesce) {
+            dispatch(session, socket, cb, submit_id, batch, n);
+            n = 0;
+        }
+    }
+
+    dispatch(session, socket, cb, submit_id, batch, n);
+
+    return 0;
+}
+
+/**
+ * Read what the server sent and handle it, `submit_id` is the id of the
+ * request if it is a `mining.submit` (0 otherwise) to time its reply.
+ * Returns -1 if the connection failed.
+ **/
+static int handle(stratum_session_t *session, int socket, stratum_cb_t cb,
+                  long submit_id) {
+    stratum_timing_t *timing = session != NULL ? session->timing : NULL;
+    stratum_response_t *batch[MAX_BATCH];
+    stratum_buffer_t local, *rx;
+    int lines = 0;
+    ssize_t ret;
+
+    if (session != NULL && session->reader != NULL) {
+        ret = handle_queued(session, socket, cb, submit_id);
 
-            i += t[i + 1].size + 1;
+        if (timing != NULL)
+            stratum_timing_poll_tx(timing, socket);
+
+        return ret;
+    }
+
+    // A line cut short is finished by the next call on the session, without
+    // one it is read to its end before returning.
+    stratum_buffer_init(&local);
+    rx = session != NULL ? &session->rx : &local;
+
+    do {
+        size_t offset = 0, n = 0;
+        char *line;
+
+        if (stratum_buffer_reserve(rx, BUFSIZE) == -1) {
+            ret = -1;
+            break;
+        }
+
+        if (timing == NULL) {
+            ret = socket_read(socket, rx->data + rx->len, BUFSIZE);
         } else {
-            if (x->type == JSMN_STRING) {
-                DEBUG_LOG("Did not match any in parsing switch, got `%.*s`",
-                          x->end - x->start, data + x->start);
+            ret = socket_recv(socket, rx->data + rx->len, BUFSIZE,
+                              &timing->rx_wire);
+
+            // The request left long before its reply came back.
+            stratum_timing_poll_tx(timing, socket);
+        }
+
+        if (ret <= 0) {
+            CRITICAL_LOG("Read failure for fd(%d)", socket);
+            ret = -1;
+            break;
+        }
+
+        rx->len += ret;
+
+        while ((line = stratum_buffer_next_line(rx, &offset)) != NULL) {
+            stratum_response_t *res;
+
+            lines++;
+
+            if (*line == '\0')
+                continue;
+
+            DEBUG_LOG("Parsing %s", line);
+            res = stratum_parse_response(line);
+
+            if (res == NULL || res->id == -1) {
+                CRITICAL_LOG("Skipping unparsable line from fd(%d): %s",
+                             socket, line);
+                stratum_response_free(res);
+                continue;
+            }
+
+            DEBUG_LOG("Received: id %ld, method: %s, result: [%s, %s], "
+                      "errors: [%s, %s, %s]",
+                      res->id, res->method, res->result[0], res->result[1],
+                      res->error[0], res->error[1], res->error[2]);
+
+            if (res->id == 0) {
+                // Params have been given, print them to DEBUG.
+                DEBUG_LOG("params: [%s, %s, %s, %s, %s, %s, %s, %s]",
+                          res->params[0], res->params[1], res->params[2],
+                          res->params[3], res->params[4], res->params[5],
+                          res->params[6], res->params[7]);
+            }
+
+            batch[n++] = res;
+
+            // Without coalescing, every message is dispatched as soon as
+            // parsed.
+            if (session == NULL || !session->coalesce || n == MAX_BATCH) {
+                dispatch(session, socket, cb, submit_id, batch, n);
+                n = 0;
             }
         }
 
-        if (tmp != NULL) {
-            free(tmp);
-            i++;
+        dispatch(session, socket, cb, submit_id, batch, n);
+        stratum_buffer_consume(rx, offset);
+
+        if (rx->len > MAX_LINE_SIZE) {
+            CRITICAL_LOG("Line too long from fd(%d)", socket);
+            stratum_buffer_consume(rx, rx->len);
+            ret = -1;
+            break;
         }
+    } while (lines == 0 || (rx == &local && rx->len > 0));
+
+    stratum_buffer_free(&local);
+
+    return ret == -1 ? -1 : 0;
+}
+
+/* send `str` then handle what the server answers, see `handle()` */
+static int send_and_handle(int socket, const char *str, stratum_cb_t cb,
+                           long submit_id) {
+    stratum_session_t *session = stratum_session_lookup(socket);
+    stratum_timing_t *timing = session != NULL ? session->timing : NULL;
+    uint64_t start = timing != NULL ? stratum_timing_now() : 0;
+
+    if (send_line(session, socket, str) == -1)
+        return -1;
+
+    if (timing != NULL && submit_id != 0)
+        stratum_timing_submit(timing, submit_id, timing->tx_bytes, start);
+
+    return handle(session, socket, cb, submit_id);
+}
+
+/* the session attached to `socket` if it speaks Stratum V2, or NULL */
+static stratum_session_t *sv2_session(int socket) {
+    stratum_session_t *session = stratum_session_lookup(socket);
+
+    return session != NULL && session->protocol == STRATUM_PROTOCOL_V2
+               ? session
+               : NULL;
+}
+
+/* copy `src` into the STR0_255 `dst`, returns -1 if it is too long */
+static int sv2_copy(char *dst, const char *src) {
+    if (strlen(src) >= sizeof(stratum_sv2_str_t))
+        return -1;
+
+    strcpy(dst, src);
+
+    return 0;
+}
+
+/* parse the big-endian hex u32 `hex` */
+static int sv2_parse_u32(const char *hex, uint32_t *out) {
+    char *end;
+
+    if (*hex == '\0' || strlen(hex) > 8)
+        return -1;
+
+    *out = strtoul(hex, &end, 16);
+
+    return *end == '\0' ? 0 : -1;
+}
+
+/* send the frame of `msg`, counting its bytes for the kernel timestamps */
+static int sv2_send(stratum_session_t *session,
+                    const stratum_sv2_message_t *msg) {
+    stratum_buffer_t buf;
+
+    stratum_buffer_init(&buf);
+
+    if (stratum_sv2_encode(&buf, msg) == -1) {
+        CRITICAL_LOG("Failed to encode the Stratum V2 message %#x", msg->type);
+        stratum_buffer_free(&buf);
+        return -1;
     }
 
-    return stratum_data;
+    if (socket_write(session->socket, buf.data, buf.len) == -1) {
+        stratum_buffer_free(&buf);
+        return -1;
+    }
+
+    if (session->timing != NULL)
+        stratum_timing_sent(session->timing, buf.len);
+
+    stratum_buffer_free(&buf);
+
+    return 0;
 }
 
-void stratum_mining_subscribe(int socket, const char *user_agent,
-                              const char *session_id, const char *host,
-                              const char *port, stratum_cb_t cb) {
-    size_t size = snprintf(NULL, 0, "[\"%s\", \"%s\", \"%s\", %s]", user_agent,
-                           session_id, host, port) +
-                  1;
-    char *params = calloc(1, size);
-    snprintf(params, size, "[\"%s\", \"%s\", \"%s\", %s]", user_agent,
-             session_id, host, port);
-
-    stratum_data_t data = {
-        .id = 1,
-        .method = "mining.subscribe",
-        .params = params,
-    };
+/* the id of the request `msg` answers, 0 if it is not a reply to a share */
+static long sv2_share_id(const stratum_sv2_message_t *msg) {
+    switch (msg->type) {
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS:
+        return msg->body.submit_shares_success.last_sequence_number;
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR:
+        return msg->body.submit_shares_error.sequence_number;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Hand `msg` to the session, then to `cb` as a stratum v1 shaped response.
+ * Nothing is allocated unless there is a callback.
+ **/
+static void sv2_dispatch(stratum_session_t *session, stratum_cb_t cb,
+                         long submit_id, const stratum_sv2_message_t *msg) {
+    stratum_timing_t *timing = session->timing;
+    uint64_t parsed = timing != NULL ? stratum_timing_now() : 0;
+    stratum_response_t *res;
+
+    if (timing != NULL)
+        stratum_timing_record(timing, STRATUM_STAGE_WIRE_TO_PARSED,
+                              timing->rx_wire, parsed);
+
+    stratum_session_handle_sv2(session, msg);
+
+    if (timing != NULL && submit_id != 0 && sv2_share_id(msg) == submit_id)
+        stratum_timing_ack(timing, submit_id);
+
+    if (cb != NULL && (res = stratum_sv2_to_response(msg)) != NULL) {
+        cb(res, session->socket);
+        stratum_response_free(res);
+    }
 
-    stratum_send_and_handle_data(socket, &data, cb);
+    if (timing != NULL)
+        stratum_timing_record(timing, STRATUM_STAGE_PARSED_TO_DISPATCHED,
+                              parsed, stratum_timing_now());
 }
 
-void stratum_mining_authorize(int socket, const char *username,
-                              const char *password, stratum_cb_t cb) {
-    size_t size = snprintf(NULL, 0, "[\"%s\", \"%s\"]", username, password);
-    char *params = calloc(1, size + 1);
-    snprintf(params, size + 1, "[\"%s\", \"%s\"]", username, password);
+/**
+ * Like `send_and_handle()` with Stratum V2 frames: reads until at least one
+ * frame came back and none is left halfway.
+ **/
+static int sv2_send_and_handle(stratum_session_t *session,
+                               const stratum_sv2_message_t *msg,
+                               stratum_cb_t cb, long submit_id) {
+    stratum_timing_t *timing = session->timing;
+    uint64_t start = timing != NULL ? stratum_timing_now() : 0;
+    stratum_buffer_t rx;
+    size_t offset = 0;
+    int frames = 0;
+    ssize_t ret;
 
-    stratum_data_t data = {
-        .id = 2,
-        .method = "mining.authorize",
-        .params = params,
-    };
+    if (sv2_send(session, msg) == -1)
+        return -1;
+
+    if (timing != NULL && submit_id != 0)
+        stratum_timing_submit(timing, submit_id, timing->tx_bytes, start);
+
+    stratum_buffer_init(&rx);
+
+    do {
+        stratum_sv2_message_t reply;
+
+        if (stratum_buffer_reserve(&rx, BUFSIZE) == -1)
+            break;
+
+        ret = socket_recv(session->socket, rx.data + rx.len, BUFSIZE,
+                          timing != NULL ? &timing->rx_wire : NULL);
+
+        if (ret <= 0) {
+            CRITICAL_LOG("Read failure for fd(%d)", session->socket);
+            ret = -1;
+            break;
+        }
+
+        rx.len += ret;
 
-    stratum_send_and_handle_data(socket, &data, cb);
+        if (timing != NULL)
+            stratum_timing_poll_tx(timing, session->socket);
+
+        while ((ret = stratum_sv2_decode(&reply, (uint8_t *)rx.data + offset,
+                                         rx.len - offset)) > 0) {
+            offset += ret;
+            frames++;
+            DEBUG_LOG("Received the Stratum V2 message %#x", reply.type);
+            sv2_dispatch(session, cb, submit_id, &reply);
+        }
+
+        if (ret == -1) {
+            CRITICAL_LOG("Malformed Stratum V2 frame on fd(%d)",
+                         session->socket);
+            break;
+        }
+    } while (frames == 0 || offset < rx.len);
+
+    stratum_buffer_free(&rx);
+
+    return ret == -1 ? -1 : 0;
 }
 
-void stratum_mining_submit(int socket, const char *worker, const char *job_id,
-                           const char *time, const char *nonce_2,
-                           char *solution, stratum_cb_t cb) {
-    size_t size = snprintf(NULL, 0, "[\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"]",
-                           worker, job_id, time, nonce_2, solution);
-    char *params = calloc(1, size + 1);
-    snprintf(params, size + 1, "[\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"]",
-             worker, job_id, time, nonce_2, solution);
+static int sv2_subscribe(stratum_session_t *session, const char *user_agent,
+                         const char *host, const char *port, stratum_cb_t cb) {
+    stratum_sv2_message_t msg = {.type = STRATUM_SV2_SETUP_CONNECTION};
+    stratum_sv2_setup_connection_t *m = &msg.body.setup_connection;
 
-    stratum_data_t data = {
-        .id = 2,
-        .method = "mining.submit",
-        .params = params,
-    };
+    m->protocol = STRATUM_SV2_PROTOCOL_MINING;
+    m->min_version = STRATUM_SV2_VERSION;
+    m->max_version = STRATUM_SV2_VERSION;
+    m->endpoint_port = strtoul(port, NULL, 10);
+
+    if (sv2_copy(m->endpoint_host, host) == -1 ||
+        sv2_copy(m->vendor, user_agent) == -1) {
+        CRITICAL_LOG("Too long a host or user agent for SetupConnection");
+        return -1;
+    }
 
-    stratum_send_and_handle_data(socket, &data, cb);
+    return sv2_send_and_handle(session, &msg, cb, 0);
 }
 
-void stratum_send_and_handle_data(int socket, stratum_data_t *data,
-                                  stratum_cb_t cb) {
-    char *str = stratum_serialize_data(data);
-    char *buf = calloc(1, BUFSIZE);
+static int sv2_authorize(stratum_session_t *session, long id,
+                         const char *username, stratum_cb_t cb) {
+    stratum_sv2_message_t msg = {
+        .type = STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL};
+    stratum_sv2_open_standard_mining_channel_t *m =
+        &msg.body.open_standard_mining_channel;
 
-    socket_send(socket, str);
-    socket_read(socket, buf, BUFSIZE);
+    m->request_id = id;
+    // Let the server pick any target.
+    memset(m->max_target, 0xff, sizeof(m->max_target));
 
-    char *_str, *token;
+    if (sv2_copy(m->user_identity, username) == -1) {
+        CRITICAL_LOG("Too long a username for OpenStandardMiningChannel");
+        return -1;
+    }
 
-    _str = strdup(buf);
-    // Split by '\n'.
-    while ((token = strsep(&_str, "\n"))) {
-        if (!strlen(token))
-            continue;
+    return sv2_send_and_handle(session, &msg, cb, 0);
+}
+
+static int sv2_submit(stratum_session_t *session, long id,
+                      const char *worker, const char *job_id, const char *time,
+                      const char *nonce, const char *version,
+                      stratum_cb_t cb) {
+    stratum_sv2_message_t msg = {.type = STRATUM_SV2_SUBMIT_SHARES_STANDARD};
+    stratum_sv2_submit_shares_standard_t *m = &msg.body.submit_shares_standard;
+    stratum_worker_t *owner = NULL;
+
+    if (session->workers != NULL)
+        owner = stratum_workers_find(session->workers, worker);
+
+    // Each worker mines on the channel opened for it.
+    m->channel_id = owner != NULL && owner->authorized ? owner->channel_id
+                                                       : session->channel_id;
+    m->sequence_number = id;
+
+    if (sv2_parse_u32(job_id, &m->job_id) == -1 ||
+        sv2_parse_u32(time, &m->ntime) == -1 ||
+        sv2_parse_u32(nonce, &m->nonce) == -1 ||
+        sv2_parse_u32(version, &m->version) == -1) {
+        CRITICAL_LOG("Invalid share for SubmitSharesStandard");
+        return -1;
+    }
+
+    return sv2_send_and_handle(session, &msg, cb, id);
+}
+
+static int sv2_suggest_target(stratum_session_t *session,
+                              const char *target) {
+    stratum_sv2_message_t msg = {.type = STRATUM_SV2_UPDATE_CHANNEL};
+    stratum_target_t parsed;
+
+    if (stratum_target_from_hex(&parsed, target) == -1) {
+        CRITICAL_LOG("Invalid target `%s`", target);
+        return -1;
+    }
+
+    msg.body.update_channel.channel_id = session->channel_id;
+    stratum_sv2_target_to_u256(&parsed,
+                               msg.body.update_channel.maximum_target);
+    return sv2_send(session, &msg);
+}
+
+int stratum_mining_subscribe(int socket, const char *user_agent,
+                             const char *session_id, const char *host,
+                             const char *port, stratum_cb_t cb) {
+    stratum_session_t *session = sv2_session(socket);
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    int ret = -1;
+
+    if (session != NULL) {
+        // SetupConnection has no SESSION_ID to resume.
+        return sv2_subscribe(session, user_agent, host, port, cb);
+    }
+
+    stratum_writer_init(&w, line, sizeof(line), 1);
+    stratum_write_subscribe(&w, 1, user_agent, session_id, host, port);
+    stratum_writer_finish(&w);
+
+    if (!w.overflow)
+        ret = send_and_handle(socket, w.buf, cb, 0);
+
+    stratum_writer_free(&w);
+
+    return ret;
+}
+
+int stratum_mining_authorize(int socket, const char *username,
+                             const char *password, stratum_cb_t cb) {
+    stratum_session_t *session = stratum_session_lookup(socket);
+    long id =
+        worker_request_id(session, username, STRATUM_WORKER_AUTHORIZE, 2);
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    int ret = -1;
+
+    if (session != NULL && session->protocol == STRATUM_PROTOCOL_V2)
+        return sv2_authorize(session, id, username, cb);
+
+    stratum_writer_init(&w, line, sizeof(line), 1);
+    stratum_write_authorize(&w, id, username, password);
+    stratum_writer_finish(&w);
+
+    if (!w.overflow)
+        ret = send_and_handle(socket, w.buf, cb, 0);
 
-        DEBUG_LOG("Parsing %s", token);
-        stratum_response_t *res = stratum_parse_response(token);
-        DEBUG_LOG(
-            "Received: id %ld, method: %s, result: [%s, %s], errors: [%s, "
-            "%s, %s]",
-            res->id, res->method, res->result[0], res->result[1], res->error[0],
-            res->error[1], res->error[2]);
-
-        if (res->id == -1) {
-            // TODO(blaze): resend data?
-            err(EXIT_FAILURE,
-                "Failed to parse the response from the server.\n"
-                "Sent to the server: %s",
-                str);
-        } else if (res->id == 0) {
-            // Params have been given, print them to DEBUG.
-            DEBUG_LOG("params: [%s, %s, %s, %s, %s, %s, %s, %s]",
-                      res->params[0], res->params[1], res->params[2],
-                      res->params[3], res->params[4], res->params[5],
-                      res->params[6], res->params[7]);
+    stratum_writer_free(&w);
+
+    return ret;
+}
+
+int stratum_mining_submit(int socket, const char *worker, const char *job_id,
+                          const char *time, const char *nonce_2,
+                          char *solution, stratum_cb_t cb) {
+    stratum_session_t *session = stratum_session_lookup(socket);
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    int journaled = 0;
+    int ret = -1;
+    long id;
+
+    if (session != NULL && session->dedup != NULL &&
+        !stratum_dedup_check(session->dedup, job_id, time, nonce_2,
+                             solution)) {
+        DEBUG_LOG("Dropping duplicate share for job %s", job_id);
+        return 0;
+    }
+
+    id = worker_request_id(session, worker, STRATUM_WORKER_SUBMIT, 2);
+
+    // Journaled before it leaves, so a failed send can be retried.
+    if (session != NULL && session->journal != NULL) {
+        if (stratum_journal_append(session->journal, id, session->session_id,
+                                   session->nonce_1, worker, job_id, time,
+                                   nonce_2, solution) == 0) {
+            journaled = 1;
+        } else {
+            CRITICAL_LOG("The journal is full, share for job %s not recorded",
+                         job_id);
         }
+    }
 
-        if (cb != NULL)
-            cb(res, socket);
+    if (session != NULL && session->protocol == STRATUM_PROTOCOL_V2) {
+        ret = sv2_submit(session, id, worker, job_id, time, nonce_2, solution,
+                         cb);
+    } else {
+        stratum_writer_init(&w, line, sizeof(line), 1);
+        stratum_write_submit(&w, id, worker, job_id, time, nonce_2, solution);
+        stratum_writer_finish(&w);
 
-        for (int i = 0; i < 2; i++)
-            if (res->result[i] != NULL)
-                free(res->result[i]);
+        if (!w.overflow)
+            ret = send_and_handle(socket, w.buf, cb, id);
+
+        stratum_writer_free(&w);
+    }
+
+    // Unless the journal submits it again, the caller retrying it must not
+    // find it a duplicate.
+    if (ret == -1 && !journaled && session != NULL && session->dedup != NULL)
+        stratum_dedup_forget(session->dedup, job_id, time, nonce_2, solution);
+
+    // Only a share that left counts towards the rate.
+    if (ret == 0 && session != NULL)
+        stratum_session_handle_submit(session);
+
+    return ret;
+}
 
-        for (int i = 0; i < 8; i++)
-            free(res->params[i]);
+int stratum_mining_suggest_target(int socket, const char *target) {
+    stratum_session_t *session = sv2_session(socket);
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+
+    if (session != NULL)
+        return sv2_suggest_target(session, target);
+
+    stratum_writer_init(&w, line, sizeof(line), 0);
+    stratum_write_suggest_target(&w, 3, target);
+    stratum_writer_finish(&w);
+
+    if (w.overflow)
+        return -1;
+
+    return send_line(stratum_session_lookup(socket), socket, w.buf);
+}
+
+static int send_data(int socket, stratum_data_t *data, stratum_cb_t cb,
+                     int handle) {
+    char line[LINE_SIZE];
+    stratum_writer_t w;
+    int ret = -1;
+
+    if (sv2_session(socket) != NULL) {
+        CRITICAL_LOG("`%s` has no Stratum V2 counterpart", data->method);
+        return -1;
+    }
+
+    stratum_writer_init(&w, line, sizeof(line), 1);
+    stratum_writer_request(&w, data->id, data->method, data->params);
+    stratum_writer_finish(&w);
+
+    if (w.overflow)
+        CRITICAL_LOG("Failed to serialize `%s`", data->method);
+    else if (handle)
+        ret = send_and_handle(socket, w.buf, cb, 0);
+    else
+        ret = send_line(stratum_session_lookup(socket), socket, w.buf);
+
+    stratum_writer_free(&w);
+
+    return ret;
+}
+
+int stratum_send_data(int socket, stratum_data_t *data) {
+    return send_data(socket, data, NULL, 0);
+}
+
+int stratum_send_and_handle_data(int socket, stratum_data_t *data,
+                                 stratum_cb_t cb) {
+    return send_data(socket, data, cb, 1);
+}
 
-        free(res->error[0]);
-        free(res->error[1]);
-        free(res->error[2]);
-        free(res->method);
+int stratum_handle_data(int socket, stratum_cb_t cb) {
+    if (sv2_session(socket) != NULL) {
+        CRITICAL_LOG("fd(%d) speaks Stratum V2", socket);
+        return -1;
     }
 
-    free(_str);
-    free(buf);
+    return handle(stratum_session_lookup(socket), socket, cb, 0);
 }
 
 const char *stratum_error_code_to_string(uint8_t code) {
@@ -0,0 +1,685 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libstratum/sv2.h"
+
+#include "libstratum/hex.h"
+
+typedef struct {
+    stratum_buffer_t *buf;
+    int error;
+} sv2_writer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t left;
+    int error;
+} sv2_reader_t;
+
+static void put(sv2_writer_t *w, const void *data, size_t size) {
+    if (!w->error && stratum_buffer_append(w->buf, data, size) == -1)
+        w->error = 1;
+}
+
+/* append the `size` low bytes of `value` in little-endian */
+static void put_le(sv2_writer_t *w, uint64_t value, size_t size) {
+    uint8_t le[8];
+
+    for (size_t i = 0; i < size; i++)
+        le[i] = value >> (8 * i);
+
+    put(w, le, size);
+}
+
+static void put_f32(sv2_writer_t *w, float value) {
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    put_le(w, bits, 4);
+}
+
+/* STR0_255 */
+static void put_str(sv2_writer_t *w, const char *str) {
+    size_t len = strnlen(str, sizeof(stratum_sv2_str_t));
+
+    if (len == sizeof(stratum_sv2_str_t)) {
+        w->error = 1;
+        return;
+    }
+
+    put_le(w, len, 1);
+    put(w, str, len);
+}
+
+/* B0_32 */
+static void put_b032(sv2_writer_t *w, const uint8_t *data, size_t size) {
+    if (size > 32) {
+        w->error = 1;
+        return;
+    }
+
+    put_le(w, size, 1);
+    put(w, data, size);
+}
+
+static const uint8_t *take(sv2_reader_t *r, size_t size) {
+    const uint8_t *p = r->data;
+
+    if (r->error || size > r->left) {
+        r->error = 1;
+        return NULL;
+    }
+
+    r->data += size;
+    r->left -= size;
+
+    return p;
+}
+
+static uint64_t get_le(sv2_reader_t *r, size_t size) {
+    const uint8_t *p = take(r, size);
+    uint64_t value = 0;
+
+    for (size_t i = 0; p != NULL && i < size; i++)
+        value |= (uint64_t)p[i] << (8 * i);
+
+    return value;
+}
+
+static float get_f32(sv2_reader_t *r) {
+    uint32_t bits = get_le(r, 4);
+    float value;
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+static void get_bytes(sv2_reader_t *r, uint8_t *out, size_t size) {
+    const uint8_t *p = take(r, size);
+
+    if (p != NULL)
+        memcpy(out, p, size);
+}
+
+static void get_str(sv2_reader_t *r, char *out) {
+    size_t len = get_le(r, 1);
+    const uint8_t *p = take(r, len);
+
+    if (p != NULL)
+        memcpy(out, p, len);
+
+    out[p != NULL ? len : 0] = '\0';
+}
+
+/* B0_32 into `out`, returns its size */
+static uint8_t get_b032(sv2_reader_t *r, uint8_t *out) {
+    size_t len = get_le(r, 1);
+
+    if (len > 32) {
+        r->error = 1;
+        return 0;
+    }
+
+    get_bytes(r, out, len);
+
+    return len;
+}
+
+/* 1 if the messages of `type` are addressed to a channel */
+static int sv2_channel_msg(stratum_sv2_type_t type) {
+    switch (type) {
+    case STRATUM_SV2_NEW_MINING_JOB:
+    case STRATUM_SV2_UPDATE_CHANNEL:
+    case STRATUM_SV2_SUBMIT_SHARES_STANDARD:
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS:
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR:
+    case STRATUM_SV2_SET_NEW_PREV_HASH:
+    case STRATUM_SV2_SET_TARGET:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int sv2_encode_payload(sv2_writer_t *w,
+                              const stratum_sv2_message_t *msg) {
+    switch (msg->type) {
+    case STRATUM_SV2_SETUP_CONNECTION: {
+        const stratum_sv2_setup_connection_t *m = &msg->body.setup_connection;
+
+        put_le(w, m->protocol, 1);
+        put_le(w, m->min_version, 2);
+        put_le(w, m->max_version, 2);
+        put_le(w, m->flags, 4);
+        put_str(w, m->endpoint_host);
+        put_le(w, m->endpoint_port, 2);
+        put_str(w, m->vendor);
+        put_str(w, m->hardware_version);
+        put_str(w, m->firmware);
+        put_str(w, m->device_id);
+        break;
+    }
+    case STRATUM_SV2_SETUP_CONNECTION_SUCCESS: {
+        const stratum_sv2_setup_connection_success_t *m =
+            &msg->body.setup_connection_success;
+
+        put_le(w, m->used_version, 2);
+        put_le(w, m->flags, 4);
+        break;
+    }
+    case STRATUM_SV2_SETUP_CONNECTION_ERROR: {
+        const stratum_sv2_setup_connection_error_t *m =
+            &msg->body.setup_connection_error;
+
+        put_le(w, m->flags, 4);
+        put_str(w, m->error_code);
+        break;
+    }
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL: {
+        const stratum_sv2_open_standard_mining_channel_t *m =
+            &msg->body.open_standard_mining_channel;
+
+        put_le(w, m->request_id, 4);
+        put_str(w, m->user_identity);
+        put_f32(w, m->nominal_hash_rate);
+        put(w, m->max_target, 32);
+        break;
+    }
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS: {
+        const stratum_sv2_open_standard_mining_channel_success_t *m =
+            &msg->body.open_standard_mining_channel_success;
+
+        put_le(w, m->request_id, 4);
+        put_le(w, m->channel_id, 4);
+        put(w, m->target, 32);
+        put_b032(w, m->extranonce_prefix, m->extranonce_prefix_size);
+        put_le(w, m->group_channel_id, 4);
+        break;
+    }
+    case STRATUM_SV2_OPEN_MINING_CHANNEL_ERROR: {
+        const stratum_sv2_open_mining_channel_error_t *m =
+            &msg->body.open_mining_channel_error;
+
+        put_le(w, m->request_id, 4);
+        put_str(w, m->error_code);
+        break;
+    }
+    case STRATUM_SV2_NEW_MINING_JOB: {
+        const stratum_sv2_new_mining_job_t *m = &msg->body.new_mining_job;
+
+        put_le(w, m->channel_id, 4);
+        put_le(w, m->job_id, 4);
+        // OPTION[u32]
+        put_le(w, m->has_min_ntime != 0, 1);
+
+        if (m->has_min_ntime)
+            put_le(w, m->min_ntime, 4);
+
+        put_le(w, m->version, 4);
+        put_b032(w, m->merkle_root, 32);
+        break;
+    }
+    case STRATUM_SV2_UPDATE_CHANNEL: {
+        const stratum_sv2_update_channel_t *m = &msg->body.update_channel;
+
+        put_le(w, m->channel_id, 4);
+        put_f32(w, m->nominal_hash_rate);
+        put(w, m->maximum_target, 32);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_STANDARD: {
+        const stratum_sv2_submit_shares_standard_t *m =
+            &msg->body.submit_shares_standard;
+
+        put_le(w, m->channel_id, 4);
+        put_le(w, m->sequence_number, 4);
+        put_le(w, m->job_id, 4);
+        put_le(w, m->nonce, 4);
+        put_le(w, m->ntime, 4);
+        put_le(w, m->version, 4);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS: {
+        const stratum_sv2_submit_shares_success_t *m =
+            &msg->body.submit_shares_success;
+
+        put_le(w, m->channel_id, 4);
+        put_le(w, m->last_sequence_number, 4);
+        put_le(w, m->new_submits_accepted_count, 4);
+        put_le(w, m->new_shares_sum, 8);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR: {
+        const stratum_sv2_submit_shares_error_t *m =
+            &msg->body.submit_shares_error;
+
+        put_le(w, m->channel_id, 4);
+        put_le(w, m->sequence_number, 4);
+        put_str(w, m->error_code);
+        break;
+    }
+    case STRATUM_SV2_SET_NEW_PREV_HASH: {
+        const stratum_sv2_set_new_prev_hash_t *m = &msg->body.set_new_prev_hash;
+
+        put_le(w, m->channel_id, 4);
+        put_le(w, m->job_id, 4);
+        put(w, m->prev_hash, 32);
+        put_le(w, m->min_ntime, 4);
+        put_le(w, m->nbits, 4);
+        break;
+    }
+    case STRATUM_SV2_SET_TARGET: {
+        const stratum_sv2_set_target_t *m = &msg->body.set_target;
+
+        put_le(w, m->channel_id, 4);
+        put(w, m->maximum_target, 32);
+        break;
+    }
+    default:
+        return -1;
+    }
+
+    return w->error ? -1 : 0;
+}
+
+int stratum_sv2_encode(stratum_buffer_t *buf,
+                       const stratum_sv2_message_t *msg) {
+    sv2_writer_t w = {.buf = buf, .error = 0};
+    size_t start = buf->len;
+    size_t length;
+    uint8_t *header;
+
+    put_le(&w, sv2_channel_msg(msg->type) ? STRATUM_SV2_CHANNEL_MSG : 0, 2);
+    put_le(&w, msg->type, 1);
+    // MSG_LENGTH, filled in once the payload is written.
+    put_le(&w, 0, 3);
+
+    if (sv2_encode_payload(&w, msg) == -1) {
+        buf->len = start;
+        return -1;
+    }
+
+    header = (uint8_t *)buf->data + start;
+    length = buf->len - start - STRATUM_SV2_HEADER_SIZE;
+
+    for (int i = 0; i < 3; i++)
+        header[3 + i] = length >> (8 * i);
+
+    return 0;
+}
+
+static void sv2_decode_payload(sv2_reader_t *r, stratum_sv2_message_t *msg) {
+    switch (msg->type) {
+    case STRATUM_SV2_SETUP_CONNECTION: {
+        stratum_sv2_setup_connection_t *m = &msg->body.setup_connection;
+
+        m->protocol = get_le(r, 1);
+        m->min_version = get_le(r, 2);
+        m->max_version = get_le(r, 2);
+        m->flags = get_le(r, 4);
+        get_str(r, m->endpoint_host);
+        m->endpoint_port = get_le(r, 2);
+        get_str(r, m->vendor);
+        get_str(r, m->hardware_version);
+        get_str(r, m->firmware);
+        get_str(r, m->device_id);
+        break;
+    }
+    case STRATUM_SV2_SETUP_CONNECTION_SUCCESS: {
+        stratum_sv2_setup_connection_success_t *m =
+            &msg->body.setup_connection_success;
+
+        m->used_version = get_le(r, 2);
+        m->flags = get_le(r, 4);
+        break;
+    }
+    case STRATUM_SV2_SETUP_CONNECTION_ERROR: {
+        stratum_sv2_setup_connection_error_t *m =
+            &msg->body.setup_connection_error;
+
+        m->flags = get_le(r, 4);
+        get_str(r, m->error_code);
+        break;
+    }
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL: {
+        stratum_sv2_open_standard_mining_channel_t *m =
+            &msg->body.open_standard_mining_channel;
+
+        m->request_id = get_le(r, 4);
+        get_str(r, m->user_identity);
+        m->nominal_hash_rate = get_f32(r);
+        get_bytes(r, m->max_target, 32);
+        break;
+    }
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS: {
+        stratum_sv2_open_standard_mining_channel_success_t *m =
+            &msg->body.open_standard_mining_channel_success;
+
+        m->request_id = get_le(r, 4);
+        m->channel_id = get_le(r, 4);
+        get_bytes(r, m->target, 32);
+        m->extranonce_prefix_size = get_b032(r, m->extranonce_prefix);
+        m->group_channel_id = get_le(r, 4);
+        break;
+    }
+    case STRATUM_SV2_OPEN_MINING_CHANNEL_ERROR: {
+        stratum_sv2_open_mining_channel_error_t *m =
+            &msg->body.open_mining_channel_error;
+
+        m->request_id = get_le(r, 4);
+        get_str(r, m->error_code);
+        break;
+    }
+    case STRATUM_SV2_NEW_MINING_JOB: {
+        stratum_sv2_new_mining_job_t *m = &msg->body.new_mining_job;
+
+        m->channel_id = get_le(r, 4);
+        m->job_id = get_le(r, 4);
+        m->has_min_ntime = get_le(r, 1);
+
+        if (m->has_min_ntime > 1)
+            r->error = 1;
+        else if (m->has_min_ntime)
+            m->min_ntime = get_le(r, 4);
+
+        m->version = get_le(r, 4);
+
+        if (get_b032(r, m->merkle_root) != 32)
+            r->error = 1;
+        break;
+    }
+    case STRATUM_SV2_UPDATE_CHANNEL: {
+        stratum_sv2_update_channel_t *m = &msg->body.update_channel;
+
+        m->channel_id = get_le(r, 4);
+        m->nominal_hash_rate = get_f32(r);
+        get_bytes(r, m->maximum_target, 32);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_STANDARD: {
+        stratum_sv2_submit_shares_standard_t *m =
+            &msg->body.submit_shares_standard;
+
+        m->channel_id = get_le(r, 4);
+        m->sequence_number = get_le(r, 4);
+        m->job_id = get_le(r, 4);
+        m->nonce = get_le(r, 4);
+        m->ntime = get_le(r, 4);
+        m->version = get_le(r, 4);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS: {
+        stratum_sv2_submit_shares_success_t *m =
+            &msg->body.submit_shares_success;
+
+        m->channel_id = get_le(r, 4);
+        m->last_sequence_number = get_le(r, 4);
+        m->new_submits_accepted_count = get_le(r, 4);
+        m->new_shares_sum = get_le(r, 8);
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR: {
+        stratum_sv2_submit_shares_error_t *m = &msg->body.submit_shares_error;
+
+        m->channel_id = get_le(r, 4);
+        m->sequence_number = get_le(r, 4);
+        get_str(r, m->error_code);
+        break;
+    }
+    case STRATUM_SV2_SET_NEW_PREV_HASH: {
+        stratum_sv2_set_new_prev_hash_t *m = &msg->body.set_new_prev_hash;
+
+        m->channel_id = get_le(r, 4);
+        m->job_id = get_le(r, 4);
+        get_bytes(r, m->prev_hash, 32);
+        m->min_ntime = get_le(r, 4);
+        m->nbits = get_le(r, 4);
+        break;
+    }
+    case STRATUM_SV2_SET_TARGET: {
+        stratum_sv2_set_target_t *m = &msg->body.set_target;
+
+        m->channel_id = get_le(r, 4);
+        get_bytes(r, m->maximum_target, 32);
+        break;
+    }
+    default:
+        msg->type = STRATUM_SV2_UNKNOWN;
+        return;
+    }
+
+    // Trailing bytes are as malformed as missing ones.
+    if (r->left != 0)
+        r->error = 1;
+}
+
+ssize_t stratum_sv2_decode(stratum_sv2_message_t *msg, const uint8_t *data,
+                           size_t size) {
+    sv2_reader_t r = {.data = data, .left = size, .error = 0};
+    uint16_t extension;
+    size_t length;
+
+    if (size < STRATUM_SV2_HEADER_SIZE)
+        return 0;
+
+    extension = get_le(&r, 2);
+    msg->type = get_le(&r, 1);
+    length = get_le(&r, 3);
+
+    if (r.left < length)
+        return 0;
+
+    r.left = length;
+
+    // The messages of extensions are skipped like unknown ones.
+    if ((extension & ~STRATUM_SV2_CHANNEL_MSG) != 0)
+        msg->type = STRATUM_SV2_UNKNOWN;
+    else
+        sv2_decode_payload(&r, msg);
+
+    return r.error ? -1 : (ssize_t)(STRATUM_SV2_HEADER_SIZE + length);
+}
+
+/* store `value` into `field`, returns -1 if it failed to be allocated */
+static int sv2_set(char **field, char *value) {
+    *field = value;
+
+    return value == NULL ? -1 : 0;
+}
+
+static char *sv2_u32(uint32_t value) {
+    char *str;
+
+    return asprintf(&str, "%08x", value) == -1 ? NULL : str;
+}
+
+static char *sv2_hex(const uint8_t *data, size_t size) {
+    char *str = malloc(2 * size + 1);
+
+    if (str != NULL)
+        stratum_hex_encode(data, size, str);
+
+    return str;
+}
+
+/* the ZIP-301 code closest to the SV2 `error_code` */
+static const char *sv2_error_code(const char *error_code) {
+    static const struct {
+        const char *name;
+        const char *code;
+    } codes[] = {
+        {"stale-share", "21"},
+        {"duplicate-share", "22"},
+        {"difficulty-too-low", "23"},
+        {"invalid-channel-id", "24"},
+        {"unknown-user", "24"},
+    };
+
+    for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+        if (strcmp(error_code, codes[i].name) == 0)
+            return codes[i].code;
+
+    return "20";
+}
+
+/* a reply to the request `id`, failed with `error_code` unless NULL */
+static int sv2_reply(stratum_response_t *res, long id,
+                     const char *error_code) {
+    res->id = id;
+
+    if (error_code == NULL)
+        return sv2_set(&res->result[0], strdup("true"));
+
+    return sv2_set(&res->result[0], strdup("null")) == -1 ||
+                   sv2_set(&res->error[0],
+                           strdup(sv2_error_code(error_code))) == -1 ||
+                   sv2_set(&res->error[1], strdup(error_code)) == -1 ||
+                   sv2_set(&res->error[2], strdup("null")) == -1
+               ? -1
+               : 0;
+}
+
+static int sv2_notification(stratum_response_t *res,
+                            const stratum_sv2_message_t *msg) {
+    stratum_target_t target;
+    char **params = res->params;
+
+    switch (msg->type) {
+    case STRATUM_SV2_NEW_MINING_JOB: {
+        const stratum_sv2_new_mining_job_t *m = &msg->body.new_mining_job;
+
+        return sv2_set(&res->method, strdup("mining.new_mining_job")) == -1 ||
+                       sv2_set(&params[0], sv2_u32(m->channel_id)) == -1 ||
+                       sv2_set(&params[1], sv2_u32(m->job_id)) == -1 ||
+                       sv2_set(&params[2], m->has_min_ntime
+                                               ? sv2_u32(m->min_ntime)
+                                               : strdup("null")) == -1 ||
+                       sv2_set(&params[3], sv2_u32(m->version)) == -1 ||
+                       sv2_set(&params[4], sv2_hex(m->merkle_root, 32)) == -1
+                   ? -1
+                   : 0;
+    }
+    case STRATUM_SV2_SET_NEW_PREV_HASH: {
+        const stratum_sv2_set_new_prev_hash_t *m = &msg->body.set_new_prev_hash;
+
+        return sv2_set(&res->method, strdup("mining.set_new_prev_hash")) ==
+                           -1 ||
+                       sv2_set(&params[0], sv2_u32(m->channel_id)) == -1 ||
+                       sv2_set(&params[1], sv2_u32(m->job_id)) == -1 ||
+                       sv2_set(&params[2], sv2_hex(m->prev_hash, 32)) == -1 ||
+                       sv2_set(&params[3], sv2_u32(m->min_ntime)) == -1 ||
+                       sv2_set(&params[4], sv2_u32(m->nbits)) == -1
+                   ? -1
+                   : 0;
+    }
+    case STRATUM_SV2_SET_TARGET:
+        // The target comes first, as in ZIP-301's `mining.set_target`.
+        stratum_sv2_target_from_u256(&target,
+                                     msg->body.set_target.maximum_target);
+
+        return sv2_set(&res->method, strdup("mining.set_target")) == -1 ||
+                       sv2_set(&params[0], sv2_hex(target.bytes, 32)) == -1 ||
+                       sv2_set(&params[1],
+                               sv2_u32(msg->body.set_target.channel_id)) == -1
+                   ? -1
+                   : 0;
+    default:
+        return -1;
+    }
+}
+
+stratum_response_t *stratum_sv2_to_response(const stratum_sv2_message_t *msg) {
+    stratum_response_t *res;
+    int ret;
+
+    if ((res = calloc(1, sizeof(stratum_response_t))) == NULL)
+        return NULL;
+
+    switch (msg->type) {
+    case STRATUM_SV2_SETUP_CONNECTION_SUCCESS:
+        // The id `stratum_mining_subscribe()` uses.
+        ret = sv2_reply(res, 1, NULL);
+        break;
+    case STRATUM_SV2_SETUP_CONNECTION_ERROR:
+        ret = sv2_reply(res, 1, msg->body.setup_connection_error.error_code);
+        break;
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS: {
+        const stratum_sv2_open_standard_mining_channel_success_t *m =
+            &msg->body.open_standard_mining_channel_success;
+
+        ret = sv2_reply(res, m->request_id, NULL) == -1 ||
+                      sv2_set(&res->result[1],
+                              sv2_hex(m->extranonce_prefix,
+                                      m->extranonce_prefix_size)) == -1
+                  ? -1
+                  : 0;
+        break;
+    }
+    case STRATUM_SV2_OPEN_MINING_CHANNEL_ERROR:
+        ret = sv2_reply(res, msg->body.open_mining_channel_error.request_id,
+                        msg->body.open_mining_channel_error.error_code);
+        break;
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS:
+        ret = sv2_reply(res,
+                        msg->body.submit_shares_success.last_sequence_number,
+                        NULL);
+        break;
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR:
+        ret = sv2_reply(res, msg->body.submit_shares_error.sequence_number,
+                        msg->body.submit_shares_error.error_code);
+        break;
+    default:
+        ret = sv2_notification(res, msg);
+        break;
+    }
+
+    if (ret == -1) {
+        stratum_response_free(res);
+        return NULL;
+    }
+
+    return res;
+}
+
+void stratum_sv2_target_from_u256(stratum_target_t *target,
+                                  const uint8_t u256[32]) {
+    for (int i = 0; i < 32; i++)
+        target->bytes[i] = u256[31 - i];
+}
+
+void stratum_sv2_target_to_u256(const stratum_target_t *target,
+                                uint8_t u256[32]) {
+    for (int i = 0; i < 32; i++)
+        u256[i] = target->bytes[31 - i];
+}
+
+static void sv2_store_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        out[i] = value >> (8 * i);
+}
+
+void stratum_sv2_header(const stratum_sv2_new_mining_job_t *job,
+                        const stratum_sv2_set_new_prev_hash_t *prev_hash,
+                        uint8_t header[80]) {
+    uint32_t ntime = prev_hash->min_ntime;
+
+    if (job->has_min_ntime && job->min_ntime > ntime)
+        ntime = job->min_ntime;
+
+    // VERSION || PREVHASH || MERKLEROOT || TIME || BITS || NONCE
+    sv2_store_u32(header, job->version);
+    memcpy(header + 4, prev_hash->prev_hash, 32);
+    memcpy(header + 36, job->merkle_root, 32);
+    sv2_store_u32(header + 68, ntime);
+    sv2_store_u32(header + 72, prev_hash->nbits);
+    sv2_store_u32(header + 76, 0);
+}
@@ -0,0 +1,130 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#include "libstratum/target.h"
+
+#include "libstratum/hex.h"
+#include "libstratum/sha256.h"
+
+int stratum_target_from_hex(stratum_target_t *target, const char *hex) {
+    size_t len = strlen(hex);
+    char padded[65];
+
+    if (len == 0 || len > 64)
+        return -1;
+
+    memset(padded, '0', 64 - len);
+    memcpy(padded + 64 - len, hex, len + 1);
+
+    return stratum_hex_decode(padded, target->bytes, sizeof(target->bytes)) ==
+                   sizeof(target->bytes)
+               ? 0
+               : -1;
+}
+
+int stratum_target_from_difficulty(stratum_target_t *target,
+                                   double difficulty) {
+    // 0xffff * 2^208 / difficulty, as `mant` * 2^`shift`.
+    double value;
+    uint64_t mant;
+    int shift = 208;
+
+    if (!(difficulty > 0))
+        return -1;
+
+    value = 0xffff / difficulty;
+
+    // Keep 63 significant bits, without pulling in libm.
+    for (; value >= 9223372036854775808.0; shift++)
+        value /= 2;
+
+    for (; value < 4611686018427387904.0 && shift > -64; shift--)
+        value *= 2;
+
+    mant = value;
+    memset(target->bytes, 0, sizeof(target->bytes));
+
+    if (shift > 256 - 63) {
+        memset(target->bytes, 0xff, sizeof(target->bytes));
+        return 0;
+    }
+
+    for (int bit = 0; bit < 64; bit++) {
+        int pos = shift + bit;
+
+        if ((mant >> bit & 1) && pos >= 0)
+            target->bytes[31 - pos / 8] |= 1 << pos % 8;
+    }
+
+    return 0;
+}
+
+void stratum_target_to_hex(const stratum_target_t *target, char *out) {
+    stratum_hex_encode(target->bytes, sizeof(target->bytes), out);
+}
+
+void stratum_target_scale(stratum_target_t *target, double factor) {
+    // `factor` as a fixed point number with 24 fractional bits (3 bytes).
+    uint64_t mul, carry = 0;
+    uint8_t out[36];
+
+    if (factor > 255)
+        factor = 255;
+    else if (factor < 0)
+        factor = 0;
+
+    mul = (uint64_t)(factor * (1 << 24));
+
+    // Little-endian multiplication, one byte at a time.
+    for (int i = 0; i < 32; i++) {
+        carry += target->bytes[31 - i] * mul;
+        out[i] = carry & 0xff;
+        carry >>= 8;
+    }
+
+    for (int i = 32; i < 36; i++, carry >>= 8)
+        out[i] = carry & 0xff;
+
+    if (out[35] != 0) {
+        memset(target->bytes, 0xff, sizeof(target->bytes));
+        return;
+    }
+
+    for (int i = 0; i < 32; i++)
+        target->bytes[31 - i] = out[i + 3];
+}
+
+int stratum_target_check_hash(const stratum_target_t *target,
+                              const uint8_t hash[32]) {
+    // Compare from the most significant byte, which is last in the hash.
+    for (int i = 0; i < 32; i++) {
+        if (hash[31 - i] < target->bytes[i])
+            return 1;
+        if (hash[31 - i] > target->bytes[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+int stratum_share_check(const stratum_target_t *target, const uint8_t *header,
+                        size_t header_size, const uint8_t *solution,
+                        size_t solution_size) {
+    stratum_sha256_t ctx;
+    uint8_t hash[32];
+
+    stratum_sha256_init(&ctx);
+    stratum_sha256_update(&ctx, header, header_size);
+    stratum_sha256_update(&ctx, solution, solution_size);
+    stratum_sha256_final(&ctx, hash);
+
+    stratum_sha256_init(&ctx);
+    stratum_sha256_update(&ctx, hash, sizeof(hash));
+    stratum_sha256_final(&ctx, hash);
+
+    return stratum_target_check_hash(target, hash);
+}
@@ -0,0 +1,129 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+#include <time.h>
+
+#include "libstratum/timing.h"
+
+#include "libstratum/connection.h"
+
+int stratum_timing_enable(stratum_timing_t *timing, int socket) {
+    memset(timing, 0, sizeof(stratum_timing_t));
+
+    return socket_enable_timestamping(socket);
+}
+
+uint64_t stratum_timing_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stratum_timing_record(stratum_timing_t *timing, stratum_stage_t stage,
+                           uint64_t start, uint64_t end) {
+    stratum_latency_t *latency = &timing->stages[stage];
+    uint64_t ns;
+
+    // Either side is missing if the kernel did not timestamp the data.
+    if (start == 0 || end == 0)
+        return;
+
+    // Kernel and process clocks agree, but be safe if the clock steps.
+    ns = end > start ? end - start : 0;
+
+    if (latency->count == 0 || ns < latency->min)
+        latency->min = ns;
+    if (ns > latency->max)
+        latency->max = ns;
+
+    latency->count++;
+    latency->total += ns;
+}
+
+void stratum_timing_sent(stratum_timing_t *timing, size_t size) {
+    timing->tx_bytes += size;
+}
+
+void stratum_timing_submit(stratum_timing_t *timing, long id, uint32_t end,
+                           uint64_t start) {
+    stratum_timing_submit_t *slot = NULL;
+
+    // Reuse the oldest slot if too many submits are waiting for a reply.
+    for (int i = 0; i < STRATUM_TIMING_PENDING; i++) {
+        stratum_timing_submit_t *s = &timing->submits[i];
+
+        if (s->id == 0) {
+            slot = s;
+            break;
+        }
+
+        if (slot == NULL || s->submit < slot->submit)
+            slot = s;
+    }
+
+    slot->id = id;
+    slot->end = end;
+    slot->submit = start;
+    slot->wire = 0;
+}
+
+void stratum_timing_poll_tx(stratum_timing_t *timing, int socket) {
+    uint32_t key;
+    uint64_t ns;
+
+    while (socket_tx_timestamp(socket, &key, &ns)) {
+        for (int i = 0; i < STRATUM_TIMING_PENDING; i++) {
+            stratum_timing_submit_t *s = &timing->submits[i];
+
+            // `key` numbers the last byte sent, which may be past the end of
+            // the request when several sends left in one packet.
+            if (s->id == 0 || s->wire != 0 || (int32_t)(key - (s->end - 1)) < 0)
+                continue;
+
+            s->wire = ns;
+            stratum_timing_record(timing, STRATUM_STAGE_SUBMIT_TO_WIRE,
+                                  s->submit, ns);
+        }
+    }
+}
+
+void stratum_timing_ack(stratum_timing_t *timing, long id) {
+    for (int i = 0; i < STRATUM_TIMING_PENDING; i++) {
+        stratum_timing_submit_t *s = &timing->submits[i];
+
+        if (s->id != id)
+            continue;
+
+        stratum_timing_record(timing, STRATUM_STAGE_WIRE_TO_ACK, s->wire,
+                              timing->rx_wire);
+        s->id = 0;
+        return;
+    }
+}
+
+uint64_t stratum_timing_mean(const stratum_timing_t *timing,
+                             stratum_stage_t stage) {
+    const stratum_latency_t *latency = &timing->stages[stage];
+
+    return latency->count > 0 ? latency->total / latency->count : 0;
+}
+
+const char *stratum_stage_to_string(stratum_stage_t stage) {
+    switch (stage) {
+    case STRATUM_STAGE_WIRE_TO_PARSED:
+        return "wire->parsed";
+    case STRATUM_STAGE_PARSED_TO_DISPATCHED:
+        return "parsed->dispatched";
+    case STRATUM_STAGE_SUBMIT_TO_WIRE:
+        return "submit->wire";
+    case STRATUM_STAGE_WIRE_TO_ACK:
+        return "wire->ack";
+    default:
+        return "UNKNOWN";
+    }
+}
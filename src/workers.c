@@ -0,0 +1,144 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <string.h>
+
+#include "libstratum/workers.h"
+
+void stratum_workers_init(stratum_workers_t *workers) {
+    memset(workers, 0, sizeof(stratum_workers_t));
+    workers->next_id = STRATUM_WORKERS_FIRST_ID;
+}
+
+stratum_worker_t *stratum_workers_find(stratum_workers_t *workers,
+                                       const char *name) {
+    for (int i = 0; i < workers->count; i++)
+        if (strcmp(workers->workers[i].name, name) == 0)
+            return &workers->workers[i];
+
+    return NULL;
+}
+
+int stratum_workers_track(stratum_workers_t *workers, long id,
+                          const char *name, stratum_worker_request_t type) {
+    stratum_worker_t *worker = stratum_workers_find(workers, name);
+    stratum_workers_pending_t *pending;
+
+    if (worker == NULL) {
+        if (workers->count == STRATUM_MAX_WORKERS ||
+            strlen(name) >= STRATUM_WORKER_NAME_SIZE)
+            return -1;
+
+        worker = &workers->workers[workers->count++];
+        strcpy(worker->name, name);
+    }
+
+    pending = &workers->pending[workers->head++ % STRATUM_WORKERS_PENDING];
+    pending->id = id;
+    pending->worker = worker - workers->workers;
+    pending->type = type;
+    pending->answered = 0;
+
+    return 0;
+}
+
+static stratum_workers_pending_t *workers_pending(stratum_workers_t *workers,
+                                                  long id) {
+    // Ids start at 1, 0 marks the unused entries.
+    if (id <= 0)
+        return NULL;
+
+    for (int i = 0; i < STRATUM_WORKERS_PENDING; i++)
+        if (workers->pending[i].id == id)
+            return &workers->pending[i];
+
+    return NULL;
+}
+
+stratum_worker_t *stratum_workers_lookup(stratum_workers_t *workers, long id) {
+    stratum_workers_pending_t *pending = workers_pending(workers, id);
+
+    return pending != NULL ? &workers->workers[pending->worker] : NULL;
+}
+
+/* account for the answer to the request `id`, `ok` if it succeeded */
+static stratum_worker_t *workers_answer(stratum_workers_t *workers, long id,
+                                        int ok) {
+    stratum_workers_pending_t *pending = workers_pending(workers, id);
+    stratum_worker_t *worker;
+
+    // Counted once, even if the server repeats itself.
+    if (pending == NULL || pending->answered)
+        return NULL;
+
+    pending->answered = 1;
+    worker = &workers->workers[pending->worker];
+
+    if (pending->type == STRATUM_WORKER_AUTHORIZE)
+        worker->authorized = ok;
+    else if (ok)
+        worker->accepted++;
+    else
+        worker->rejected++;
+
+    return worker;
+}
+
+void stratum_workers_handle_response(stratum_workers_t *workers,
+                                     const stratum_response_t *res) {
+    workers_answer(workers, res->id,
+                   res->result[0] != NULL &&
+                       strcmp(res->result[0], "true") == 0);
+}
+
+void stratum_workers_handle_sv2(stratum_workers_t *workers,
+                                const stratum_sv2_message_t *msg) {
+    stratum_worker_t *worker;
+
+    switch (msg->type) {
+    case STRATUM_SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS: {
+        const stratum_sv2_open_standard_mining_channel_success_t *m =
+            &msg->body.open_standard_mining_channel_success;
+
+        if ((worker = workers_answer(workers, m->request_id, 1)) != NULL)
+            worker->channel_id = m->channel_id;
+        break;
+    }
+    case STRATUM_SV2_OPEN_MINING_CHANNEL_ERROR:
+        workers_answer(workers, msg->body.open_mining_channel_error.request_id,
+                       0);
+        break;
+    case STRATUM_SV2_SUBMIT_SHARES_SUCCESS: {
+        const stratum_sv2_submit_shares_success_t *m =
+            &msg->body.submit_shares_success;
+
+        // One success may acknowledge every share of the channel so far.
+        for (int i = 0; i < STRATUM_WORKERS_PENDING; i++) {
+            stratum_workers_pending_t *pending = &workers->pending[i];
+
+            worker = &workers->workers[pending->worker];
+
+            if (pending->type == STRATUM_WORKER_SUBMIT && !pending->answered &&
+                worker->authorized && worker->channel_id == m->channel_id &&
+                pending->id <= m->last_sequence_number)
+                pending->answered = 1;
+        }
+
+        for (int i = 0; i < workers->count; i++) {
+            worker = &workers->workers[i];
+
+            if (worker->authorized && worker->channel_id == m->channel_id)
+                worker->accepted += m->new_submits_accepted_count;
+        }
+        break;
+    }
+    case STRATUM_SV2_SUBMIT_SHARES_ERROR:
+        workers_answer(workers, msg->body.submit_shares_error.sequence_number,
+                       0);
+        break;
+    default:
+        break;
+    }
+}
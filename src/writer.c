@@ -0,0 +1,260 @@
+//          Copyright Blaze 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libstratum/writer.h"
+
+#define MIN_HEAP_SIZE 256
+
+static int writer_reserve(stratum_writer_t *w, size_t size) {
+    // Keep room for the '\0'.
+    size_t need = w->len + size + 1, cap;
+    char *buf;
+
+    if (w->overflow)
+        return -1;
+
+    if (need <= w->size)
+        return 0;
+
+    if (!w->grow) {
+        w->overflow = 1;
+        return -1;
+    }
+
+    cap = w->size * 2 > MIN_HEAP_SIZE ? w->size * 2 : MIN_HEAP_SIZE;
+    while (cap < need)
+        cap *= 2;
+
+    if (w->owned) {
+        buf = realloc(w->buf, cap);
+    } else if ((buf = malloc(cap)) != NULL && w->len > 0) {
+        memcpy(buf, w->buf, w->len);
+    }
+
+    if (buf == NULL) {
+        w->overflow = 1;
+        return -1;
+    }
+
+    w->buf = buf;
+    w->size = cap;
+    w->owned = 1;
+
+    return 0;
+}
+
+/* length of the prefix of `str` which can be written without escaping */
+static size_t writer_plain_prefix(const char *str, size_t size) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                 _mm_cmpeq_epi8(v, backslash));
+
+        // Control characters are the bytes for which min(v, 0x1f) == v.
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        int mask = _mm_movemask_epi8(m);
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < size; i++) {
+        unsigned char c = str[i];
+
+        if (c == '"' || c == '\\' || c < 0x20)
+            return i;
+    }
+
+    return size;
+}
+
+void stratum_writer_init(stratum_writer_t *w, char *buf, size_t size,
+                         int grow) {
+    w->buf = buf;
+    w->size = buf != NULL ? size : 0;
+    w->len = 0;
+    w->grow = grow != 0;
+    w->owned = 0;
+    w->overflow = 0;
+    w->items = 0;
+}
+
+void stratum_writer_free(stratum_writer_t *w) {
+    if (w->owned)
+        free(w->buf);
+
+    w->buf = NULL;
+    w->size = 0;
+    w->owned = 0;
+}
+
+size_t stratum_writer_finish(stratum_writer_t *w) {
+    if (!w->overflow && w->buf != NULL)
+        w->buf[w->len] = '\0';
+
+    return w->len;
+}
+
+void stratum_writer_raw(stratum_writer_t *w, const char *data, size_t size) {
+    if (writer_reserve(w, size) == 0)
+        memcpy(w->buf + w->len, data, size);
+
+    w->len += size;
+}
+
+void stratum_writer_string(stratum_writer_t *w, const char *str) {
+    static const char digits[] = "0123456789abcdef";
+    size_t size = strlen(str);
+
+    stratum_writer_raw(w, "\"", 1);
+
+    for (;;) {
+        size_t n = writer_plain_prefix(str, size);
+        unsigned char c;
+
+        stratum_writer_raw(w, str, n);
+
+        if (n == size)
+            break;
+
+        c = str[n];
+        str += n + 1;
+        size -= n + 1;
+
+        switch (c) {
+        case '"':
+            stratum_writer_raw(w, "\\\"", 2);
+            break;
+        case '\\':
+            stratum_writer_raw(w, "\\\\", 2);
+            break;
+        case '\n':
+            stratum_writer_raw(w, "\\n", 2);
+            break;
+        case '\r':
+            stratum_writer_raw(w, "\\r", 2);
+            break;
+        case '\t':
+            stratum_writer_raw(w, "\\t", 2);
+            break;
+        default: {
+            char escaped[] = {'\\', 'u', '0', '0', digits[c >> 4],
+                              digits[c & 0xf]};
+
+            stratum_writer_raw(w, escaped, sizeof(escaped));
+            break;
+        }
+        }
+    }
+
+    stratum_writer_raw(w, "\"", 1);
+}
+
+void stratum_writer_long(stratum_writer_t *w, long value) {
+    char digits[24];
+    size_t i = sizeof(digits);
+    unsigned long v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    do {
+        digits[--i] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+
+    if (value < 0)
+        digits[--i] = '-';
+
+    stratum_writer_raw(w, digits + i, sizeof(digits) - i);
+}
+
+static void writer_request_prefix(stratum_writer_t *w, long id,
+                                  const char *method) {
+    static const char id_key[] = "{\"id\": ";
+    static const char method_key[] = ", \"method\": ";
+    static const char params_key[] = ", \"params\": ";
+
+    stratum_writer_raw(w, id_key, sizeof(id_key) - 1);
+
+    if (id == 0)
+        stratum_writer_raw(w, "null", 4);
+    else
+        stratum_writer_long(w, id);
+
+    stratum_writer_raw(w, method_key, sizeof(method_key) - 1);
+    stratum_writer_string(w, method);
+    stratum_writer_raw(w, params_key, sizeof(params_key) - 1);
+}
+
+void stratum_writer_request(stratum_writer_t *w, long id, const char *method,
+                            const char *params) {
+    writer_request_prefix(w, id, method);
+    stratum_writer_raw(w, params, strlen(params));
+    stratum_writer_raw(w, "}\n", 2);
+}
+
+void stratum_writer_begin_request(stratum_writer_t *w, long id,
+                                  const char *method) {
+    writer_request_prefix(w, id, method);
+    stratum_writer_raw(w, "[", 1);
+
+    w->items = 0;
+}
+
+void stratum_writer_param(stratum_writer_t *w, const char *str) {
+    if (str == NULL) {
+        stratum_writer_param_raw(w, "null");
+        return;
+    }
+
+    if (w->items++ > 0)
+        stratum_writer_raw(w, ", ", 2);
+
+    stratum_writer_string(w, str);
+}
+
+void stratum_writer_param_raw(stratum_writer_t *w, const char *json) {
+    if (w->items++ > 0)
+        stratum_writer_raw(w, ", ", 2);
+
+    stratum_writer_raw(w, json, strlen(json));
+}
+
+void stratum_writer_end_request(stratum_writer_t *w) {
+    stratum_writer_raw(w, "]}\n", 3);
+}
+
+void stratum_writer_result(stratum_writer_t *w, long id, const char *result,
+                           const char *error) {
+    static const char id_key[] = "{\"id\": ";
+    static const char result_key[] = ", \"result\": ";
+    static const char error_key[] = ", \"error\": ";
+
+    if (result == NULL)
+        result = "null";
+    if (error == NULL)
+        error = "null";
+
+    stratum_writer_raw(w, id_key, sizeof(id_key) - 1);
+    stratum_writer_long(w, id);
+    stratum_writer_raw(w, result_key, sizeof(result_key) - 1);
+    stratum_writer_raw(w, result, strlen(result));
+    stratum_writer_raw(w, error_key, sizeof(error_key) - 1);
+    stratum_writer_raw(w, error, strlen(error));
+    stratum_writer_raw(w, "}\n", 2);
+}